@@ -0,0 +1,105 @@
+#!/bin/bash
+# End-to-end latencies, handshake time and memory of rubi_server on a vcan
+# interface, for every count of background boards given (default: 0 30 100
+# 250). Counts which don't fit the standard addressing run in the extended
+# one. The interface is created if needed, which takes sudo and the vcan
+# module.
+#
+# Environment: CAN (vcan0), RATE and PROBE_RATE of the background boards
+# and of the probe in updates/s (100), DURATION in s (30), THREADS of the
+# emulator (1), OUT directory of the reports (latency_reports), ADDRESSING
+# to use for every count and SERVER_ARGS passed on to rubi_server.
+#
+# MODE is one of:
+#   node     - rubi_server as a node of its own, per-field topics (default)
+#   nodelet  - rubi_server in a standalone nodelet manager
+#   snapshot - rubi_server as a node, the bench reads the probe's snapshot
+#              topic, which is published on every update (_snapshot_batch:=1
+#              unless SERVER_ARGS say otherwise)
+# The server's CPU time over the whole run is added to every report, as is
+# its resident memory.
+
+set -e
+
+CAN=${CAN:-vcan0}
+RATE=${RATE:-100}
+PROBE_RATE=${PROBE_RATE:-100}
+DURATION=${DURATION:-30}
+THREADS=${THREADS:-1}
+OUT=${OUT:-latency_reports}
+MODE=${MODE:-node}
+BOARDS=${@:-0 30 100 250}
+
+if ! ip link show "$CAN" > /dev/null 2>&1; then
+    sudo modprobe vcan
+    sudo ip link add dev "$CAN" type vcan
+fi
+if ! ip link show "$CAN" | grep -q "UP"; then
+    sudo ip link set "$CAN" up
+fi
+
+PIDS=()
+cleanup()
+{
+    for pid in "${PIDS[@]}"; do
+        kill -INT "$pid" 2> /dev/null || true
+    done
+    wait
+}
+trap cleanup EXIT
+
+if ! rosnode list > /dev/null 2>&1; then
+    roscore > /dev/null &
+    PIDS+=($!)
+    until rosnode list > /dev/null 2>&1; do sleep 0.5; done
+fi
+
+case $MODE in
+    node)
+        SERVER="rubi_server rubi_server"
+        BENCH_ARGS="" ;;
+    nodelet)
+        SERVER="nodelet nodelet standalone rubi_server/RubiServerNodelet"
+        SERVER="$SERVER __name:=rubi_server"
+        BENCH_ARGS="" ;;
+    snapshot)
+        SERVER="rubi_server rubi_server"
+        SERVER_ARGS="_snapshot_batch:=1 $SERVER_ARGS"
+        BENCH_ARGS="_snapshot:=true" ;;
+    *)
+        echo "Unknown MODE $MODE" >&2
+        exit 1 ;;
+esac
+
+mkdir -p "$OUT"
+
+for boards in $BOARDS; do
+    # the probe takes an address as well, standard addressing has 126
+    addressing=${ADDRESSING:-$([ "$boards" -lt 126 ] && echo standard ||
+                               echo extended)}
+    report="$OUT/${MODE}_boards_$boards.yaml"
+    echo "=== $boards background boards, $addressing addressing, $MODE"
+
+    rosrun $SERVER _cans:="$CAN" _addressing:="$addressing" \
+        $SERVER_ARGS > /dev/null &
+    server=$!
+
+    rosrun rubi_server rubi_latency_bench _port:="$CAN" _boards:="$boards" \
+        _rate:="$RATE" _probe_rate:="$PROBE_RATE" _duration:="$DURATION" \
+        _threads:="$THREADS" _report:="$report" $BENCH_ARGS
+
+    # rosrun execs the server, so these are its own memory and user + system
+    # time, the latter in clock ticks
+    rss_kb=$(awk '/^VmRSS:/ { print $2 }' /proc/$server/status)
+    cpu_s=$(awk -v hz="$(getconf CLK_TCK)" \
+        '{ sub(/.*\) /, ""); printf "%.2f", ($12 + $13) / hz }' \
+        /proc/$server/stat)
+    echo "mode: $MODE" >> "$report"
+    echo "addressing: $addressing" >> "$report"
+    echo "server_rss_kb: $rss_kb" >> "$report"
+    echo "server_cpu_s: $cpu_s" >> "$report"
+    echo "server_rss_kb: $rss_kb, server_cpu_s: $cpu_s"
+
+    kill -INT $server
+    wait $server || true
+done
@@ -0,0 +1,76 @@
+#include "alloc_check.h"
+
+#ifdef RUBI_CHECK_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<uint64_t> violations{0};
+thread_local bool armed = false;
+
+void *Allocate(size_t size)
+{
+    if (armed)
+        violations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *ptr = malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+} // namespace
+
+AllocationCheck::Scope::Scope(bool arm) : was_armed(armed)
+{
+    armed = armed || arm;
+}
+
+AllocationCheck::Scope::~Scope() { armed = was_armed; }
+
+AllocationCheck::Pause::Pause() : was_armed(armed) { armed = false; }
+
+AllocationCheck::Pause::~Pause() { armed = was_armed; }
+
+bool AllocationCheck::IsCompiledIn() { return true; }
+
+uint64_t AllocationCheck::GetViolations() { return violations.load(); }
+
+void *operator new(size_t size) { return Allocate(size); }
+
+void *operator new[](size_t size) { return Allocate(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return Allocate(size);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+#else
+
+bool AllocationCheck::IsCompiledIn() { return false; }
+
+uint64_t AllocationCheck::GetViolations() { return 0; }
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <inttypes.h>
+
+// Debug check that the frame path does not allocate from the heap once the
+// boards are up, compiled in only with -DRUBI_CHECK_ALLOCATIONS, which
+// replaces the global operator new. Allocations a thread makes inside an
+// ALLOCATION_CHECK_SCOPE, or an ALLOCATION_CHECK_SCOPE_IF whose condition
+// holds, are counted as violations, unless they are made inside an
+// ALLOCATION_CHECK_PAUSE, e.g. by a frontend.
+namespace AllocationCheck
+{
+bool IsCompiledIn();
+// of all threads so far, always 0 if the check is not compiled in
+uint64_t GetViolations();
+} // namespace AllocationCheck
+
+#ifdef RUBI_CHECK_ALLOCATIONS
+
+namespace AllocationCheck
+{
+class Scope
+{
+    bool was_armed;
+
+  public:
+    Scope(bool arm = true);
+    ~Scope();
+};
+
+class Pause
+{
+    bool was_armed;
+
+  public:
+    Pause();
+    ~Pause();
+};
+} // namespace AllocationCheck
+
+#define ALLOCATION_CHECK_CONCAT_(a, b) a##b
+#define ALLOCATION_CHECK_CONCAT(a, b) ALLOCATION_CHECK_CONCAT_(a, b)
+
+#define ALLOCATION_CHECK_SCOPE() \
+    AllocationCheck::Scope ALLOCATION_CHECK_CONCAT(allocation_check_, __LINE__)
+#define ALLOCATION_CHECK_SCOPE_IF(condition)                          \
+    AllocationCheck::Scope ALLOCATION_CHECK_CONCAT(allocation_check_, \
+                                                   __LINE__)(condition)
+#define ALLOCATION_CHECK_PAUSE() \
+    AllocationCheck::Pause ALLOCATION_CHECK_CONCAT(allocation_check_, __LINE__)
+
+#else
+
+#define ALLOCATION_CHECK_SCOPE() \
+    do                           \
+    {                            \
+    } while (0)
+#define ALLOCATION_CHECK_SCOPE_IF(condition) \
+    do                                       \
+    {                                        \
+    } while (0)
+#define ALLOCATION_CHECK_PAUSE() \
+    do                           \
+    {                            \
+    } while (0)
+
+#endif
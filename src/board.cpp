@@ -1,6 +1,10 @@
 
+#include "alloc_check.h"
 #include "board.h"
 #include "exceptions.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
 #include <memory>
 
 BoardManager::BoardManager() {}
@@ -13,60 +17,220 @@ void BoardManager::Init(std::vector<std::string> cans_names)
         cans.emplace_back(
             std::pair<std::string, sptr<CanHandler>>(can_name, handler));
     }
+
+    cans_load.resize(cans.size());
+    cans_load_sampled = std::chrono::steady_clock::now();
+    scheduler.SchedulePeriodic(cans_load_sample_period,
+                               [this]() { SampleCansLoad(); });
+    scheduler.SchedulePeriodic(cans_load_report_period,
+                               [this]() { ReportCansUtilization(); });
+    scheduler.SchedulePeriodic(traffic_window,
+                               [this]() { traffic_analyzer.Sample(); });
+
+    scheduler.SchedulePeriodic(std::chrono::seconds(1),
+                               [this]() { loop_monitor.ReportOverruns(); });
+
+    if (AllocationCheck::IsCompiledIn())
+        scheduler.SchedulePeriodic(std::chrono::seconds(1),
+                                   [this]() { ReportAllocations(); });
+
+    if (emergency_stop_enabled)
+    {
+        emergency_stop = uptr<EmergencyStop>(
+            new EmergencyStop(cans_names, emergency_stop_socket,
+                              emergency_stop_priority, owns_process));
+    }
 }
 
 void BoardManager::Spin(std::chrono::system_clock::time_point time)
 {
-    std::vector<float> utilization;
-    bool dump_traffic_load = false;
+    loop_monitor.BeginPass();
+
+    // replies which came in while the server was busy are taken before the
+    // keep-alive checks can count them as missed
+    for (const auto &can_entry : cans)
+        can_entry.second->ReceiveFrames();
+    loop_monitor.EndStage(LoopMonitor::stage_bus);
 
-    if (std::chrono::duration_cast<std::chrono::seconds>(time - last_keepalive)
-            .count() >= cans_load_collection_time)
+    for (const auto &can_entry : cans)
+        can_entry.second->AdvanceTimers(time);
+    loop_monitor.EndStage(LoopMonitor::stage_keepalive);
+
+    scheduler.Advance(time);
+
+    if (emergency_stop)
     {
-        last_keepalive = time;
-        dump_traffic_load = true;
+        if (auto latencies = emergency_stop->PollLatencies())
+        {
+            LOG_WARNING(log, "Emergency stop has been broadcast on all buses!");
+            frontend->ReportEmergencyStop(*latencies);
+        }
     }
 
+    loop_monitor.EndStage(LoopMonitor::stage_timers);
+}
+
+void BoardManager::WaitForEvents()
+{
+    TRACE_SCOPE("wait", 0);
+
+    auto &fds = poll_fds;
+    fds.clear();
+
     for (const auto &can_entry : cans)
+        fds.push_back({can_entry.second->GetFd(), POLLIN, 0});
+
+    if (frontend->GetEventFd() >= 0)
+        fds.push_back({frontend->GetEventFd(), POLLIN, 0});
+
+    auto timeout = scheduler.GetResolution();
+    auto wait_start = std::chrono::steady_clock::now();
+    int ready = poll(fds.data(), fds.size(), timeout.count());
+
+    loop_monitor.EndWait(std::chrono::steady_clock::now() - wait_start,
+                         timeout, ready == 0);
+}
+
+void BoardManager::Run()
+{
+    if (realtime.enabled)
     {
-        can_entry.second->Tick(time);
-        if (dump_traffic_load)
-            utilization.push_back(can_entry.second->GetTrafficSoFar(true) /
-                                  cans_load_collection_time);
+        // mlockall and the malloc settings apply to the whole process, in a
+        // nodelet manager that's every other nodelet as well
+        if (realtime.lock_memory && !owns_process)
+            LOG_WARNING(log, "Not locking the memory inside of a nodelet "
+                             "manager.");
+        else if (realtime.lock_memory)
+            realtime.LockMemory();
+        realtime.ApplyToThread(pthread_self(), realtime.bus_thread, "bus");
     }
 
-    if (dump_traffic_load)
-        frontend->ReportCansUtilization(utilization);
+    while (!frontend->Quit())
+    {
+        auto time_now = std::chrono::system_clock::now();
+        Spin(time_now);
+        frontend->Spin();
+        Logger::Drain();
+        loop_monitor.EndStage(LoopMonitor::stage_frontend);
+        WaitForEvents();
+    }
+
+    Logger::Drain();
 }
 
-void BoardManager::RegisterNewHandler(
-    sptr<BoardCommunicationHandler> new_backend_handler)
+void BoardManager::Panic()
 {
-    sptr<BoardCommunicationHandler> old_backend_handler;
-    auto board_id = new_backend_handler->GetBoard().id;
-    sptr<BoardDescriptor> board_descriptor =
-        new_backend_handler->GetBoard().descriptor;
+    if (emergency_stop)
+    {
+        emergency_stop->Trigger();
+        return;
+    }
 
-    new_backend_handler->HandshakeComplete();
+    // without the fast path, the stop goes out through the regular one
+    LOG_WARNING(log, "Emergency stop is disabled, putting the boards to sleep "
+                     "through the buses' queues.");
+    for (const auto &can_entry : cans)
+        can_entry.second->BroadcastCommand(RUBI_COMMAND_SOFTSLEEP);
+}
 
-    std::map<sptr<BoardDescriptor>, std::vector<BoardInstance>>::iterator
-        handlers_bank = BoardManager::inst().handlers.end();
+void BoardManager::ReportAllocations()
+{
+    uint64_t violations = AllocationCheck::GetViolations();
+    if (violations == allocations_reported)
+        return;
+
+    LOG_WARNING(log, std::to_string(violations - allocations_reported) +
+                     " heap allocations on the frame path!");
+    allocations_reported = violations;
+}
+
+void BoardManager::SampleCansLoad()
+{
+    auto now = std::chrono::steady_clock::now();
+    float period_s = std::chrono::duration<float>(now - cans_load_sampled).count();
+    cans_load_sampled = now;
 
-    for (auto handler_entry = BoardManager::inst().handlers.begin();
-         handler_entry != BoardManager::inst().handlers.end(); ++handler_entry)
+    if (period_s <= 0)
+        return;
+
+    size_t window_samples = std::max<size_t>(
+        1, cans_load_collection_time * 1000 / cans_load_sample_period.count());
+    float alpha = 1 - std::exp(-period_s / cans_load_collection_time);
+
+    for (size_t i = 0; i < cans.size(); i++)
     {
-        if (handler_entry->first->board_name ==
-            new_backend_handler->GetBoard().descriptor->board_name)
-        {
-            ASSERT(*new_backend_handler->GetBoard().descriptor ==
-                   *handler_entry->first);
-            board_descriptor = handler_entry->first;
-            new_backend_handler->GetBoard().descriptor = handler_entry->first;
-            handlers_bank = handler_entry;
+        auto &can = cans[i].second;
+        auto &load = cans_load[i];
 
-            break;
+        float sample =
+            can->GetTrafficSoFar(true) / (can->GetBitrate() * period_s);
+
+        load.samples.push_back(sample);
+        while (load.samples.size() > window_samples)
+            load.samples.pop_front();
+
+        load.ewma += alpha * (sample - load.ewma);
+
+        // some hysteresis, so that a bus hovering at the limit does not
+        // flood the log
+        if (!load.saturated && load.ewma > cans_load_warning)
+        {
+            load.saturated = true;
+            LOG_WARNING(log, "Bus " + cans[i].first +
+                                 " is approaching saturation, " +
+                                 std::to_string((int)(load.ewma * 100)) +
+                                 "% used.");
+        }
+        else if (load.saturated && load.ewma < 0.9 * cans_load_warning)
+        {
+            load.saturated = false;
+            LOG_INFO(log, "Bus " + cans[i].first + " is no longer saturated.");
         }
     }
+}
+
+void BoardManager::ReportCansUtilization()
+{
+    std::vector<float> utilization;
+    std::vector<float> utilization_ewma;
+
+    for (const auto &load : cans_load)
+    {
+        float sum = 0;
+        for (auto sample : load.samples)
+            sum += sample;
+
+        utilization.push_back(load.samples.size() ? sum / load.samples.size()
+                                                  : 0);
+        utilization_ewma.push_back(load.ewma);
+    }
+
+    frontend->ReportCansUtilization(utilization, utilization_ewma);
+}
+
+std::chrono::milliseconds
+BoardManager::GetKeepAliveInterval(std::string board_name)
+{
+    auto interval = keepalive_intervals.find(board_name);
+    if (interval != keepalive_intervals.end())
+        return interval->second;
+
+    return keepalive_interval;
+}
+
+void BoardManager::RegisterNewHandler(
+    sptr<BoardCommunicationHandler> new_backend_handler)
+{
+    sptr<BoardCommunicationHandler> old_backend_handler;
+    auto board_id = new_backend_handler->GetBoard().id;
+
+    new_backend_handler->HandshakeComplete();
+
+    // descriptors are interned by HandshakeComplete, boards of the same kind
+    // share a pointer
+    sptr<BoardDescriptor> board_descriptor =
+        new_backend_handler->GetBoard().descriptor;
+    auto handlers_bank = BoardManager::inst().handlers.find(board_descriptor);
 
     std::vector<BoardInstance>::iterator i;
 
@@ -92,8 +256,8 @@ void BoardManager::RegisterNewHandler(
     {
         if (old_backend_handler->IsDead())
         {
-            log.Info(string("Replacing dead handler for board ") +
-                     (string)old_backend_handler->GetBoard());
+            LOG_INFO(log, string("Replacing dead handler for board ") +
+                          (string)old_backend_handler->GetBoard());
 
             BoardManager::inst()
                 .handlers[board_descriptor][i - handlers_bank->second.begin()]
@@ -107,13 +271,27 @@ void BoardManager::RegisterNewHandler(
 
             new_backend_handler->Launch(
                 old_backend_handler->GetFrontendHandler());
+            old_backend_handler->GetCanHandler()->DropRetired(
+                old_backend_handler);
+        }
+        else if (redundancy)
+        {
+            LOG_INFO(log, string("Keeping ") +
+                          (string)new_backend_handler->GetBoard() +
+                          " as a hot standby.");
+
+            holden_handlers.insert(new_backend_handler);
+
+            // a missed heartbeat has to be noticed within the deadline
+            new_backend_handler->SetKeepAliveInterval(failover_deadline / 2);
+            old_backend_handler->SetKeepAliveInterval(failover_deadline / 2);
         }
         else
         {
-            log.Warning(string("Handler for ") +
-                        (string)old_backend_handler->GetBoard() +
-                        " already exists. Putting new "
-                        "connection on hold.");
+            LOG_WARNING(log, string("Handler for ") +
+                             (string)old_backend_handler->GetBoard() +
+                             " already exists. Putting new "
+                             "connection on hold.");
 
             holden_handlers.insert(new_backend_handler);
         }
@@ -128,6 +306,19 @@ void BoardManager::RegisterNewHandler(
     }
 }
 
+bool BoardManager::IsBackendHandler(sptr<BoardCommunicationHandler> handler)
+{
+    auto handlers_bank = handlers.find(handler->GetBoard().descriptor);
+    if (handlers_bank == handlers.end())
+        return false;
+
+    for (const auto &inst : handlers_bank->second)
+        if (inst.backend_handler.lock() == handler)
+            return true;
+
+    return false;
+}
+
 sptr<BoardCommunicationHandler>
 BoardManager::RequestNewHandler(BoardInstance inst,
                                 sptr<FrontendBoardHandler> frontend)
@@ -138,10 +329,11 @@ BoardManager::RequestNewHandler(BoardInstance inst,
     std::vector<BoardInstance>::iterator i;
 
     sptr<BoardCommunicationHandler> new_handler, old_handler;
+    DropDeadStandbys();
     for (const auto &holden_handler : holden_handlers)
     {
         if (!holden_handler->IsDead() && !holden_handler->IsLost() &&
-            *holden_handler->GetBoard().descriptor == *inst.descriptor &&
+            holden_handler->GetBoard().descriptor == inst.descriptor &&
             holden_handler->GetBoard().id == inst.id)
         {
             new_handler = holden_handler;
@@ -168,23 +360,164 @@ BoardManager::RequestNewHandler(BoardInstance inst,
                                             [i - handlers_bank->second.begin()];
 
             board_inst.backend_handler = new_handler;
+
+            // the requester may be one of several frontends of the board
+            if (old_handler)
+                frontend = old_handler->GetFrontendHandler();
+
+            frontend->ReplaceBackendHandler(new_handler);
             new_handler->Launch(frontend);
 
-            log.Info("Replacing dead handler for board " +
-                     (string)old_handler->GetBoard());
+            // the old handler may be gone already
+            LOG_INFO(log, "Replacing dead handler for board " +
+                          (string)new_handler->GetBoard());
 
             break;
         }
     }
 
-    if (!old_handler || !old_handler->IsDead())
+    if (old_handler && old_handler->IsDead())
+    {
+        old_handler->GetCanHandler()->DropRetired(old_handler);
+    }
+    else if (old_handler)
     {
         old_handler->Hold();
         holden_handlers.insert(old_handler);
-        log.Warning("Putting active handler for board " +
-                    (string)old_handler->GetBoard() +
-                    " on hold on replacement.");
+        LOG_WARNING(log, "Putting active handler for board " +
+                         (string)old_handler->GetBoard() +
+                         " on hold on replacement.");
     }
 
     return new_handler;
 }
+
+void BoardManager::DropDeadStandbys()
+{
+    for (auto i = holden_handlers.begin(); i != holden_handlers.end();)
+    {
+        if ((*i)->IsDead())
+            i = holden_handlers.erase(i);
+        else
+            ++i;
+    }
+}
+
+void BoardManager::Failover(sptr<BoardCommunicationHandler> primary,
+                            std::chrono::steady_clock::time_point missed)
+{
+    auto board = primary->GetBoard();
+    auto handlers_bank = handlers.find(board.descriptor);
+    if (handlers_bank == handlers.end())
+        return;
+
+    auto instance = std::find_if(
+        handlers_bank->second.begin(), handlers_bank->second.end(),
+        [&](const BoardInstance &instance) {
+            return instance.backend_handler.lock() == primary;
+        });
+
+    // only the active handler of a board is failed over
+    if (instance == handlers_bank->second.end())
+        return;
+
+    sptr<BoardCommunicationHandler> standby;
+    DropDeadStandbys();
+    for (const auto &holden_handler : holden_handlers)
+    {
+        if (!holden_handler->IsDead() && !holden_handler->IsLost() &&
+            holden_handler->GetBoard().descriptor == board.descriptor &&
+            holden_handler->GetBoard().id == board.id)
+        {
+            standby = holden_handler;
+            break;
+        }
+    }
+
+    if (!standby)
+    {
+        LOG_WARNING(log, "No healthy standby for board " + (string)board + "!");
+        return;
+    }
+
+    auto frontend_handler = primary->GetFrontendHandler();
+
+    holden_handlers.erase(standby);
+    instance->backend_handler = standby;
+    frontend_handler->ReplaceBackendHandler(standby);
+    standby->Launch(frontend_handler);
+
+    // should the old primary come back, it becomes the standby
+    primary->Hold();
+    holden_handlers.insert(primary);
+
+    // from the fault being detectable rather than from the last answer,
+    // which may be a whole keep-alive interval earlier
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - missed);
+
+    LOG_WARNING(log, "Board " + (string)board +
+                         " failed over to its standby in " +
+                         std::to_string(latency.count() / 1000.0f) + " ms.");
+
+    frontend->ReportFailover(standby->GetBoard(), latency.count() / 1000.0f);
+}
+
+uint32_t BoardManager::GroupCommand(uint8_t command_id, std::string selector,
+                                    std::string value,
+                                    std::vector<BoardInstance> &targets)
+{
+    uint32_t request_id = ++group_commands_issued;
+
+    for (const auto &can_entry : cans)
+    {
+        auto bus_handlers = can_entry.second->GetHandlers();
+        std::vector<sptr<BoardCommunicationHandler>> selected;
+
+        for (const auto &handler : bus_handlers)
+        {
+            auto board_name = handler->GetBoard().descriptor->board_name;
+            bool matches = false;
+
+            if (selector == "all")
+                matches = true;
+            else if (selector == "bus")
+                matches = can_entry.first == value;
+            else if (selector == "name")
+                matches = board_name == value;
+            else if (selector == "tag")
+            {
+                auto tags = board_tags.equal_range(board_name);
+                for (auto tag = tags.first; tag != tags.second; ++tag)
+                    matches = matches || tag->second == value;
+            }
+
+            if (matches)
+                selected.push_back(handler);
+        }
+
+        if (selected.empty())
+            continue;
+
+        // one frame reaches every board on the bus, including those which
+        // are not selectable yet, it's only sent when all of them are
+        // selected, otherwise the unicasts are burst out
+        bool broadcast =
+            selected.size() == can_entry.second->GetAddressedCount();
+        if (broadcast)
+            can_entry.second->BroadcastCommand(command_id);
+
+        for (const auto &handler : selected)
+        {
+            targets.push_back(handler->GetBoard());
+            handler->GroupCommand(request_id, command_id, broadcast);
+        }
+
+        LOG_INFO(log, "Group command " + std::to_string(request_id) +
+                          " sent to " + std::to_string(selected.size()) +
+                          " boards on " + can_entry.first +
+                          (broadcast ? " by broadcast." : "."));
+    }
+
+    return request_id;
+}
@@ -4,14 +4,20 @@
 #include <boost/optional.hpp>
 #include <chrono>
 #include <ctime>
+#include <deque>
 #include <map>
-#include <map>
+#include <poll.h>
 #include <set>
 #include <string>
 #include <vector>
 
 #include "descriptors.h"
+#include "emergency_stop.h"
 #include "frontend.h"
+#include "loop_monitor.h"
+#include "realtime.h"
+#include "timer_wheel.h"
+#include "traffic_analyzer.h"
 
 // this singleton is not beautiful
 class BoardManager
@@ -30,22 +36,129 @@ public:
   std::vector<std::pair<std::string, sptr<CanHandler>>> cans;
   std::set<sptr<BoardCommunicationHandler>> holden_handlers;
 
-  std::chrono::system_clock::time_point last_keepalive;
-
+  // bus load is sampled every cans_load_sample_period, and reported over a
+  // sliding window of cans_load_collection_time seconds and as an EWMA with
+  // the same time constant
   float cans_load_collection_time = 3.0;
+  std::chrono::milliseconds cans_load_sample_period{100};
+  std::chrono::milliseconds cans_load_report_period{1000};
+  // warn when the EWMA of a bus' load exceeds this fraction
+  float cans_load_warning = 0.7;
+
+  // per identifier and per field traffic, kept over traffic_windows windows
+  // of traffic_window each
+  TrafficAnalyzer traffic_analyzer;
+  std::chrono::milliseconds traffic_window{1000};
+  int traffic_windows = 10;
+  // a field's rate is flagged when it differs from its baseline by more
+  // than this factor
+  float traffic_change_ratio = 3.0;
+
+  // for interfaces which do not report their bit timing, e.g. vcan
+  uint32_t default_bitrate = 500000;
+  // count stuff bits of every frame instead of assuming the worst case
+  bool exact_bit_stuffing = true;
+
+  // keep-alive period, optionally overridden per board name
+  std::chrono::milliseconds keepalive_interval{1000};
+  std::map<std::string, std::chrono::milliseconds> keepalive_intervals;
+
+  // one sequenced keep-alive frame per bus instead of one per board
+  bool broadcast_keepalive = false;
+
+  enum addressing_t
+  {
+    addressing_legacy = 1, // RUBI_ADDRESS_RANGE1 only
+    addressing_standard,   // 11-bit addresses below the lottery range
+    addressing_extended    // 29-bit addresses
+  };
+
+  addressing_t addressing = addressing_legacy;
+  int extended_boards_count = 1024;
+
+  // keep boards with duplicate (name, id) as hot standbys
+  bool redundancy = false;
+  std::chrono::milliseconds failover_deadline{100};
+
+  // false inside of a nodelet manager, where process wide settings, e.g.
+  // signal handlers, would affect every nodelet
+  bool owns_process = true;
+
+  // periodic work which is not bound to a single bus
+  TimerWheel scheduler;
+
+  // board name -> tags, for group commands
+  std::multimap<std::string, std::string> board_tags;
+
+  // the socket is bound only if a path is given, the ROS frontend derives
+  // one from the node's name
+  bool emergency_stop_enabled = false;
+  std::string emergency_stop_socket;
+  int emergency_stop_priority = 90;
+  uptr<EmergencyStop> emergency_stop;
+
+  // applied by Run() to the thread it's called on, and by the frontends to
+  // their own threads
+  RealtimeProfile realtime;
+
+  // per stage timing of the passes of Run(), with their budgets
+  LoopMonitor loop_monitor;
+  // don't count keep-alives missed while the server itself was late
+  bool keepalive_compensation = true;
 
 private:
   BoardManager();
 
   Logger log{"BoardManager"};
 
+  uint32_t group_commands_issued = 0;
+  uint64_t allocations_reported = 0;
+
+  struct can_load_t
+  {
+    // fractions of the bitrate, newest at the back
+    std::deque<float> samples;
+    float ewma = 0;
+    bool saturated = false;
+  };
+
+  std::vector<can_load_t> cans_load;
+  // reused by WaitForEvents, the loop doesn't allocate
+  std::vector<pollfd> poll_fds;
+  std::chrono::steady_clock::time_point cans_load_sampled;
+
+  void SampleCansLoad();
+  void ReportCansUtilization();
+  void ReportAllocations();
+  // standbys which died are of no use to a failover
+  void DropDeadStandbys();
+
 public:
   BoardManager(BoardManager const &) = delete;
   void operator=(BoardManager const &) = delete;
 
   void Init(std::vector<std::string> cans);
   void Spin(std::chrono::system_clock::time_point);
+
+  // blocks until a bus or the frontend has work, or the next timer tick
+  void WaitForEvents();
+
+  // runs the main loop until the frontend wants to quit
+  void Run();
   void RegisterNewHandler(sptr<BoardCommunicationHandler> handler);
+  // whether the handler is the backend of its BoardInstance
+  bool IsBackendHandler(sptr<BoardCommunicationHandler> handler);
+  // missed is when the keep-alive which went unanswered was requested
+  void Failover(sptr<BoardCommunicationHandler> primary,
+                std::chrono::steady_clock::time_point missed);
+
+  // selector is "all", "name", "tag" or "bus", returns the request id
+  uint32_t GroupCommand(uint8_t command_id, std::string selector,
+                        std::string value, std::vector<BoardInstance> &targets);
+  std::chrono::milliseconds GetKeepAliveInterval(std::string board_name);
+
+  // puts every board to sleep, through the emergency stop if it's enabled
+  void Panic();
 
   sptr<BoardCommunicationHandler>
   RequestNewHandler(BoardInstance inst, sptr<FrontendBoardHandler> frontend);
@@ -0,0 +1,623 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "board_emulator.h"
+#include "inproc_can.h"
+#include "protocol_defs.h"
+#include "rubi_autodefs.h"
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+namespace
+{
+// kept here rather than using rubi_type_size(), so that the library does
+// not depend on the server
+int TypeSize(uint8_t typecode)
+{
+    switch (typecode)
+    {
+    case _RUBI_TYPECODES_int32_t:
+    case _RUBI_TYPECODES_uint32_t:
+    case _RUBI_TYPECODES_float:
+        return 4;
+    case _RUBI_TYPECODES_int16_t:
+    case _RUBI_TYPECODES_uint16_t:
+        return 2;
+    case _RUBI_TYPECODES_int8_t:
+    case _RUBI_TYPECODES_uint8_t:
+    case _RUBI_TYPECODES_bool:
+    case _RUBI_TYPECODES_RUBI_ENUM1:
+        return 1;
+    case _RUBI_TYPECODES_shortstring:
+        return 32;
+    case _RUBI_TYPECODES_longstring:
+        return 255;
+    default:
+        throw std::runtime_error("Unknown typecode " +
+                                 std::to_string(typecode));
+    }
+}
+
+std::string JoinNames(const std::vector<std::string> &names)
+{
+    std::string ret;
+
+    for (const auto &name : names)
+        ret += (ret.empty() ? "" : ",") + name;
+
+    return ret;
+}
+} // namespace
+
+// raw socket or in-process endpoint, without the bookkeeping of SocketCan
+class EmulatorSocket
+{
+    int soc = -1;
+    std::unique_ptr<InprocCanEndpoint> inproc;
+
+  public:
+    EmulatorSocket(std::string port)
+    {
+        if (port.compare(0, 7, "inproc:") == 0)
+        {
+            inproc.reset(new InprocCanEndpoint(port.substr(7)));
+            return;
+        }
+
+        soc = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+        if (soc < 0)
+            throw std::runtime_error("Can't open a CAN socket");
+
+        ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, port.c_str(), IFNAMSIZ - 1);
+
+        sockaddr_can addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.can_family = AF_CAN;
+
+        if (ioctl(soc, SIOCGIFINDEX, &ifr) < 0)
+        {
+            close(soc);
+            throw std::runtime_error("No such interface " + port);
+        }
+
+        addr.can_ifindex = ifr.ifr_ifindex;
+        fcntl(soc, F_SETFL, O_NONBLOCK);
+
+        if (bind(soc, (sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(soc);
+            throw std::runtime_error("Can't bind to " + port);
+        }
+    }
+
+    ~EmulatorSocket()
+    {
+        if (soc >= 0)
+            close(soc);
+    }
+
+    void Send(const can_frame &frame)
+    {
+        if (inproc)
+            return inproc->Send(frame);
+
+        while (write(soc, &frame, sizeof(frame)) != sizeof(frame))
+            std::this_thread::yield();
+    }
+
+    bool Receive(can_frame &frame)
+    {
+        if (inproc)
+            return inproc->Receive(frame);
+
+        return read(soc, &frame, sizeof(frame)) == sizeof(frame);
+    }
+
+    int GetFd() { return inproc ? inproc->GetFd() : soc; }
+};
+
+class EmulatedBoard
+{
+    enum state_t
+    {
+        state_lottery = 1, // until an address is assigned
+        state_addressed,   // handshake done, waiting for the server
+        state_rebooting
+    };
+
+    emulated_board_t config;
+    EmulatorWorker *worker;
+    emulator_stats_t &stats;
+
+    uint16_t lottery_id;
+    uint32_t cob = 0;
+    // both also read by GetOperationalCount() from other threads
+    std::atomic<state_t> state{state_lottery};
+    time_point next_action;
+
+    bool wake = true;
+    std::atomic<bool> operational{false};
+
+    std::vector<std::vector<uint8_t>> values;
+    std::vector<time_point> next_publish;
+
+    // reassembly of block transfers from the server
+    std::vector<uint8_t> rx_buffer;
+    uint8_t blocks_received = 0;
+
+    void Send(uint32_t id, const std::vector<uint8_t> &data);
+    void SendMessage(uint8_t msg_type, uint8_t id,
+                     const std::vector<uint8_t> &data);
+    void SendInfo(uint8_t info_type, const std::string &value);
+    void StreamDescriptors();
+    void Reboot(time_point now);
+    void MessageInbound(uint8_t msg_type, uint8_t id,
+                        const std::vector<uint8_t> &data, time_point now);
+
+  public:
+    EmulatedBoard(const emulated_board_t &config, EmulatorWorker *worker,
+                  emulator_stats_t &stats, uint16_t lottery_id,
+                  time_point first_lottery);
+
+    uint32_t GetLotteryCob() { return RUBI_LOTTERY_RANGE_LOW + lottery_id; }
+    bool IsOperational() { return state == state_addressed && operational; }
+
+    void FrameInbound(const can_frame &frame, time_point now);
+    void CommandInbound(uint8_t command_id, time_point now);
+    void BroadcastKeepAliveInbound(uint8_t seq);
+
+    // does what is due, returns when it wants to be called again
+    time_point Tick(time_point now);
+};
+
+class EmulatorWorker
+{
+    friend class BoardEmulator;
+
+    EmulatorSocket socket;
+    BoardEmulator *emulator;
+    std::vector<std::unique_ptr<EmulatedBoard>> boards;
+    std::unordered_map<uint32_t, EmulatedBoard *> by_cob;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    void Run();
+    void FrameInbound(const can_frame &frame, time_point now);
+
+  public:
+    EmulatorWorker(std::string port, BoardEmulator *emulator)
+        : socket(port), emulator(emulator)
+    {
+    }
+
+    BoardEmulator *GetEmulator() { return emulator; }
+    void Send(const can_frame &frame)
+    {
+        socket.Send(frame);
+        emulator->stats.frames_sent += 1;
+    }
+
+    void SetCob(EmulatedBoard *board, uint32_t old_cob, uint32_t cob)
+    {
+        if (old_cob)
+            by_cob.erase(old_cob);
+        if (cob)
+            by_cob[cob] = board;
+    }
+};
+
+EmulatedBoard::EmulatedBoard(const emulated_board_t &config,
+                             EmulatorWorker *worker, emulator_stats_t &stats,
+                             uint16_t lottery_id, time_point first_lottery)
+    : config(config), worker(worker), stats(stats), lottery_id(lottery_id),
+      next_action(first_lottery)
+{
+    for (const auto &field : config.fields)
+    {
+        values.emplace_back(TypeSize(field.typecode) *
+                            std::max<size_t>(field.subfields.size(), 1));
+        next_publish.push_back(first_lottery);
+    }
+}
+
+void EmulatedBoard::Send(uint32_t id, const std::vector<uint8_t> &data)
+{
+    can_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = id;
+    frame.can_dlc = data.size();
+    memcpy(frame.data, data.data(), data.size());
+
+    worker->Send(frame);
+}
+
+// the framing of rubi_continue_tx(): up to 6 bytes fit in a single frame,
+// longer messages go in 7 byte blocks followed by a closing frame
+void EmulatedBoard::SendMessage(uint8_t msg_type, uint8_t id,
+                                const std::vector<uint8_t> &data)
+{
+    if (data.size() <= 6)
+    {
+        std::vector<uint8_t> frame = {msg_type, id};
+        frame.insert(frame.end(), data.begin(), data.end());
+        Send(cob, frame);
+        return;
+    }
+
+    uint8_t blocks = 0;
+    for (size_t i = 0; i < data.size(); i += 7)
+    {
+        std::vector<uint8_t> frame = {RUBI_MSG_BLOCK};
+        frame.insert(frame.end(), data.begin() + i,
+                     data.begin() + std::min(i + 7, data.size()));
+        Send(cob, frame);
+        blocks += 1;
+    }
+
+    Send(cob, {(uint8_t)(msg_type | RUBI_FLAG_BLOCK_TRANSFER), id, blocks});
+}
+
+void EmulatedBoard::SendInfo(uint8_t info_type, const std::string &value)
+{
+    SendMessage(RUBI_MSG_INFO, info_type,
+                std::vector<uint8_t>(value.begin(), value.end()));
+}
+
+void EmulatedBoard::StreamDescriptors()
+{
+    SendInfo(RUBI_INFO_BOARD_NAME, config.name);
+    SendInfo(RUBI_INFO_BOARD_VERSION, config.version);
+    SendInfo(RUBI_INFO_BOARD_DRIVER, config.driver);
+    SendInfo(RUBI_INFO_BOARD_DESC, config.description);
+
+    if (!config.id.empty())
+        SendInfo(RUBI_INFO_BOARD_ID, config.id);
+
+    for (const auto &field : config.fields)
+    {
+        SendInfo(RUBI_INFO_FIELD_NAME, field.name);
+        SendInfo(RUBI_INFO_FIELD_TYPE, std::string(1, field.typecode));
+        SendInfo(RUBI_INFO_FIELD_ACCESS, std::string(1, field.access));
+
+        if (!field.subfields.empty())
+            SendInfo(RUBI_INFO_SUBFIELDS, JoinNames(field.subfields));
+    }
+
+    Send(cob, {RUBI_MSG_INIT_COMPLETE});
+    stats.handshakes += 1;
+}
+
+void EmulatedBoard::Reboot(time_point now)
+{
+    worker->SetCob(this, cob, 0);
+    cob = 0;
+
+    state = state_rebooting;
+    next_action = now + worker->GetEmulator()->reboot_time;
+    wake = true;
+    operational = false;
+    rx_buffer.clear();
+    blocks_received = 0;
+}
+
+void EmulatedBoard::FrameInbound(const can_frame &frame, time_point now)
+{
+    stats.frames_received += 1;
+
+    // address assignment, the lottery id of the board is ours alone
+    if (frame.can_id == GetLotteryCob())
+    {
+        if (state != state_lottery || frame.can_dlc < 1 || frame.can_dlc > 2)
+            return;
+
+        uint16_t node = frame.data[0];
+        if (frame.can_dlc == 2)
+        {
+            node |= frame.data[1] << 8;
+            cob = CAN_EFF_FLAG | (RUBI_EXTENDED_ADDRESS_LOW + node);
+        }
+        else
+        {
+            cob = RUBI_ADDRESS_RANGE1_LOW + node;
+        }
+
+        worker->SetCob(this, 0, cob);
+        state = state_addressed;
+
+        Send(cob, {RUBI_MSG_LOTTERY});
+        StreamDescriptors();
+        return;
+    }
+
+    if (frame.can_dlc < 1 || state != state_addressed)
+        return;
+
+    if ((frame.data[0] & RUBI_MSG_MASK) == RUBI_MSG_BLOCK)
+    {
+        rx_buffer.insert(rx_buffer.end(), frame.data + 1,
+                         frame.data + frame.can_dlc);
+        blocks_received += 1;
+        return;
+    }
+
+    if (frame.can_dlc < 2)
+        return;
+
+    std::vector<uint8_t> data(frame.data + 2, frame.data + frame.can_dlc);
+    if (frame.data[0] & RUBI_FLAG_BLOCK_TRANSFER)
+    {
+        bool transfer_failed =
+            frame.can_dlc < 3 || frame.data[2] != blocks_received;
+
+        data.swap(rx_buffer);
+        rx_buffer.clear();
+        blocks_received = 0;
+
+        if (transfer_failed)
+            return;
+    }
+
+    MessageInbound(frame.data[0] & RUBI_MSG_MASK, frame.data[1], data, now);
+}
+
+void EmulatedBoard::MessageInbound(uint8_t msg_type, uint8_t id,
+                                   const std::vector<uint8_t> &data,
+                                   time_point now)
+{
+    switch (msg_type)
+    {
+    case RUBI_MSG_COMMAND:
+        CommandInbound(id, now);
+        break;
+
+    case RUBI_MSG_FIELD:
+        if (id < values.size() && data.size() == values[id].size())
+        {
+            values[id] = data;
+            stats.field_writes_received += 1;
+
+            if (config.fields[id].written)
+                config.fields[id].written(values[id]);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void EmulatedBoard::CommandInbound(uint8_t command_id, time_point now)
+{
+    stats.commands_received += 1;
+
+    switch (command_id)
+    {
+    case RUBI_COMMAND_KEEPALIVE:
+        if (state == state_addressed)
+        {
+            SendMessage(RUBI_MSG_COMMAND, RUBI_COMMAND_KEEPALIVE,
+                        {(uint8_t)wake});
+            stats.keepalives_answered += 1;
+        }
+        break;
+    case RUBI_COMMAND_SOFTSLEEP:
+        wake = false;
+        break;
+    case RUBI_COMMAND_WAKE:
+        wake = true;
+        break;
+    case RUBI_COMMAND_HOLD:
+        operational = false;
+        break;
+    case RUBI_COMMAND_OPERATIONAL:
+        operational = true;
+        break;
+    case RUBI_COMMAND_REBOOT:
+        Reboot(now);
+        break;
+    default:
+        break;
+    }
+}
+
+void EmulatedBoard::BroadcastKeepAliveInbound(uint8_t seq)
+{
+    if (state != state_addressed)
+        return;
+
+    SendMessage(RUBI_MSG_COMMAND, RUBI_COMMAND_KEEPALIVE, {(uint8_t)wake, seq});
+    stats.keepalives_answered += 1;
+}
+
+time_point EmulatedBoard::Tick(time_point now)
+{
+    switch (state)
+    {
+    case state_rebooting:
+        if (now < next_action)
+            return next_action;
+
+        state = state_lottery;
+        // fall through
+
+    case state_lottery:
+        if (now < next_action)
+            return next_action;
+
+        // the two first bytes are not looked at by the server
+        Send(GetLotteryCob(),
+             {(uint8_t)(lottery_id & 0xff), (uint8_t)(lottery_id >> 8),
+              (uint8_t)(RUBI_PROTOCOL_VERSION & 0xff),
+              (uint8_t)(RUBI_PROTOCOL_VERSION >> 8)});
+        stats.lotteries += 1;
+
+        // try again if nobody answers
+        next_action = now + std::chrono::seconds(1);
+        return next_action;
+
+    case state_addressed:
+        break;
+    }
+
+    time_point next = now + std::chrono::milliseconds(100);
+    if (!operational || !wake)
+        return next;
+
+    for (size_t i = 0; i < config.fields.size(); i++)
+    {
+        const auto &field = config.fields[i];
+
+        if (!field.period.count() || field.access == RUBI_READONLY)
+            continue;
+
+        if (now >= next_publish[i])
+        {
+            // a changing value, so that nothing on the way can skip it
+            if (field.fill)
+                field.fill(values[i]);
+            else
+                values[i][0] += 1;
+
+            SendMessage(RUBI_MSG_FIELD, i, values[i]);
+            stats.field_updates_sent += 1;
+
+            // a late worker skips updates rather than bursting them
+            next_publish[i] += field.period;
+            if (next_publish[i] < now)
+                next_publish[i] = now + field.period;
+        }
+
+        next = std::min(next, next_publish[i]);
+    }
+
+    return next;
+}
+
+void EmulatorWorker::FrameInbound(const can_frame &frame, time_point now)
+{
+    if (frame.can_id == RUBI_BROADCAST1 && frame.can_dlc >= 2 &&
+        frame.data[0] == RUBI_MSG_COMMAND)
+    {
+        for (auto &board : boards)
+            board->CommandInbound(frame.data[1], now);
+        return;
+    }
+
+    if (frame.can_id == RUBI_BROADCAST2 && frame.can_dlc >= 3 &&
+        frame.data[0] == RUBI_MSG_COMMAND &&
+        frame.data[1] == RUBI_COMMAND_KEEPALIVE)
+    {
+        if (emulator->answer_broadcast_keepalive)
+        {
+            for (auto &board : boards)
+                board->BroadcastKeepAliveInbound(frame.data[2]);
+        }
+        return;
+    }
+
+    // frames of boards of the other workers, and lotteries of boards
+    // which are not ours, are not looked at
+    auto board = by_cob.find(frame.can_id);
+    if (board != by_cob.end())
+        board->second->FrameInbound(frame, now);
+}
+
+void EmulatorWorker::Run()
+{
+    while (running)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + std::chrono::milliseconds(10);
+
+        for (auto &board : boards)
+            next = std::min(next, board->Tick(now));
+
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+            next - std::chrono::steady_clock::now());
+
+        pollfd fd = {socket.GetFd(), POLLIN, 0};
+        poll(&fd, 1, std::max<int>(0, timeout.count()));
+
+        can_frame frame;
+        while (socket.Receive(frame))
+            FrameInbound(frame, std::chrono::steady_clock::now());
+    }
+}
+
+BoardEmulator::BoardEmulator(std::string port, int threads) : port(port)
+{
+    for (int i = 0; i < std::max(threads, 1); i++)
+        workers.emplace_back(new EmulatorWorker(port, this));
+}
+
+BoardEmulator::~BoardEmulator() { Stop(); }
+
+void BoardEmulator::AddBoard(const emulated_board_t &board)
+{
+    const size_t lottery_ids =
+        RUBI_LOTTERY_RANGE_HIGH - RUBI_LOTTERY_RANGE_LOW + 1;
+    if (boards_count >= lottery_ids)
+        throw std::runtime_error("Out of lottery identifiers");
+
+    static std::mt19937 random(std::random_device{}());
+    std::uniform_int_distribution<int> spread(0, lottery_spread.count());
+
+    auto &worker = workers[boards_count % workers.size()];
+    auto first_lottery = std::chrono::steady_clock::now() +
+                         std::chrono::milliseconds(spread(random));
+
+    // every board has a lottery id of its own, so they never collide
+    worker->boards.emplace_back(new EmulatedBoard(
+        board, worker.get(), stats, boards_count, first_lottery));
+    worker->SetCob(worker->boards.back().get(), 0,
+                   worker->boards.back()->GetLotteryCob());
+
+    boards_count += 1;
+}
+
+void BoardEmulator::Start()
+{
+    for (auto &worker : workers)
+    {
+        worker->running = true;
+        worker->thread = std::thread(&EmulatorWorker::Run, worker.get());
+    }
+}
+
+void BoardEmulator::Stop()
+{
+    for (auto &worker : workers)
+    {
+        worker->running = false;
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+int BoardEmulator::GetOperationalCount()
+{
+    // boards may change their state while being counted
+    int count = 0;
+
+    for (auto &worker : workers)
+    {
+        for (auto &board : worker->boards)
+            count += board->IsOperational();
+    }
+
+    return count;
+}
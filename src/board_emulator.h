@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct emulated_field_t
+{
+    std::string name;
+    uint8_t typecode;
+    // RUBI_READONLY, RUBI_WRITEONLY or RUBI_READWRITE, as seen by the board
+    uint8_t access;
+    std::vector<std::string> subfields;
+    // fields the board writes are published this often, never if 0
+    std::chrono::microseconds period{0};
+
+    // both are called from the worker's thread: fill sets the value about
+    // to be published (otherwise its first byte is incremented), written
+    // gets every value the server writes
+    std::function<void(std::vector<uint8_t> &)> fill;
+    std::function<void(const std::vector<uint8_t> &)> written;
+};
+
+struct emulated_board_t
+{
+    std::string name;
+    std::string id; // empty for boards without one
+    std::string version = "1.0";
+    std::string driver;
+    std::string description;
+    std::vector<emulated_field_t> fields;
+};
+
+struct emulator_stats_t
+{
+    std::atomic<uint64_t> lotteries{0};
+    std::atomic<uint64_t> handshakes{0};
+    std::atomic<uint64_t> keepalives_answered{0};
+    std::atomic<uint64_t> field_updates_sent{0};
+    std::atomic<uint64_t> field_writes_received{0};
+    std::atomic<uint64_t> commands_received{0};
+    std::atomic<uint64_t> frames_sent{0};
+    std::atomic<uint64_t> frames_received{0};
+};
+
+class EmulatorWorker;
+
+// Emulates RUBI boards which speak the real wire protocol, on a (v)can
+// interface or on an in-process bus (inproc:<name>). The boards take part
+// in the lottery, stream their descriptors, answer keep-alives, publish
+// their fields and obey sleep, wake and reboot commands. They are spread
+// over a pool of threads, each of which has a socket of its own.
+class BoardEmulator
+{
+    std::string port;
+    std::vector<std::unique_ptr<EmulatorWorker>> workers;
+    size_t boards_count = 0;
+
+  public:
+    emulator_stats_t stats;
+
+    // first lottery of each board happens at a random time within this,
+    // so that the handshakes of hundreds of boards don't overflow the
+    // server's socket
+    std::chrono::milliseconds lottery_spread{1000};
+    std::chrono::milliseconds reboot_time{200};
+    bool answer_broadcast_keepalive = true;
+
+    // throws std::runtime_error if the port can't be opened
+    BoardEmulator(std::string port, int threads);
+    ~BoardEmulator();
+    BoardEmulator(BoardEmulator const &) = delete;
+    void operator=(BoardEmulator const &) = delete;
+
+    // boards can only be added before Start()
+    void AddBoard(const emulated_board_t &board);
+    void Start();
+    void Stop();
+
+    // boards which completed the handshake and were told to operate
+    int GetOperationalCount();
+};
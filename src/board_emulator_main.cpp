@@ -0,0 +1,122 @@
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "board_emulator.h"
+#include "rubi_autodefs.h"
+
+using std::string;
+
+static std::atomic<bool> running{true};
+
+// value of a "_name:=value" argument
+static string GetArgument(int argc, char **argv, string name, string fallback)
+{
+    string prefix = "_" + name + ":=";
+
+    for (int i = 1; i < argc; i++)
+        if (strncmp(argv[i], prefix.c_str(), prefix.size()) == 0)
+            return string(argv[i]).substr(prefix.size());
+
+    return fallback;
+}
+
+// a board with a field of every kind the server handles differently
+static emulated_board_t MakeBoard(int id, std::chrono::microseconds period,
+                                  bool block_transfers)
+{
+    emulated_board_t board;
+    board.name = "emulated";
+    board.id = std::to_string(id);
+    board.driver = "emulated";
+    board.description = "Board emulated by rubi_board_emulator";
+
+    emulated_field_t field;
+
+    field.name = "position";
+    field.typecode = _RUBI_TYPECODES_uint16_t;
+    field.access = RUBI_WRITEONLY;
+    field.subfields = {"a", "b", "c"};
+    field.period = period;
+    board.fields.push_back(field);
+
+    field.name = "temperature";
+    field.typecode = _RUBI_TYPECODES_float;
+    field.subfields.clear();
+    field.period = period * 10;
+    board.fields.push_back(field);
+
+    field.name = "setpoint";
+    field.typecode = _RUBI_TYPECODES_int32_t;
+    field.access = RUBI_READWRITE;
+    field.period = period * 10;
+    board.fields.push_back(field);
+
+    field.name = "target";
+    field.typecode = _RUBI_TYPECODES_int32_t;
+    field.access = RUBI_READONLY;
+    field.period = std::chrono::microseconds(0);
+    board.fields.push_back(field);
+
+    if (block_transfers)
+    {
+        field.name = "status";
+        field.typecode = _RUBI_TYPECODES_shortstring;
+        field.access = RUBI_WRITEONLY;
+        field.period = period * 100;
+        board.fields.push_back(field);
+    }
+
+    return board;
+}
+
+int main(int argc, char **argv)
+{
+    string port = GetArgument(argc, argv, "port", "vcan0");
+    int boards = std::stoi(GetArgument(argc, argv, "boards", "16"));
+    int threads = std::stoi(GetArgument(argc, argv, "threads", "1"));
+    // updates of the fastest field of each board per second
+    double rate = std::stod(GetArgument(argc, argv, "rate", "100"));
+    bool block_transfers = GetArgument(argc, argv, "block", "true") == "true";
+
+    auto period = std::chrono::microseconds(
+        rate > 0 ? (int64_t)(1000000 / rate) : 0);
+
+    std::signal(SIGINT, [](int) { running = false; });
+    std::signal(SIGTERM, [](int) { running = false; });
+
+    try
+    {
+        BoardEmulator emulator(port, threads);
+
+        for (int i = 0; i < boards; i++)
+            emulator.AddBoard(MakeBoard(i, period, block_transfers));
+
+        emulator.Start();
+
+        while (running)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+
+            std::cout << "operational " << emulator.GetOperationalCount()
+                      << "/" << boards << ", lotteries "
+                      << emulator.stats.lotteries << ", keep-alives "
+                      << emulator.stats.keepalives_answered << ", updates "
+                      << emulator.stats.field_updates_sent << ", writes "
+                      << emulator.stats.field_writes_received << ", frames "
+                      << emulator.stats.frames_sent << "/"
+                      << emulator.stats.frames_received << std::endl;
+        }
+
+        emulator.Stop();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
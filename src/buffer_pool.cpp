@@ -0,0 +1,68 @@
+#include "buffer_pool.h"
+#include "exceptions.h"
+
+const size_t BufferPool::max_size;
+
+int BufferPool::ClassOf(size_t size)
+{
+    int buffer_class = 0;
+
+    while ((smallest_size << buffer_class) < size)
+        buffer_class += 1;
+
+    return buffer_class;
+}
+
+BufferPool::buffer_t BufferPool::Acquire(size_t size)
+{
+    ASSERT(size <= max_size);
+
+    int buffer_class = ClassOf(size);
+    size_t class_size = smallest_size << buffer_class;
+    auto &free = free_buffers[buffer_class];
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (free.empty())
+    {
+        slabs.emplace_back(new uint8_t[slab_size]);
+        allocated_bytes += slab_size;
+
+        for (size_t i = 0; i < slab_size / class_size; i++)
+            free.push_back(slabs.back().get() + i * class_size);
+    }
+
+    buffer_t buffer;
+    buffer.data = free.back();
+    buffer.size = class_size;
+    free.pop_back();
+
+    in_use_bytes += class_size;
+
+    return buffer;
+}
+
+void BufferPool::Release(buffer_t &buffer)
+{
+    if (!buffer.data)
+        return;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    free_buffers[ClassOf(buffer.size)].push_back(buffer.data);
+    in_use_bytes -= buffer.size;
+
+    buffer = buffer_t();
+}
+
+size_t BufferPool::GetAllocatedBytes()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return allocated_bytes;
+}
+
+size_t BufferPool::GetInUseBytes()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return in_use_bytes;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <inttypes.h>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+// Slab pool of the protocol handlers' buffers of a bus. Buffers are only
+// held while a message is being sent or reassembled, so a bus needs about
+// as many as it has block transfers in flight, rather than a pair per
+// board. Sizes are rounded up to powers of two, released buffers are kept
+// for reuse.
+class BufferPool
+{
+  public:
+    struct buffer_t
+    {
+        uint8_t *data = nullptr;
+        size_t size = 0;
+    };
+
+  private:
+    static const int classes_n = 6;
+    static const size_t smallest_size = 16;
+    // slabs are carved into as many buffers of a class as fit
+    static const size_t slab_size = 1024;
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<uint8_t[]>> slabs;
+    std::array<std::vector<uint8_t *>, classes_n> free_buffers;
+
+    size_t allocated_bytes = 0;
+    size_t in_use_bytes = 0;
+
+    static int ClassOf(size_t size);
+
+  public:
+    // largest size that can be acquired
+    static const size_t max_size = smallest_size << (classes_n - 1);
+
+    buffer_t Acquire(size_t size);
+    // does nothing for an empty buffer, empties it otherwise
+    void Release(buffer_t &buffer);
+
+    size_t GetAllocatedBytes();
+    size_t GetInUseBytes();
+};
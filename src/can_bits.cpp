@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <linux/can.h>
+#include <linux/can/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "can_bits.h"
+
+namespace
+{
+// CRC delimiter, ACK slot and delimiter, end of frame and intermission,
+// none of which is stuffed
+const int frame_tail_bits = 1 + 2 + 7 + 3;
+
+struct bit_stream_t
+{
+    // the longest extended frame has 118 stuffable bits
+    uint8_t bits[128];
+    int size = 0;
+
+    void Put(uint32_t value, int count)
+    {
+        for (int i = count - 1; i >= 0; i--)
+            bits[size++] = (value >> i) & 1;
+    }
+};
+
+uint16_t Crc15(const bit_stream_t &stream)
+{
+    uint16_t crc = 0;
+
+    for (int i = 0; i < stream.size; i++)
+    {
+        bool next = stream.bits[i] ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7fff;
+        if (next)
+            crc ^= 0x4599;
+    }
+
+    return crc;
+}
+
+int StuffBits(const bit_stream_t &stream)
+{
+    int stuffed = 0;
+    int run = 1;
+    uint8_t previous = stream.bits[0];
+
+    for (int i = 1; i < stream.size; i++)
+    {
+        if (stream.bits[i] == previous)
+        {
+            run += 1;
+        }
+        else
+        {
+            previous = stream.bits[i];
+            run = 1;
+        }
+
+        // the stuff bit is the complement, and starts a new run
+        if (run == 5)
+        {
+            stuffed += 1;
+            previous = !previous;
+            run = 1;
+        }
+    }
+
+    return stuffed;
+}
+
+rtattr *FindAttribute(rtattr *attr, int length, unsigned short type)
+{
+    for (; RTA_OK(attr, length); attr = RTA_NEXT(attr, length))
+    {
+        if (attr->rta_type == type)
+            return attr;
+    }
+
+    return nullptr;
+}
+} // namespace
+
+int CanFrameBits(uint32_t can_id, const uint8_t *data, uint8_t dlc)
+{
+    bool extended = can_id & CAN_EFF_FLAG;
+    bool remote = can_id & CAN_RTR_FLAG;
+    dlc = std::min<uint8_t>(dlc, CAN_MAX_DLEN);
+
+    bit_stream_t stream;
+    stream.Put(0, 1); // start of frame
+
+    if (extended)
+    {
+        uint32_t id = can_id & CAN_EFF_MASK;
+        stream.Put(id >> 18, 11);
+        stream.Put(1, 1); // SRR
+        stream.Put(1, 1); // IDE
+        stream.Put(id & 0x3ffff, 18);
+        stream.Put(remote, 1);
+        stream.Put(0, 2); // r1, r0
+    }
+    else
+    {
+        stream.Put(can_id & CAN_SFF_MASK, 11);
+        stream.Put(remote, 1);
+        stream.Put(0, 1); // IDE
+        stream.Put(0, 1); // r0
+    }
+
+    stream.Put(dlc, 4);
+
+    if (!remote)
+    {
+        for (int i = 0; i < dlc; i++)
+            stream.Put(data[i], 8);
+    }
+
+    stream.Put(Crc15(stream), 15);
+
+    return stream.size + StuffBits(stream) + frame_tail_bits;
+}
+
+int CanFrameBitsWorstCase(bool extended, uint8_t dlc)
+{
+    dlc = std::min<uint8_t>(dlc, CAN_MAX_DLEN);
+
+    // bits from the start of frame to the end of the CRC
+    int stuffable = (extended ? 54 : 34) + 8 * dlc;
+
+    return stuffable + (stuffable - 1) / 4 + frame_tail_bits;
+}
+
+boost::optional<uint32_t> CanGetBitrate(const std::string &ifname)
+{
+    unsigned int index = if_nametoindex(ifname.c_str());
+    if (!index)
+        return boost::none;
+
+    int soc = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (soc < 0)
+        return boost::none;
+
+    struct
+    {
+        nlmsghdr header;
+        ifinfomsg info;
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+    request.header.nlmsg_type = RTM_GETLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.info.ifi_family = AF_UNSPEC;
+    request.info.ifi_index = index;
+
+    char response[16384];
+    int length = -1;
+    if (send(soc, &request, request.header.nlmsg_len, 0) >= 0)
+        length = recv(soc, response, sizeof(response), 0);
+    close(soc);
+
+    if (length < 0)
+        return boost::none;
+
+    // IFLA_LINKINFO -> IFLA_INFO_DATA -> IFLA_CAN_BITTIMING
+    for (auto header = (nlmsghdr *)response; NLMSG_OK(header, length);
+         header = NLMSG_NEXT(header, length))
+    {
+        if (header->nlmsg_type != RTM_NEWLINK)
+            continue;
+
+        auto info = (ifinfomsg *)NLMSG_DATA(header);
+        rtattr *linkinfo =
+            FindAttribute(IFLA_RTA(info), IFLA_PAYLOAD(header), IFLA_LINKINFO);
+        if (!linkinfo)
+            continue;
+
+        rtattr *data = FindAttribute((rtattr *)RTA_DATA(linkinfo),
+                                     RTA_PAYLOAD(linkinfo), IFLA_INFO_DATA);
+        if (!data)
+            continue;
+
+        rtattr *bittiming = FindAttribute((rtattr *)RTA_DATA(data),
+                                          RTA_PAYLOAD(data), IFLA_CAN_BITTIMING);
+        if (!bittiming || RTA_PAYLOAD(bittiming) < sizeof(can_bittiming))
+            continue;
+
+        auto timing = (can_bittiming *)RTA_DATA(bittiming);
+        if (timing->bitrate)
+            return timing->bitrate;
+    }
+
+    return boost::none;
+}
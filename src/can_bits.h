@@ -0,0 +1,17 @@
+#pragma once
+
+#include <boost/optional.hpp>
+#include <inttypes.h>
+#include <string>
+
+// Length on the wire of a classic CAN frame, from the start of frame bit up
+// to and including the interframe space. The identifier carries the
+// CAN_EFF_FLAG and CAN_RTR_FLAG of the socketcan frame.
+int CanFrameBits(uint32_t can_id, const uint8_t *data, uint8_t dlc);
+
+// Upper bound of CanFrameBits(), assuming the worst possible bit stuffing.
+int CanFrameBitsWorstCase(bool extended, uint8_t dlc);
+
+// Nominal bitrate of an interface as configured through netlink, none for
+// interfaces without bit timing, e.g. vcan.
+boost::optional<uint32_t> CanGetBitrate(const std::string &ifname);
@@ -1,7 +1,10 @@
 
+#include <algorithm>
 #include <memory>
 
+#include "alloc_check.h"
 #include "board.h"
+#include "can_bits.h"
 #include "communication.h"
 #include "exceptions.h"
 #include "frontend.h"
@@ -13,105 +16,259 @@
 using std::get;
 using std::string;
 
-CanHandler::CanHandler(std::string can_name)
+CanHandler::CanHandler(std::string can_name) : can_name(can_name)
 {
     // std::vector<uint8_t> lottery_invitation = {RUBI_MSG_COMMAND,
     // RUBI_COMMAND_LOTERRY};
     std::vector<uint8_t> lottery_invitation = {RUBI_MSG_COMMAND,
                                                RUBI_COMMAND_REBOOT};
 
-    max_boards_count = RUBI_ADDRESS_RANGE1_HIGH - RUBI_ADDRESS_RANGE1_LOW;
+    switch (BoardManager::inst().addressing)
+    {
+    case BoardManager::addressing_legacy:
+        max_boards_count = RUBI_ADDRESS_RANGE1_HIGH - RUBI_ADDRESS_RANGE1_LOW;
+        break;
+    case BoardManager::addressing_standard:
+        // upper part of RUBI_ADDRESS_RANGE2 is shadowed by the lottery
+        max_boards_count = RUBI_LOTTERY_RANGE_LOW - RUBI_ADDRESS_RANGE1_LOW;
+        break;
+    case BoardManager::addressing_extended:
+        max_boards_count = std::min(
+            BoardManager::inst().extended_boards_count,
+            RUBI_EXTENDED_ADDRESS_HIGH - RUBI_EXTENDED_ADDRESS_LOW + 1);
+        break;
+    default:
+        ASSERT(0);
+    }
+
+    ASSERT(max_boards_count > 0 && max_boards_count <= 0x10000);
+
     address_pool.resize(max_boards_count);
-    traffic.resize(max_boards_count);
+    for (int i = 0; i < max_boards_count; i++)
+        free_addresses.push_back(i);
 
     socketcan = std::unique_ptr<SocketCan>(new SocketCan(can_name));
-    socketcan->Send(std::pair<uint16_t, std::vector<uint8_t>>(
+    socketcan->SetExactBitStuffing(BoardManager::inst().exact_bit_stuffing);
+
+    if (auto configured_bitrate = CanGetBitrate(can_name))
+    {
+        bitrate = *configured_bitrate;
+    }
+    else
+    {
+        bitrate = BoardManager::inst().default_bitrate;
+        LOG_WARNING(log, "Bitrate of " + can_name + " is unknown, assuming " +
+                         std::to_string(bitrate) + " bit/s.");
+    }
+    socketcan->Send(std::pair<uint32_t, std::vector<uint8_t>>(
         RUBI_BROADCAST1, lottery_invitation));
+
+    LOG_INFO(log, "Bus " + can_name + " can address up to " +
+                  std::to_string(max_boards_count) + " boards.");
+
+    if (BoardManager::inst().broadcast_keepalive)
+    {
+        scheduler.SchedulePeriodic(BoardManager::inst().keepalive_interval,
+                                   [this]() { BroadcastKeepAlive(); });
+    }
+}
+
+uint32_t CanHandler::NodeToCob(uint16_t board_nodeid)
+{
+    if (BoardManager::inst().addressing == BoardManager::addressing_extended)
+        return CAN_EFF_FLAG | (RUBI_EXTENDED_ADDRESS_LOW + board_nodeid);
+
+    return RUBI_ADDRESS_RANGE1_LOW + board_nodeid;
+}
+
+boost::optional<uint16_t> CanHandler::CobToNode(uint32_t cob)
+{
+    uint32_t low = NodeToCob(0);
+
+    if (cob >= low && cob < low + max_boards_count)
+        return (uint16_t)(cob - low);
+
+    return boost::none;
+}
+
+uint16_t CanHandler::NewBoard(uint16_t lottery_id)
+{
+    ASSERT(!free_addresses.empty(), "Out of board addresses!");
+
+    uint16_t board_nodeid = free_addresses.front();
+    free_addresses.pop_front();
+
+    address_pool[board_nodeid] =
+        std::make_shared<BoardCommunicationHandler>(this, board_nodeid);
+
+    std::vector<uint8_t> assignment = {(uint8_t)(board_nodeid & 0xff)};
+    if (BoardManager::inst().addressing == BoardManager::addressing_extended)
+        assignment.push_back((uint8_t)(board_nodeid >> 8));
+
+    socketcan->Send(std::pair<uint32_t, std::vector<uint8_t>>(
+        RUBI_LOTTERY_RANGE_LOW + lottery_id, assignment));
+
+    return board_nodeid;
 }
 
-uint8_t CanHandler::NewBoard(uint16_t lottery_id)
+void CanHandler::ReleaseAddress(sptr<BoardCommunicationHandler> handler)
 {
-    for (unsigned int i = 0; i < address_pool.size(); i++)
+    auto board_nodeid = handler->GetNodeId();
+
+    if (!address_pool[board_nodeid] || *address_pool[board_nodeid] != handler)
+        return;
+
+    BoardManager::inst().traffic_analyzer.Forget(*handler);
+    if (BoardManager::inst().IsBackendHandler(handler))
+        retired_handlers.push_back(handler);
+    address_pool[board_nodeid] = boost::none;
+    free_addresses.push_back(board_nodeid);
+}
+
+void CanHandler::ScheduleKeepAlive(
+    sptr<BoardCommunicationHandler> handler,
+    boost::optional<std::chrono::milliseconds> interval)
+{
+    if (!interval)
     {
-        if (!address_pool[i].is_initialized())
-        {
-            address_pool[i] =
-                std::make_shared<BoardCommunicationHandler>(this, i);
-            socketcan->Send(std::pair<uint16_t, std::vector<uint8_t>>(
-                RUBI_LOTTERY_RANGE_LOW + lottery_id,
-                std::vector<uint8_t>({(uint8_t)i})));
+        interval = BoardManager::inst().GetKeepAliveInterval(
+            handler->GetBoard().descriptor
+                ? handler->GetBoard().descriptor->board_name
+                : "");
+    }
+
+    if (handler->keepalive_timer)
+        scheduler.Cancel(handler->keepalive_timer);
+
+    std::weak_ptr<BoardCommunicationHandler> weak_handler = handler;
+    auto timer = std::make_shared<TimerWheel::timer_id>();
 
-            return i;
+    *timer = scheduler.SchedulePeriodic(*interval, [this, weak_handler,
+                                                    timer]() {
+        auto handler = weak_handler.lock();
+        if (!handler || handler->IsDead())
+        {
+            scheduler.Cancel(*timer);
+            if (handler)
+                ReleaseAddress(handler);
+            return;
         }
-    }
 
-    ASSERT(false);
-    return 0;
+        if (handler->GetBoard().descriptor && !IsCoveredByBroadcast(handler))
+            handler->KeepAliveRequest();
+    });
+
+    handler->keepalive_timer = *timer;
+    handler->keepalive_interval = *interval;
 }
 
-void CanHandler::Tick(std::chrono::system_clock::time_point time)
+bool CanHandler::IsCoveredByBroadcast(
+    sptr<BoardCommunicationHandler> handler)
 {
-    if (std::chrono::duration_cast<std::chrono::seconds>(time - last_keepalive)
-            .count() >= 1)
+    // boards on a non-default period keep being polled on their own
+    return BoardManager::inst().broadcast_keepalive &&
+           handler->IsBroadcastKeepAliveCapable() &&
+           handler->keepalive_interval ==
+               BoardManager::inst().keepalive_interval;
+}
+
+void CanHandler::BroadcastKeepAlive()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto requested = keepalive_seq_sent[keepalive_seq];
+
+    // see BoardCommunicationHandler::KeepAliveRequest()
+    if (now - requested < BoardManager::inst().keepalive_interval / 2)
+        return;
+
+    for (const auto &handler : address_pool)
     {
-        for (const auto &handler : address_pool)
+        if (handler && !(*handler)->IsDead() &&
+            (*handler)->GetBoard().descriptor &&
+            IsCoveredByBroadcast(*handler))
         {
-            if (handler && !(*handler)->IsDead() &&
-                (*handler)->GetBoard().descriptor)
-            {
-                (*handler)->KeepAliveRequest();
-            }
+            (*handler)->KeepAliveCheck(requested);
         }
-        last_keepalive = time;
     }
 
-    while (auto msg = socketcan->Receive(1))
-    {
-        auto rx = *msg;
+    // boards which only understand unicast keep-alives ignore this frame
+    keepalive_seq += 1;
+    keepalive_seq_sent[keepalive_seq] = now;
+    socketcan->Send(std::pair<uint32_t, std::vector<uint8_t>>(
+        RUBI_BROADCAST2,
+        {RUBI_MSG_COMMAND, RUBI_COMMAND_KEEPALIVE, keepalive_seq}));
+}
+
+void CanHandler::AdvanceTimers(std::chrono::system_clock::time_point time)
+{
+    scheduler.Advance(time);
+}
 
-        if (std::get<0>(rx) >= RUBI_LOTTERY_RANGE_LOW &&
-            std::get<0>(rx) <= RUBI_LOTTERY_RANGE_HIGH)
+void CanHandler::ReceiveFrames()
+{
+    // the frame is reused, so that receiving doesn't allocate
+    auto &rx = rx_frame;
+    timeval rx_time;
+
+    while (socketcan->Receive(0, rx, rx_time))
+    {
+        if (rx.first >= RUBI_LOTTERY_RANGE_LOW &&
+            rx.first <= RUBI_LOTTERY_RANGE_HIGH)
         {
-            uint16_t version_reported =
-                *(reinterpret_cast<uint16_t *>(std::get<1>(rx).data() + 2));
-            if (std::get<1>(rx).size() == 4 &&
-                version_reported == RUBI_PROTOCOL_VERSION)
-                NewBoard(std::get<0>(rx) - RUBI_LOTTERY_RANGE_LOW);
+            if (rx.second.size() == 4 &&
+                *(reinterpret_cast<uint16_t *>(rx.second.data() + 2)) ==
+                    RUBI_PROTOCOL_VERSION)
+                NewBoard(rx.first - RUBI_LOTTERY_RANGE_LOW);
             else
-                log.Error("Board with outdated/incompatible  protocol version "
-                          "found on the bus!");
+                LOG_ERROR(log, "Board with outdated/incompatible  protocol "
+                               "version found on the bus!");
         }
-        else if (std::get<0>(rx) >= RUBI_ADDRESS_RANGE1_LOW &&
-                 std::get<0>(rx) <= RUBI_ADDRESS_RANGE1_HIGH)
+        else if (auto board_nodeid = CobToNode(rx.first))
         {
-            int id = std::get<0>(rx) - RUBI_ADDRESS_RANGE1_LOW;
+            int id = *board_nodeid;
 
-            ASSERT(std::get<1>(rx).size() >= 1);
-            ASSERT(address_pool[id] != boost::none);
+            ASSERT(rx.second.size() >= 1);
+
+            if (!address_pool[id])
+            {
+                StatsAdd(unknown_frames);
+                LOG_WARNING(log, "Received message on an unassigned address.");
+                continue;
+            }
 
             if ((*address_pool[id])->IsDead())
             {
-                log.Error("Received message from board that should be dead!");
+                LOG_ERROR(log,
+                          "Received message from board that should be dead!");
                 continue;
             }
 
-            switch (std::get<1>(rx)[0] & RUBI_MSG_MASK)
+            switch (rx.second[0] & RUBI_MSG_MASK)
             {
             case RUBI_MSG_LOTTERY:
                 (*address_pool[id])->ConfirmAddress();
+                ScheduleKeepAlive(*address_pool[id]);
                 break;
             case RUBI_MSG_FIELD:
             case RUBI_MSG_FUNCTION:
-            case RUBI_MSG_INFO:
             case RUBI_MSG_BLOCK:
+            {
+                auto &handler = *address_pool[id];
+
+                // nothing but the frontend may allocate once the board is up
+                ALLOCATION_CHECK_SCOPE_IF(handler->frontend != nullptr);
+                handler->protocol->InboundWrapper(rx);
+                break;
+            }
+            case RUBI_MSG_INFO:
             case RUBI_MSG_EVENT:
             case RUBI_MSG_COMMAND:
-                (*address_pool[id])
-                    ->protocol->InboundWrapper(
-                        std::pair<uint16_t, bytes_t>(get<0>(rx), get<1>(rx)));
+                (*address_pool[id])->protocol->InboundWrapper(rx);
                 break;
 
             case RUBI_MSG_INIT_COMPLETE:
+                // the board class is known now, apply its own interval
+                ScheduleKeepAlive(*address_pool[id]);
                 BoardManager::inst().RegisterNewHandler(*address_pool[id]);
                 break;
             default:
@@ -120,15 +277,71 @@ void CanHandler::Tick(std::chrono::system_clock::time_point time)
         }
         else
         {
-            log.Warning("Unknown message received.");
+            StatsAdd(unknown_frames);
+            LOG_WARNING(log, "Unknown message received.");
         }
     }
 }
 
+std::vector<sptr<BoardCommunicationHandler>> CanHandler::GetHandlers()
+{
+    std::vector<sptr<BoardCommunicationHandler>> ret;
+
+    for (const auto &handler : address_pool)
+    {
+        if (handler && !(*handler)->IsDead() &&
+            (*handler)->GetBoard().descriptor)
+        {
+            ret.push_back(*handler);
+        }
+    }
+
+    return ret;
+}
+
+void CanHandler::DropRetired(sptr<BoardCommunicationHandler> handler)
+{
+    retired_handlers.erase(std::remove(retired_handlers.begin(),
+                                       retired_handlers.end(), handler),
+                           retired_handlers.end());
+}
+
+size_t CanHandler::GetAddressedCount()
+{
+    return max_boards_count - free_addresses.size();
+}
+
+sptr<BoardCommunicationHandler> CanHandler::GetHandler(uint32_t cob)
+{
+    auto board_nodeid = CobToNode(cob);
+    if (!board_nodeid || !address_pool[*board_nodeid])
+        return nullptr;
+
+    return *address_pool[*board_nodeid];
+}
+
+void CanHandler::BroadcastCommand(uint8_t command_id)
+{
+    socketcan->Send(std::pair<uint32_t, std::vector<uint8_t>>(
+        RUBI_BROADCAST1, {RUBI_MSG_COMMAND, command_id}));
+}
+
+int CanHandler::GetFd() { return socketcan->GetFd(); }
+
+std::string CanHandler::GetName() { return can_name; }
+
+SocketCan &CanHandler::GetSocket() { return *socketcan; }
+
+uint64_t CanHandler::GetUnknownFramesCount() { return unknown_frames; }
+
+BufferPool &CanHandler::GetBufferPool() { return *buffers; }
+
+uint32_t CanHandler::GetBitrate() { return bitrate; }
+
 uint64_t CanHandler::GetTrafficSoFar(bool reset)
 {
-    uint64_t total_data =
-        socketcan->GetTotalTransmittedDataSize() + socketcan->GetTotalReceivedDataSize();
+    uint64_t total_data = socketcan->GetTotalTransmittedBits() +
+                          socketcan->GetTotalReceivedBits();
     uint64_t to_return = total_data - traffic_reported;
 
     if (reset)
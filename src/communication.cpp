@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <memory>
 
+#include "alloc_check.h"
 #include "board.h"
 #include "communication.h"
 #include "exceptions.h"
@@ -14,23 +16,57 @@ using std::string;
 
 BoardInstance BoardCommunicationHandler::GetBoard() { return inst; }
 
+uint16_t BoardCommunicationHandler::GetNodeId() { return board_nodeid; }
+
 bool BoardCommunicationHandler::IsDead() { return dead; }
 bool BoardCommunicationHandler::IsLost() { return lost; }
 bool BoardCommunicationHandler::IsWake() { return wake; }
+bool BoardCommunicationHandler::IsBroadcastKeepAliveCapable()
+{
+    return broadcast_keepalive_capable;
+}
+
+std::chrono::microseconds BoardCommunicationHandler::GetKeepAliveRtt()
+{
+    return keepalive_rtt;
+}
+
+std::chrono::steady_clock::time_point
+BoardCommunicationHandler::GetLastKeepAlive()
+{
+    return keepalive_received;
+}
+
+void BoardCommunicationHandler::SetKeepAliveInterval(
+    std::chrono::milliseconds interval)
+{
+    if (interval != keepalive_interval)
+        can_handler->ScheduleKeepAlive(shared_from_this(), interval);
+}
 
-void BoardCommunicationHandler::FFDataOutbound(
-    std::shared_ptr<FFDescriptor> desc, std::vector<uint8_t> &data)
+void BoardCommunicationHandler::FFDataOutbound(int ffid,
+                                               std::vector<uint8_t> &data)
 {
-    if (IsWake())
-        protocol->SendFFData(desc->ffid, desc->GetFFType(), data);
+    if (!IsWake())
+        return;
+
+    ALLOCATION_CHECK_SCOPE();
+
+    if (ffid < (int)stats.fields_count)
+        stats.fields[ffid].CountTx(data.size());
+
+    protocol->SendFFData(ffid, inst.descriptor->layout.types[ffid], data);
 }
 
 BoardCommunicationHandler::BoardCommunicationHandler(CanHandler *can_handler,
-                                                     uint8_t board_nodeid)
+                                                     uint16_t board_nodeid)
     : can_handler(can_handler), dead(false), addressed(false),
       operational(false), lost(false), wake(false), keep_alives_missed(0),
-      keep_alive_received(true), received_descriptors(0)
+      keep_alive_received(true), received_descriptors(0),
+      board_nodeid(board_nodeid)
 {
+    lottery_won = std::chrono::steady_clock::now();
+    keepalive_received = lottery_won;
     protocol = std::unique_ptr<ProtocolHandler>(
         new ProtocolHandler(this, board_nodeid, can_handler));
 }
@@ -84,7 +120,7 @@ void BoardCommunicationHandler::EventInbound(int error_type,
                   ": " + error_msg;
         }
 
-        log.Error(msg);
+        LOG_ERROR(log, msg);
         break;
 
     case RUBI_EVENT_INFO:
@@ -93,7 +129,7 @@ void BoardCommunicationHandler::EventInbound(int error_type,
         msg = "Info from board " + (std::string)inst + ": ";
         msg += std::string((char *)data.data() + 1);
 
-        log.Info(msg);
+        LOG_INFO(log, msg);
         break;
 
     case RUBI_EVENT_WARNING:
@@ -102,7 +138,7 @@ void BoardCommunicationHandler::EventInbound(int error_type,
         msg = "Info from board " + (std::string)inst + ": ";
         msg += std::string((char *)data.data() + 1);
 
-        log.Warning(msg);
+        LOG_WARNING(log, msg);
         break;
 
     case RUBI_EVENT_ERROR:
@@ -111,7 +147,7 @@ void BoardCommunicationHandler::EventInbound(int error_type,
         msg = "Info from board " + (std::string)inst + ": ";
         msg += std::string((char *)data.data() + 1);
 
-        log.Error(msg);
+        LOG_ERROR(log, msg);
         break;
 
     default:
@@ -123,32 +159,92 @@ void BoardCommunicationHandler::CommandInbound(int command_id,
                                                std::vector<uint8_t> &data)
 {
     ASSERT(command_id == RUBI_COMMAND_KEEPALIVE);
-    // TODO keep-alive id
-
-    ASSERT(data.size() == 1);
+    ASSERT(data.size() >= 1);
     wake = data[0];
 
+    auto now = std::chrono::steady_clock::now();
+    auto requested = keepalive_sent;
+    if (data.size() >= 2)
+    {
+        // answer to a broadcast keep-alive, carrying its sequence number
+        broadcast_keepalive_capable = true;
+        requested = can_handler->keepalive_seq_sent[data[1]];
+    }
+
+    keepalive_rtt =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - requested);
+
+    if (pending_command && requested > pending_command->issued)
+    {
+        if (pending_command->command_id == RUBI_COMMAND_WAKE)
+            CompleteCommand(wake);
+        else if (pending_command->command_id == RUBI_COMMAND_SOFTSLEEP)
+            CompleteCommand(!wake);
+        else
+            CompleteCommand(true);
+    }
+
+    keepalive_received = now;
     keep_alive_received = true;
     lost = false;
     keep_alives_missed = 0;
+    keep_alives_compensated = 0;
 }
 
-void BoardCommunicationHandler::KeepAliveRequest()
+void BoardCommunicationHandler::KeepAliveCheck(
+    std::chrono::steady_clock::time_point requested)
 {
-    if (!keep_alive_received)
+    auto &manager = BoardManager::inst();
+
+    if (!keep_alive_received && manager.keepalive_compensation &&
+        keep_alives_compensated < 5 &&
+        manager.loop_monitor.WasLateSince(requested))
+    {
+        // the server overran a budget since the request, the answer may be
+        // late because of it rather than because of the board
+        keep_alives_compensated += 1;
+        StatsAdd(stats.keepalives_compensated);
+    }
+    else if (!keep_alive_received)
     {
         keep_alives_missed += 1;
         lost = true;
+        StatsAdd(stats.keepalives_missed);
 
-        log.Warning("Didn't receive keep-alive from " + (string)inst + "!");
+        LOG_WARNING(log,
+                    "Didn't receive keep-alive from " + (string)inst + "!");
+
+        if (pending_command)
+            CompleteCommand(false);
 
         if (keep_alives_missed == 5)
         {
             dead = true;
-            log.Error("Board " + (string)inst + " is now considered dead!");
+            LOG_ERROR(log,
+                      "Board " + (string)inst + " is now considered dead!");
         }
+
+        // once per outage, the primary is replaced by then or there's no
+        // standby to replace it with
+        if (keep_alives_missed == 1 && BoardManager::inst().redundancy &&
+            inst.descriptor)
+            BoardManager::inst().Failover(shared_from_this(), requested);
     }
     keep_alive_received = false;
+}
+
+void BoardCommunicationHandler::KeepAliveRequest()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    // a timer catching up after a stall of the server fires several times at
+    // once, the request in flight keeps the time it was given
+    if (now - keepalive_sent < keepalive_interval / 2)
+        return;
+
+    KeepAliveCheck(keepalive_sent);
+
+    keepalive_sent = now;
     protocol->SendCommand(RUBI_COMMAND_KEEPALIVE, {});
 }
 
@@ -157,6 +253,11 @@ void BoardCommunicationHandler::FFDataInbound(int ffid,
 {
     ASSERT(frontend);
 
+    if (ffid < (int)stats.fields_count)
+        stats.fields[ffid].CountRx(data.size());
+
+    // frontends allocate their messages, they are not on the frame path
+    ALLOCATION_CHECK_PAUSE();
     frontend->FFDataInbound(data, ffid);
 };
 
@@ -180,6 +281,14 @@ sptr<FrontendBoardHandler> BoardCommunicationHandler::GetFrontendHandler()
     return frontend;
 }
 
+CanHandler *BoardCommunicationHandler::GetCanHandler() { return can_handler; }
+
+size_t BoardCommunicationHandler::GetMemoryUsage()
+{
+    return sizeof(*this) + protocol->GetMemoryUsage() +
+           stats.fields_count * sizeof(traffic_stats_t);
+}
+
 void BoardCommunicationHandler::Hold()
 {
     protocol->SendCommand(RUBI_COMMAND_HOLD, {});
@@ -189,40 +298,103 @@ void BoardCommunicationHandler::CommandReboot()
 {
     dead = true;
     protocol->SendCommand(RUBI_COMMAND_REBOOT, {});
-    log.Info("Board " + (string)inst + " was ordered a reboot!");
+    LOG_INFO(log, "Board " + (string)inst + " was ordered a reboot!");
 }
 
 void BoardCommunicationHandler::CommandSleep()
 {
     protocol->SendCommand(RUBI_COMMAND_SOFTSLEEP, {});
-    log.Info("Board " + (string)inst + " ordered to go sleeping!");
+    LOG_INFO(log, "Board " + (string)inst + " ordered to go sleeping!");
 }
 
 void BoardCommunicationHandler::CommandWake()
 {
     protocol->SendCommand(RUBI_COMMAND_WAKE, {});
-    log.Info("Board " + (string)inst + " was ordered to wake up!");
+    LOG_INFO(log, "Board " + (string)inst + " was ordered to wake up!");
+}
+
+void BoardCommunicationHandler::GroupCommand(uint32_t request_id,
+                                             uint8_t command_id,
+                                             bool broadcast)
+{
+    pending_command = pending_command_t{request_id, command_id,
+                                        std::chrono::steady_clock::now()};
+
+    switch (command_id)
+    {
+    case RUBI_COMMAND_WAKE:
+        if (!broadcast)
+            protocol->SendCommand(RUBI_COMMAND_WAKE, {});
+        break;
+    case RUBI_COMMAND_SOFTSLEEP:
+        if (!broadcast)
+            protocol->SendCommand(RUBI_COMMAND_SOFTSLEEP, {});
+        break;
+    case RUBI_COMMAND_REBOOT:
+        if (!broadcast)
+            protocol->SendCommand(RUBI_COMMAND_REBOOT, {});
+
+        // a rebooting board won't answer keep-alives anymore
+        dead = true;
+        CompleteCommand(true);
+        break;
+    default:
+        ASSERT(0);
+    }
+}
+
+void BoardCommunicationHandler::CompleteCommand(bool success)
+{
+    BoardManager::inst().frontend->ReportGroupCommandStatus(
+        pending_command->request_id, pending_command->command_id, inst,
+        success);
+
+    pending_command = boost::none;
 }
 
 void BoardCommunicationHandler::HandshakeComplete()
 {
     string board_name = inst.descriptor->board_name;
+    inst.descriptor->Freeze();
+
+    auto &descriptor_map = BoardManager::inst().descriptor_map;
+    auto known = descriptor_map.find(board_name);
 
-    if (BoardManager::inst().descriptor_map.find(board_name) ==
-        BoardManager::inst().descriptor_map.end())
+    if (known == descriptor_map.end())
     {
-        BoardManager::inst().descriptor_map[board_name] = inst.descriptor;
+        descriptor_map[board_name] = inst.descriptor;
     }
     else
     {
-        if (*BoardManager::inst().descriptor_map[board_name] !=
-            *inst.descriptor)
+        if (*known->second != *inst.descriptor)
         {
-            log.Error((std::string) "Descriptor conflict for board + " +
-                      board_name + "!");
+            LOG_ERROR(log, (std::string) "Descriptor conflict for board + " +
+                           board_name + "!");
             ASSERT(0);
         }
+
+        // all the boards of a kind share a single descriptor
+        inst.descriptor = known->second;
     }
 
-    log.Info("Handshake complete for board " + board_name + "!");
+    auto &layout = inst.descriptor->layout;
+    stats.fields_count = layout.Size();
+    stats.fields.reset(new traffic_stats_t[stats.fields_count]);
+
+    // from now on, the board only sends its fields, functions and events
+    size_t largest_message = 0;
+    if (layout.Size())
+        largest_message =
+            *std::max_element(layout.sizes.begin(), layout.sizes.end());
+    protocol->SetExpectedMessageSize(largest_message);
+
+    auto &realtime = BoardManager::inst().realtime;
+    if (realtime.enabled && realtime.preallocate)
+        protocol->Preallocate();
+
+    auto handshake_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - lottery_won);
+
+    LOG_INFO(log, "Handshake complete for board " + board_name + " in " +
+                  std::to_string(handshake_time.count()) + " ms!");
 }
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
 #include <boost/optional.hpp>
+#include <chrono>
+#include <deque>
 #include <exception>
 #include <inttypes.h>
 #include <map>
@@ -16,39 +19,92 @@ class FrontendBoardHandler;
 class CommunicationFaker;
 
 #include "board.h"
+#include "buffer_pool.h"
 #include "descriptors.h"
 #include "frontend.h"
 #include "logger.h"
 #include "protocol.h"
 #include "socketcan.h"
+#include "stats.h"
+#include "timer_wheel.h"
 
 class CanHandler
 {
     friend class BoardCommunicationHandler;
     friend class ProtocolHandler;
 
-    std::vector<float> traffic;
+    std::string can_name;
     uint64_t traffic_reported = 0;
+    uint32_t bitrate;
+    std::atomic<uint64_t> unknown_frames{0};
+
+    // shared with the protocol handlers, which may outlive the bus
+    std::shared_ptr<BufferPool> buffers = std::make_shared<BufferPool>();
 
     std::unique_ptr<SocketCan> socketcan;
+    // reused by ReceiveFrames, so that receiving a frame doesn't allocate
+    std::pair<uint32_t, bytes_t> rx_frame{0, bytes_t(8)};
 
     std::vector<boost::optional<std::shared_ptr<BoardCommunicationHandler>>>
         address_pool;
 
+    // released addresses go to the back, so they are reused last
+    std::deque<uint16_t> free_addresses;
+    // handlers of dead boards, kept while they are the backends of their
+    // BoardInstances so that a board coming back can replace them
+    std::vector<sptr<BoardCommunicationHandler>> retired_handlers;
+
     int max_boards_count;
-    uint8_t GetFreeAdress();
-    uint8_t NewBoard(uint16_t lottery_id);
+    uint16_t NewBoard(uint16_t lottery_id);
+    void ReleaseAddress(sptr<BoardCommunicationHandler> handler);
 
-    std::chrono::system_clock::time_point last_keepalive;
+    // keep-alives and other periodic per-bus work
+    TimerWheel scheduler;
+    void ScheduleKeepAlive(
+        sptr<BoardCommunicationHandler> handler,
+        boost::optional<std::chrono::milliseconds> interval = boost::none);
+
+    // broadcast keep-alives, indexed by their sequence number
+    uint8_t keepalive_seq = 0;
+    std::array<std::chrono::steady_clock::time_point, 256> keepalive_seq_sent;
+    void BroadcastKeepAlive();
+    bool IsCoveredByBroadcast(sptr<BoardCommunicationHandler> handler);
 
     Logger log{"CanHandler"};
 
   public:
     CanHandler(std::string can_name);
+    // bits on the bus since the last reset, see CanFrameBits()
     uint64_t GetTrafficSoFar(bool reset = false);
-
-    // std::shared_ptr<BoardCommunicationHandler> GetHandler(int board_node_id);
-    void Tick(std::chrono::system_clock::time_point time);
+    uint32_t GetBitrate();
+
+    // handlers of boards which are alive and have introduced themselves
+    std::vector<sptr<BoardCommunicationHandler>> GetHandlers();
+    // boards holding an address, including those still in the handshake,
+    // lost or dead ones, and standbys
+    size_t GetAddressedCount();
+    void BroadcastCommand(uint8_t command_id);
+    // the dead handler has been replaced, it's no longer kept
+    void DropRetired(sptr<BoardCommunicationHandler> handler);
+
+    int GetFd();
+    std::string GetName();
+
+    // raw counters of the bus, for the statistics
+    SocketCan &GetSocket();
+    uint64_t GetUnknownFramesCount();
+    BufferPool &GetBufferPool();
+
+    uint32_t NodeToCob(uint16_t board_nodeid);
+    boost::optional<uint16_t> CobToNode(uint32_t cob);
+
+    // handler of the board at the identifier, if any
+    sptr<BoardCommunicationHandler> GetHandler(uint32_t cob);
+
+    // handles all frames waiting on the bus
+    void ReceiveFrames();
+    // keep-alives and other per-bus timers due by the time
+    void AdvanceTimers(std::chrono::system_clock::time_point time);
 };
 
 class BoardCommunicationHandler
@@ -58,9 +114,31 @@ class BoardCommunicationHandler
     friend class CommunicationFaker;
 
     int keep_alives_missed;
+    // in a row, a server which is always late still finds dead boards
+    int keep_alives_compensated = 0;
     int received_descriptors;
+    uint16_t board_nodeid;
 
     bool dead, lost, operational, addressed, keep_alive_received, wake;
+    TimerWheel::timer_id keepalive_timer = 0;
+    std::chrono::milliseconds keepalive_interval{0};
+
+    std::chrono::steady_clock::time_point lottery_won;
+
+    bool broadcast_keepalive_capable = false;
+    std::chrono::steady_clock::time_point keepalive_sent;
+    std::chrono::steady_clock::time_point keepalive_received;
+    std::chrono::microseconds keepalive_rtt{0};
+
+    // group command awaiting confirmation by the next keep-alive
+    struct pending_command_t
+    {
+        uint32_t request_id;
+        uint8_t command_id;
+        std::chrono::steady_clock::time_point issued;
+    };
+    boost::optional<pending_command_t> pending_command;
+    void CompleteCommand(bool success);
     std::unique_ptr<ProtocolHandler> protocol;
     CanHandler *can_handler;
 
@@ -72,6 +150,8 @@ class BoardCommunicationHandler
   public:
     void Launch(sptr<FrontendBoardHandler> _frontend);
     void KeepAliveRequest();
+    // of the request sent at the time point
+    void KeepAliveCheck(std::chrono::steady_clock::time_point requested);
     void ConfirmAddress();
     void Hold();
     void HandshakeComplete();
@@ -79,21 +159,34 @@ class BoardCommunicationHandler
     bool IsDead();
     bool IsLost();
     bool IsWake();
+    bool IsBroadcastKeepAliveCapable();
+
+    std::chrono::microseconds GetKeepAliveRtt();
+    std::chrono::steady_clock::time_point GetLastKeepAlive();
+    void SetKeepAliveInterval(std::chrono::milliseconds interval);
 
     void CommandReboot();
     void CommandWake();
     void CommandSleep();
+    void GroupCommand(uint32_t request_id, uint8_t command_id,
+                      bool broadcast);
 
     BoardInstance GetBoard();
     sptr<FrontendBoardHandler> GetFrontendHandler();
+    CanHandler *GetCanHandler();
+
+    board_stats_t stats;
+    // bytes of the handler, its protocol handler and their buffers
+    size_t GetMemoryUsage();
 
     void DescriptionDataInbound(int desc_type, std::vector<uint8_t> &data);
     void EventInbound(int error_id, std::vector<uint8_t> &data);
     void CommandInbound(int command_id, std::vector<uint8_t> &data);
 
     void FFDataInbound(int ffid, std::vector<uint8_t> &data);
-    void FFDataOutbound(std::shared_ptr<FFDescriptor> desc,
-                        std::vector<uint8_t> &data);
+    void FFDataOutbound(int ffid, std::vector<uint8_t> &data);
+
+    uint16_t GetNodeId();
 
-    BoardCommunicationHandler(CanHandler *can_handler, uint8_t board_nodeid);
+    BoardCommunicationHandler(CanHandler *can_handler, uint16_t board_nodeid);
 };
\ No newline at end of file
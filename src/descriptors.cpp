@@ -1,6 +1,7 @@
 #include <boost/algorithm/string/regex.hpp>
-#include <boost/range/combine.hpp>
 #include <boost/regex.hpp>
+#include <cstring>
+#include <functional>
 #include <tuple>
 
 #include "descriptors.h"
@@ -185,60 +186,110 @@ bool BoardDescriptor::operator!=(const BoardDescriptor &rhs)
     return !(*this == rhs);
 }
 
-bool BoardDescriptor::operator==(const BoardDescriptor &rhs)
+uint32_t DescriptorLayout::Intern(const std::string &name)
 {
-    if (rhs.board_name != board_name)
-        return false;
+    for (size_t offset = 0; offset < strings.size();
+         offset += strlen(&strings[offset]) + 1)
+        if (name == &strings[offset])
+            return offset;
 
-    if (rhs.description != description)
-        return false;
+    uint32_t offset = strings.size();
+    strings += name;
+    strings += '\0';
 
-    if (rhs.version != version)
-        return false;
+    return offset;
+}
 
-    if (rhs.driver != driver)
-        return false;
+std::vector<std::string> DescriptorLayout::GetSubnames(int ffid) const
+{
+    std::vector<std::string> ret;
 
-    if (rhs.fieldfunctions.size() != fieldfunctions.size())
-        return false;
+    for (uint32_t i = subnames_begin[ffid]; i < subnames_begin[ffid + 1]; i++)
+        ret.push_back(&strings[subnames[i]]);
 
-    for (auto ffs : boost::combine(rhs.fieldfunctions, fieldfunctions))
-    {
-        if (*ffs.get<0>() != ffs.get<1>())
-            return false;
-    }
+    return ret;
+}
+
+int DescriptorLayout::Find(const std::string &name) const
+{
+    for (size_t ffid = 0; ffid < names.size(); ffid++)
+        if (name == GetName(ffid))
+            return ffid;
 
-    return true;
+    return -1;
 }
 
-bool FFDescriptor::operator!=(const sptr<FFDescriptor> &rhs)
+bool DescriptorLayout::operator==(const DescriptorLayout &rhs) const
 {
-    return !(*this == rhs);
+    // names are interned in order, so equal descriptors have equal tables
+    return hash == rhs.hash && types == rhs.types &&
+           typecodes == rhs.typecodes && accesses == rhs.accesses &&
+           counts == rhs.counts && names == rhs.names &&
+           subnames_begin == rhs.subnames_begin && subnames == rhs.subnames &&
+           strings == rhs.strings;
 }
 
-bool FieldDescriptor::operator==(const sptr<FFDescriptor> &rhs)
+void BoardDescriptor::Freeze()
 {
-    auto ptr_rhs = std::dynamic_pointer_cast<FieldDescriptor>(rhs);
-    if (!ptr_rhs)
-        return false;
+    if (frozen)
+        return;
 
-    if (ptr_rhs->name != name)
-        return false;
+    if (fieldfunctions.size() > 0)
+        ASSERT(fieldfunctions.back()->CheckCompleteness());
 
-    if (ptr_rhs->typecode != typecode)
+    for (const auto &ff : fieldfunctions)
+    {
+        auto field = std::dynamic_pointer_cast<FieldDescriptor>(ff);
+        auto function = std::dynamic_pointer_cast<FunctionDescriptor>(ff);
+        ASSERT(field || function);
+
+        auto &subnames =
+            field ? field->subfields_names : function->arg_names;
+        size_t count = field ? std::max(subnames.size(), (size_t)1)
+                             : subnames.size();
+        ASSERT(count <= 0xff);
+
+        layout.types.push_back(ff->GetFFType());
+        layout.typecodes.push_back(ff->typecode);
+        layout.accesses.push_back(field ? field->access : 0);
+        layout.element_sizes.push_back(rubi_type_size(ff->typecode));
+        layout.counts.push_back(count);
+        layout.sizes.push_back(ff->GetFFSize());
+
+        layout.names.push_back(layout.Intern(ff->name));
+        layout.subnames_begin.push_back(layout.subnames.size());
+        for (const auto &name : subnames)
+            layout.subnames.push_back(layout.Intern(name));
+    }
+    layout.subnames_begin.push_back(layout.subnames.size());
+
+    std::hash<std::string> hash_string;
+    layout.hash = hash_string(layout.strings) ^
+                  hash_string(std::string(layout.typecodes.begin(),
+                                          layout.typecodes.end())) * 31 ^
+                  hash_string(std::string(layout.accesses.begin(),
+                                          layout.accesses.end())) * 961;
+
+    fieldfunctions.clear();
+    fieldfunctions.shrink_to_fit();
+    frozen = true;
+}
+
+bool BoardDescriptor::operator==(const BoardDescriptor &rhs)
+{
+    ASSERT(frozen && rhs.frozen);
+
+    if (rhs.board_name != board_name)
         return false;
 
-    if (ptr_rhs->subfields_names != subfields_names)
+    if (rhs.description != description)
         return false;
 
-    if (ptr_rhs->access != access)
+    if (rhs.version != version)
         return false;
 
-    return true;
-}
+    if (rhs.driver != driver)
+        return false;
 
-bool FunctionDescriptor::operator==(const sptr<FFDescriptor> &rhs)
-{
-    auto ptr_rhs = std::dynamic_pointer_cast<FunctionDescriptor>(rhs);
-    ASSERT(0);
+    return rhs.layout == layout;
 }
@@ -6,6 +6,7 @@
 #include <vector>
 #include <boost/optional.hpp>
 
+#include "protocol_defs.h"
 #include "types.h"
 
 class BoardDescriptor;
@@ -31,9 +32,6 @@ public:
   static std::shared_ptr<FFDescriptor> BuildDescriptor(int ffid, int msg_type,
                                                        std::string value);
 
-  virtual bool operator==(const sptr<FFDescriptor> &rhs) = 0;
-  virtual bool operator!=(const sptr<FFDescriptor> &rhs);
-
 private:
   bool complete;
 };
@@ -49,7 +47,6 @@ public:
   virtual void Build(int desc_id, std::string value) override;
   virtual int GetFFSize() override;
   virtual int GetFFType() override;
-  virtual bool operator==(const sptr<FFDescriptor> &rhs) override;
 };
 
 class FunctionDescriptor : public FFDescriptor
@@ -63,17 +60,68 @@ public:
   virtual void Build(int desc_id, std::string value) override;
   virtual int GetFFSize() override;
   virtual int GetFFType() override;
-  virtual bool operator==(const sptr<FFDescriptor> &rhs) override;
+};
+
+// Fields and functions of a complete descriptor as flat arrays indexed by
+// ffid, with the names in a single string table. Built once the handshake
+// completes and never modified afterwards, so that it can be shared by all
+// the boards with the same descriptor.
+class DescriptorLayout
+{
+public:
+  // RUBI_MSG_FIELD or RUBI_MSG_FUNCTION
+  std::vector<uint8_t> types;
+  // of the elements, the arguments of functions
+  std::vector<uint8_t> typecodes;
+  // 0 for functions
+  std::vector<uint8_t> accesses;
+  std::vector<uint8_t> element_sizes;
+  // subfields or arguments, fields without subfields count one
+  std::vector<uint8_t> counts;
+  // of the messages, element size times count
+  std::vector<uint16_t> sizes;
+
+  // offsets into strings, subfield or argument names of ffid are
+  // subnames[subnames_begin[ffid]] up to subnames[subnames_begin[ffid + 1]]
+  std::vector<uint32_t> names;
+  std::vector<uint32_t> subnames_begin;
+  std::vector<uint32_t> subnames;
+  // null terminated, each distinct name is stored once
+  std::string strings;
+
+  size_t hash = 0;
+
+  size_t Size() const { return types.size(); }
+  bool IsField(int ffid) const { return types[ffid] == RUBI_MSG_FIELD; }
+  const char *GetName(int ffid) const { return &strings[names[ffid]]; }
+  std::vector<std::string> GetSubnames(int ffid) const;
+  // -1 when there is no such field or function
+  int Find(const std::string &name) const;
+
+  bool operator==(const DescriptorLayout &rhs) const;
+
+private:
+  friend class BoardDescriptor;
+
+  uint32_t Intern(const std::string &name);
 };
 
 class BoardDescriptor
 {
 private:
+  bool frozen = false;
+
 public:
   std::string board_name, version, driver, description;
+  // only while the descriptor is being built, see Freeze
   std::vector<std::shared_ptr<FFDescriptor>> fieldfunctions;
+  DescriptorLayout layout;
 
   void ApplyInfo(uint8_t desc_type, std::string value);
+  // builds the layout and drops fieldfunctions, the descriptor is
+  // read-only from then on
+  void Freeze();
+  bool IsFrozen() const { return frozen; }
   std::string GetBoardPrefix(boost::optional<std::string> id);
   bool operator==(const BoardDescriptor &rhs);
   bool operator!=(const BoardDescriptor &rhs);
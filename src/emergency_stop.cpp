@@ -0,0 +1,218 @@
+#include "emergency_stop.h"
+#include "exceptions.h"
+#include "protocol_defs.h"
+
+#include <csignal>
+#include <ctime>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+EmergencyStop *EmergencyStop::instance = nullptr;
+
+static int64_t MonotonicNow()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// whether a process is bound to the unix socket at the path, a socket left
+// behind by one which exited refuses connections
+static bool IsSocketAlive(const std::string &path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int probe = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (probe < 0)
+        return false;
+
+    bool alive = connect(probe, (sockaddr *)&addr, sizeof(addr)) == 0;
+    close(probe);
+
+    return alive;
+}
+
+EmergencyStop::EmergencyStop(std::vector<std::string> cans_names,
+                             std::string local_socket_path, int priority,
+                             bool handle_signal)
+    : handle_signal(handle_signal), local_socket_path(local_socket_path)
+{
+    if (local_socket_path != "")
+    {
+        struct stat path_stat;
+        bool exists = lstat(local_socket_path.c_str(), &path_stat) == 0;
+
+        if (exists && (!S_ISSOCK(path_stat.st_mode) ||
+                       IsSocketAlive(local_socket_path)))
+            throw RubiException("Emergency stop socket " + local_socket_path +
+                                " is in use, set emergency_stop_socket to a "
+                                "path of its own");
+
+        // a stale socket of a server which exited
+        if (exists)
+            unlink(local_socket_path.c_str());
+    }
+
+    for (const auto &can_name : cans_names)
+    {
+        sockets.emplace_back(new SocketCan(can_name));
+        sockets.back()->DisableReceive();
+    }
+
+    trigger_fd = eventfd(0, EFD_NONBLOCK);
+    ASSERT(trigger_fd >= 0);
+
+    if (local_socket_path != "")
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, local_socket_path.c_str(),
+                sizeof(addr.sun_path) - 1);
+
+        local_socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+        if (local_socket < 0 ||
+            bind(local_socket, (sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            LOG_ERROR(log, "Can't bind the emergency stop socket at " +
+                           local_socket_path + "!");
+            if (local_socket >= 0)
+                close(local_socket);
+            local_socket = -1;
+        }
+    }
+
+    worker = std::thread(&EmergencyStop::Worker, this);
+
+    sched_param param;
+    param.sched_priority = priority;
+    if (pthread_setschedparam(worker.native_handle(), SCHED_FIFO, &param))
+        LOG_WARNING(log, "Can't run the emergency stop thread with SCHED_FIFO "
+                         "priority " +
+                         std::to_string(priority) + ".");
+
+    if (handle_signal)
+    {
+        instance = this;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = EmergencyStop::SignalHandler;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, nullptr);
+    }
+}
+
+EmergencyStop::~EmergencyStop()
+{
+    if (handle_signal)
+    {
+        signal(SIGUSR1, SIG_DFL);
+        instance = nullptr;
+    }
+
+    quit = true;
+    uint64_t one = 1;
+    if (write(trigger_fd, &one, sizeof(one)) < 0)
+        perror("eventfd write");
+
+    worker.join();
+
+    close(trigger_fd);
+    if (local_socket >= 0)
+    {
+        close(local_socket);
+        unlink(local_socket_path.c_str());
+    }
+}
+
+void EmergencyStop::SignalHandler(int signal)
+{
+    if (instance)
+        instance->Trigger();
+}
+
+void EmergencyStop::Trigger()
+{
+    int64_t none = 0;
+    trigger_time_ns.compare_exchange_strong(none, MonotonicNow());
+
+    uint64_t one = 1;
+    if (write(trigger_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+void EmergencyStop::Broadcast()
+{
+    std::vector<uint8_t> sleep_command = {RUBI_MSG_COMMAND,
+                                          RUBI_COMMAND_SOFTSLEEP};
+    std::vector<float> latencies;
+    int64_t triggered = trigger_time_ns.exchange(0);
+
+    for (auto &socket : sockets)
+    {
+        bool sent = false;
+
+        // give up on a bus which is stuck rather than starve the others
+        for (int attempt = 0; attempt < 1000 && !sent; attempt++)
+            sent = socket->Send(std::pair<uint32_t, std::vector<uint8_t>>(
+                                    RUBI_BROADCAST1, sleep_command),
+                                false);
+
+        latencies.push_back(sent ? (MonotonicNow() - triggered) / 1000.0f
+                                 : -1.0f);
+    }
+
+    std::lock_guard<std::mutex> guard(results_lock);
+    results = latencies;
+}
+
+void EmergencyStop::Worker()
+{
+    pollfd fds[2] = {{trigger_fd, POLLIN, 0}, {local_socket, POLLIN, 0}};
+    int fds_n = local_socket >= 0 ? 2 : 1;
+
+    while (!quit)
+    {
+        if (poll(fds, fds_n, -1) <= 0)
+            continue;
+
+        if (fds_n > 1 && (fds[1].revents & POLLIN))
+        {
+            char buf[64];
+            while (recv(local_socket, buf, sizeof(buf), 0) >= 0)
+                ;
+
+            int64_t none = 0;
+            trigger_time_ns.compare_exchange_strong(none, MonotonicNow());
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(trigger_fd, &count, sizeof(count)) < 0)
+                continue;
+        }
+
+        if (!quit && trigger_time_ns != 0)
+            Broadcast();
+    }
+}
+
+boost::optional<std::vector<float>> EmergencyStop::PollLatencies()
+{
+    std::lock_guard<std::mutex> guard(results_lock);
+
+    auto ret = results;
+    results = boost::none;
+
+    return ret;
+}
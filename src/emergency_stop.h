@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <boost/optional.hpp>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+#include "socketcan.h"
+#include "types.h"
+
+// Emergency stop fast path. A dedicated thread owns a separate socket per
+// bus and, once triggered, broadcasts a sleep command on all of them without
+// going through the bus handlers. It can be triggered with Trigger(), with
+// SIGUSR1 if it may handle it, or by sending any datagram to a local unix
+// socket. A socket another process is still bound to is never taken over.
+class EmergencyStop
+{
+    static EmergencyStop *instance;
+    static void SignalHandler(int signal);
+    bool handle_signal;
+
+    std::vector<uptr<SocketCan>> sockets;
+    int trigger_fd = -1;
+    int local_socket = -1;
+    std::string local_socket_path;
+
+    std::thread worker;
+    std::atomic<bool> quit{false};
+
+    // CLOCK_MONOTONIC timestamp of the pending trigger, 0 if none
+    std::atomic<int64_t> trigger_time_ns{0};
+
+    std::mutex results_lock;
+    boost::optional<std::vector<float>> results;
+
+    Logger log{"EmergencyStop"};
+
+    void Worker();
+    void Broadcast();
+
+  public:
+    // throws if another process listens at local_socket_path
+    EmergencyStop(std::vector<std::string> cans_names,
+                  std::string local_socket_path, int priority,
+                  bool handle_signal);
+    ~EmergencyStop();
+
+    // async-signal-safe
+    void Trigger();
+
+    // trigger-to-wire latency of every bus in us, once per emergency stop
+    boost::optional<std::vector<float>> PollLatencies();
+};
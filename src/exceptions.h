@@ -37,6 +37,7 @@ class AssertionFailedException : RubiException
                         std::to_string(line) + ")";
 
         Logger("Exception").Error(rubi_msg);
+        Logger::Drain();
     }
 };
 
@@ -18,7 +18,8 @@ bool BoardCommunicationHandler::IsWake() { return wake; }
 
 sptr<BoardCommunicationHandler>
 CommunicationFaker::FakeBoard(std::string board_name,
-                              std::vector<std::pair<fields_desc, int>> fields)
+                              std::vector<std::pair<fields_desc, int>> fields,
+                              boost::optional<std::string> id)
 {
     int i = 0;
     default_values.push_back(std::vector<boost::any>());
@@ -48,9 +49,12 @@ CommunicationFaker::FakeBoard(std::string board_name,
         ++i;
     }
 
+    descriptor->Freeze();
+
     auto handler = std::make_shared<BoardCommunicationHandler>(nullptr, 0);
     BoardInstance inst(handler);
     inst.descriptor = descriptor;
+    inst.id = id;
     inst.backend_handler = handler;
 
     BoardManager::inst().descriptor_map[descriptor->board_name] = descriptor;
@@ -74,8 +78,8 @@ void BoardCommunicationHandler::FFDataInbound(int ffid,
     frontend->FFDataInbound(data, ffid);
 };
 
-void BoardCommunicationHandler::FFDataOutbound(
-    std::shared_ptr<FFDescriptor> desc, std::vector<uint8_t> &data)
+void BoardCommunicationHandler::FFDataOutbound(int ffid,
+                                               std::vector<uint8_t> &data)
 {
     string msg = "Message for the board: " + inst.descriptor->board_name;
     msg += " ";
@@ -87,16 +91,47 @@ void BoardCommunicationHandler::FFDataOutbound(
 
     msg = msg.substr(0, msg.size() - 1);
 
-    log.Info(msg);
+    LOG_INFO(log, msg);
 };
 
 BoardCommunicationHandler::BoardCommunicationHandler(CanHandler *can_handler,
-                                                     uint8_t board_nodeid)
+                                                     uint16_t board_nodeid)
 {
 }
 
 CommunicationFaker::CommunicationFaker() {}
 
 void BoardCommunicationHandler::CommandReboot() { ASSERT(0); }
+
+// fake boards are not on any bus
+CanHandler *BoardCommunicationHandler::GetCanHandler() { return nullptr; }
+
+std::chrono::microseconds BoardCommunicationHandler::GetKeepAliveRtt()
+{
+    return std::chrono::microseconds(0);
+}
+
+std::string CanHandler::GetName() { return can_name; }
+
+SocketCan &CanHandler::GetSocket() { return *socketcan; }
+
+uint64_t CanHandler::GetUnknownFramesCount() { return unknown_frames; }
+
+BufferPool &CanHandler::GetBufferPool() { return *buffers; }
+
+// fake boards have no protocol handler
+size_t BoardCommunicationHandler::GetMemoryUsage() { return sizeof(*this); }
+
+uint32_t CanHandler::GetBitrate() { return bitrate; }
+
+std::vector<sptr<BoardCommunicationHandler>> CanHandler::GetHandlers()
+{
+    return {};
+}
+
+sptr<BoardCommunicationHandler> CanHandler::GetHandler(uint32_t cob)
+{
+    return nullptr;
+}
 void BoardCommunicationHandler::CommandSleep() { wake = false; }
 void BoardCommunicationHandler::CommandWake() { wake = true; }
\ No newline at end of file
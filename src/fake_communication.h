@@ -1,4 +1,5 @@
 #include <boost/any.hpp>
+#include <boost/optional.hpp>
 #include <string>
 #include <tuple>
 
@@ -15,6 +16,7 @@ class CommunicationFaker
 
     sptr<BoardCommunicationHandler>
     FakeBoard(std::string board_name,
-              std::vector<std::pair<fields_desc, int>> fields);
+              std::vector<std::pair<fields_desc, int>> fields,
+              boost::optional<std::string> id = boost::none);
     void Tick();
 };
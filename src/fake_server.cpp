@@ -1,19 +1,38 @@
 #include <boost/algorithm/string.hpp>
 #include <cstring>
+#include <ctime>
+#include <fstream>
+#include <poll.h>
+#include <queue>
+#include <sys/resource.h>
+#include <thread>
 #include <vector>
+#include <yaml-cpp/yaml.h>
+
+#include <ros/callback_queue.h>
+#include <ros/ros.h>
 
 #include "board.h"
 #include "exceptions.h"
 #include "fake_communication.h"
+#include "histogram.h"
 #include "ros_frontend.h"
 #include "rubi_autodefs.h"
 
+#include "rubi_server/RubiBool.h"
+#include "rubi_server/RubiFloat.h"
+#include "rubi_server/RubiInt.h"
+#include "rubi_server/RubiString.h"
+#include "rubi_server/RubiUnsignedInt.h"
+
 using std::vector;
 using std::string;
 using boost::any;
 using std::pair;
 using std::make_pair;
 
+typedef std::chrono::steady_clock::time_point time_point;
+
 BoardManager::BoardManager() {}
 
 sptr<BoardCommunicationHandler>
@@ -23,133 +42,519 @@ BoardManager::RequestNewHandler(BoardInstance inst,
     return nullptr;
 }
 
+void BoardManager::Panic() {}
+
+// fake boards are not on a bus, there is nobody to send group commands to
+uint32_t BoardManager::GroupCommand(uint8_t command_id, std::string selector,
+                                    std::string value,
+                                    std::vector<BoardInstance> &targets)
+{
+    return ++group_commands_issued;
+}
+
+// used when no _scenario is given, the boards the fake server always had
+static const char *default_scenario = R"(
+boards:
+  - name: FakeBoard1
+    fields:
+      - {name: FloatTest, type: float, access: readonly}
+      - {name: StringTest, type: shortstring, access: writeonly}
+      - {name: IntTest, type: int32, access: readwrite, rate: 30}
+      - {name: BoolTest, type: bool, access: readwrite, rate: 30}
+  - name: FakeBoard2
+    fields:
+      - {name: FloatTest, type: float, subfields: [Subfield1],
+         access: readonly}
+      - {name: StringTest, type: shortstring,
+         subfields: [Subfield1, Subfield2], access: writeonly}
+      - {name: IntTest, type: int32,
+         subfields: [Subfield1, Subfield, SuBfIlEd], access: writeonly,
+         rate: 30}
+      - {name: BoolTest, type: bool, subfields: [Subfield1, sqi, SuBfIlEd],
+         access: writeonly, rate: 30}
+  - name: FakeBoard3
+    fields:
+      - {name: FloatTest, type: float, access: readonly}
+      - {name: StringTest, type: longstring, access: readonly}
+      - {name: StringTest2, type: shortstring, access: readonly}
+      - {name: IntTest, type: uint32, access: readonly}
+      - {name: IntTest2, type: uint32, access: writeonly}
+)";
+
+// a field of a board instance, updated at a fixed rate
+struct load_field_t
+{
+    // sequence numbers are carried in the first value of every update, the
+    // scheduled times of the last updates are kept to compute the latency
+    static const int sent_n = 256;
+
+    sptr<BoardCommunicationHandler> board;
+    int ffid;
+    uint8_t typecode;
+    int size;
+    std::chrono::nanoseconds period;
+
+    time_point next;
+    uint32_t seq = 0;
+    std::array<std::atomic<int64_t>, sent_n> sent;
+    bool subscribe;
+
+    ros::Subscriber probe;
+};
+
+struct load_stats_t
+{
+    uint64_t injected = 0;
+    uint64_t late = 0; // injected more than a period after scheduled
+    std::atomic<uint64_t> delivered{0};
+    LatencyHistogram latency;
+    LatencyHistogram latency_window; // reset by every report
+};
+
+// value of a "_name:=value" argument
+static string GetArgument(int argc, char **argv, string name, string fallback)
+{
+    string prefix = "_" + name + ":=";
+
+    for (int i = 1; i < argc; i++)
+        if (boost::starts_with(argv[i], prefix))
+            return string(argv[i]).substr(prefix.size());
+
+    return fallback;
+}
+
+static uint8_t ParseType(const string &type)
+{
+    static const std::map<string, uint8_t> types = {
+        {"int32", _RUBI_TYPECODES_int32_t},
+        {"int16", _RUBI_TYPECODES_int16_t},
+        {"int8", _RUBI_TYPECODES_int8_t},
+        {"uint32", _RUBI_TYPECODES_uint32_t},
+        {"uint16", _RUBI_TYPECODES_uint16_t},
+        {"uint8", _RUBI_TYPECODES_uint8_t},
+        {"float", _RUBI_TYPECODES_float},
+        {"bool", _RUBI_TYPECODES_bool},
+        {"shortstring", _RUBI_TYPECODES_shortstring},
+        {"longstring", _RUBI_TYPECODES_longstring}};
+
+    auto typecode = types.find(boost::erase_last_copy(type, "_t"));
+    if (typecode == types.end())
+        throw RubiException("Scenario: unknown field type " + type);
+
+    return typecode->second;
+}
+
+static int ParseAccess(const string &access)
+{
+    if (access == "readonly")
+        return RUBI_READONLY;
+    if (access == "writeonly")
+        return RUBI_WRITEONLY;
+    if (access == "readwrite")
+        return RUBI_READWRITE;
+
+    throw RubiException("Scenario: unknown field access " + access);
+}
+
+// either a list of names or their count
+static vector<string> ParseSubfields(const YAML::Node &subfields)
+{
+    vector<string> names;
+
+    if (!subfields)
+        return names;
+
+    if (subfields.IsSequence())
+        return subfields.as<vector<string>>();
+
+    for (int i = 0; i < subfields.as<int>(); i++)
+        names.push_back("s" + std::to_string(i));
+
+    return names;
+}
+
+// first value of the update carries the sequence number, modulo sent_n
+static void FillUpdate(load_field_t &field, vector<uint8_t> &data)
+{
+    uint8_t key = field.seq % load_field_t::sent_n;
+    float key_float = key;
+
+    data.assign(field.size, 0);
+
+    switch (field.typecode)
+    {
+    case _RUBI_TYPECODES_float:
+        memcpy(data.data(), &key_float, sizeof(key_float));
+        break;
+    case _RUBI_TYPECODES_bool:
+        data[0] = field.seq % 2;
+        break;
+    case _RUBI_TYPECODES_shortstring:
+    case _RUBI_TYPECODES_longstring:
+        snprintf((char *)data.data(), data.size(), "%u", key);
+        break;
+    default:
+        // little-endian integers of any width
+        data[0] = key;
+        break;
+    }
+}
+
+static void RecordDelivery(load_field_t *field, load_stats_t *stats,
+                           int64_t key)
+{
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+                   .count();
+    int64_t sent = field->sent[key & (load_field_t::sent_n - 1)];
+
+    stats->delivered += 1;
+    if (sent)
+    {
+        stats->latency.Record(now - sent);
+        stats->latency_window.Record(now - sent);
+    }
+}
+
+// subscribes to the field as any consumer would, on the probes' queue
+static void SubscribeProbe(ros::NodeHandle &n, BoardInstance &inst,
+                           load_field_t *field, load_stats_t *stats)
+{
+    auto topic = inst.descriptor->GetBoardPrefix(inst.id) +
+                 "fields_from_board/" +
+                 inst.descriptor->layout.GetName(field->ffid);
+    const int queue_size = 1000;
+
+    // std::func inference seems broken
+    switch (field->typecode)
+    {
+    case _RUBI_TYPECODES_int32_t:
+    case _RUBI_TYPECODES_int16_t:
+    case _RUBI_TYPECODES_int8_t:
+        field->probe = n.subscribe<rubi_server::RubiInt>(
+            topic, queue_size,
+            boost::function<void(const rubi_server::RubiInt::ConstPtr &)>(
+                [field, stats](const rubi_server::RubiInt::ConstPtr &msg) {
+                    RecordDelivery(field, stats, msg->data[0]);
+                }));
+        break;
+    case _RUBI_TYPECODES_uint32_t:
+    case _RUBI_TYPECODES_uint16_t:
+    case _RUBI_TYPECODES_uint8_t:
+        field->probe = n.subscribe<rubi_server::RubiUnsignedInt>(
+            topic, queue_size,
+            boost::function<void(
+                const rubi_server::RubiUnsignedInt::ConstPtr &)>(
+                [field,
+                 stats](const rubi_server::RubiUnsignedInt::ConstPtr &msg) {
+                    RecordDelivery(field, stats, msg->data[0]);
+                }));
+        break;
+    case _RUBI_TYPECODES_float:
+        field->probe = n.subscribe<rubi_server::RubiFloat>(
+            topic, queue_size,
+            boost::function<void(const rubi_server::RubiFloat::ConstPtr &)>(
+                [field, stats](const rubi_server::RubiFloat::ConstPtr &msg) {
+                    RecordDelivery(field, stats, (int64_t)msg->data[0]);
+                }));
+        break;
+    case _RUBI_TYPECODES_shortstring:
+    case _RUBI_TYPECODES_longstring:
+        field->probe = n.subscribe<rubi_server::RubiString>(
+            topic, queue_size,
+            boost::function<void(const rubi_server::RubiString::ConstPtr &)>(
+                [field, stats](const rubi_server::RubiString::ConstPtr &msg) {
+                    RecordDelivery(field, stats, std::stoi(msg->data[0]));
+                }));
+        break;
+    case _RUBI_TYPECODES_bool:
+        // one bit can't carry a sequence number, only counted
+        field->probe = n.subscribe<rubi_server::RubiBool>(
+            topic, queue_size,
+            boost::function<void(const rubi_server::RubiBool::ConstPtr &)>(
+                [stats](const rubi_server::RubiBool::ConstPtr &msg) {
+                    stats->delivered += 1;
+                }));
+        break;
+    default:
+        ASSERT(false);
+    }
+}
+
+static std::chrono::nanoseconds GetCpuTime(int who)
+{
+    rusage usage;
+    getrusage(who, &usage);
+
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           std::chrono::microseconds(usage.ru_utime.tv_usec +
+                                     usage.ru_stime.tv_usec);
+}
+
 int main(int argc, char **argv)
 {
-// required for the ROS' arguments jugglery
-#pragma GCC diagnostic ignored "-Wwrite-strings"
-    char *fake_args[] = {
-        "/", "_cans:=can0,can1",
-    };
-#pragma GCC diagnostic pop
+    // the fake boards live on can0 and can1 unless told otherwise
+    vector<char *> args = {argv[0], (char *)"_cans:=can0,can1"};
+    args.insert(args.end(), argv + 1, argv + argc);
 
     sptr<RosModule> frontend = std::make_shared<RosModule>();
     BoardManager::inst().frontend = frontend;
 
-    frontend->Init(2, fake_args);
+    frontend->Init(args.size(), args.data());
     CommunicationFaker faker;
+    Logger log("FakeServer");
+
+    string scenario_path = GetArgument(argc, argv, "scenario", "");
+    string report_path = GetArgument(argc, argv, "report", "");
+    // for fields which don't say, false measures the undecoded path
+    bool subscribe_all = GetArgument(argc, argv, "subscribe", "true") == "true";
+
+    YAML::Node scenario = scenario_path.empty()
+                              ? YAML::Load(default_scenario)
+                              : YAML::LoadFile(scenario_path);
+
+    // 0 runs until interrupted
+    auto duration = std::chrono::duration<double>(
+        scenario["duration"].as<double>(0));
+    auto report_period = std::chrono::duration<double>(
+        scenario["report_period"].as<double>(1));
 
-    vector<sptr<BoardCommunicationHandler>> publishers;
-    vector<pair<fields_desc, int>> board1_fields, board2_fields, board3_fields;
-
-    board1_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("FloatTest", {}, _RUBI_TYPECODES_float, any(666.6f)),
-        RUBI_READONLY));
-    board1_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("StringTest", {}, _RUBI_TYPECODES_shortstring,
-                    any(string("Hello world"))),
-        RUBI_WRITEONLY));
-    board1_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("IntTest", {}, _RUBI_TYPECODES_int32_t, any(333)),
-        RUBI_READWRITE));
-    board1_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("BoolTest", {}, _RUBI_TYPECODES_bool, any(1)),
-        RUBI_READWRITE));
-
-    board2_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("FloatTest", {"Subfield1"}, _RUBI_TYPECODES_float,
-                    any(666.6f)),
-        RUBI_READONLY));
-    board2_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("StringTest", {"Subfield1", "Subfield2"},
-                    _RUBI_TYPECODES_shortstring, any(string("Hello world"))),
-        RUBI_WRITEONLY));
-    board2_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("IntTest", {"Subfield1", "Subfield", "SuBfIlEd"},
-                    _RUBI_TYPECODES_int32_t, any(333)),
-        RUBI_WRITEONLY));
-    board2_fields.push_back(make_pair<fields_desc, int>(
-        fields_desc("BoolTest", {"Subfield1", "sqi", "SuBfIlEd"},
-                    _RUBI_TYPECODES_bool, any(0)),
-        RUBI_WRITEONLY));
-
-    board3_fields.push_back(std::make_pair<fields_desc, int>(
-        fields_desc("FloatTest", {}, _RUBI_TYPECODES_float, any(666.6f)),
-        RUBI_READONLY));
-    board3_fields.push_back(std::make_pair<fields_desc, int>(
-        fields_desc(
-            "StringTest", {}, _RUBI_TYPECODES_longstring,
-            any(string("1234567890123456789012345678901234567890123456789012345"
-                       "6789012345678901234567890123456789012345678901234567890"
-                       "1234567890123456789012345678901234567890123456789012345"
-                       "6789012345678901234567890123456789012345678901234567890"
-                       "12345678901234567890123456789012345"))),
-        RUBI_READONLY));
-    board3_fields.push_back(std::make_pair<fields_desc, int>(
-        fields_desc("StringTest2", {}, _RUBI_TYPECODES_shortstring,
-                    any(string("omedetou kurisumasu"))),
-        RUBI_READONLY));
-    board3_fields.push_back(std::make_pair<fields_desc, int>(
-        fields_desc("IntTest", {}, _RUBI_TYPECODES_uint32_t, any(123)),
-        RUBI_READONLY));
-    board3_fields.push_back(std::make_pair<fields_desc, int>(
-        fields_desc("IntTest2", {}, _RUBI_TYPECODES_uint32_t, any(987)),
-        RUBI_WRITEONLY));
-
-    publishers.push_back(faker.FakeBoard("FakeBoard1", board1_fields));
-    publishers.push_back(faker.FakeBoard("FakeBoard2", board2_fields));
-    faker.FakeBoard("FakeBoard3", board3_fields);
-    // faker.FakeBoard("b", board1_fields);
-    // faker.FakeBoard("c", board1_fields);
-    // faker.FakeBoard("d", board1_fields);
-    // faker.FakeBoard("e", board1_fields);
-    // faker.FakeBoard("f", board1_fields);
-    // faker.FakeBoard("t", board2_fields);
-    // faker.FakeBoard("u", board2_fields);
-    // faker.FakeBoard("w", board2_fields);
-    // faker.FakeBoaptrrd("x", board2_fields);
-    // faker.FakeBoard("y", board2_fields);
-    // faker.FakeBoard("z", board1_fields);
-    // faker.FakeBoard("z1", board1_fields);
-    // faker.FakeBoard("z2", board1_fields);
-    // faker.FakeBoard("z3", board1_fields);
-    // faker.FakeBoard("z4", board2_fields);
-    // faker.FakeBoard("z5", board2_fields);
-    // faker.FakeBoard("zz5", board2_fields);
-    // faker.FakeBoard("zz5", board2_fields);
-    // faker.FakeBoard("zz6", board2_fields);
-
-    for (int iter = 0;; iter++)
+    // probes run on a thread of their own, like a separate consumer would
+    ros::NodeHandle probe_n;
+    ros::CallbackQueue probe_queue;
+    probe_n.setCallbackQueue(&probe_queue);
+    ros::AsyncSpinner probe_spinner(1, &probe_queue);
+
+    vector<std::unique_ptr<load_field_t>> fields;
+    load_stats_t stats;
+    double target_rate = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto &board : scenario["boards"])
     {
-        frontend->Spin();
-        if (!(iter++ % 100))
-            frontend->ReportCansUtilization(
-                {0.0300009791f + float(iter), 125001.1f + float(iter)});
+        vector<pair<fields_desc, int>> board_fields;
+        vector<std::chrono::nanoseconds> periods;
+        vector<bool> subscribe;
 
-        for (auto pub : publishers)
+        for (const auto &field : board["fields"])
         {
-            vector<uint8_t> data;
-            // FIXME unbstable as hell
-            for (int i = 0;
-                 i <
-                 pub->GetBoard().descriptor->fieldfunctions[2]->GetFFSize() / 4;
-                 i++)
-            {
-                data.push_back(0);
-                data.push_back(0);
-                data.push_back(i);
-                data.push_back(iter);
-            }
+            uint8_t typecode = ParseType(field["type"].as<string>());
+            int access = ParseAccess(field["access"].as<string>("writeonly"));
+            double rate = field["rate"].as<double>(0);
+
+            if (rate > 0 && access == RUBI_READONLY)
+                throw RubiException("Scenario: readonly field " +
+                                    field["name"].as<string>() +
+                                    " can't be published");
 
-            pub->FFDataInbound(2, data);
-            data.clear();
+            board_fields.push_back(make_pair(
+                fields_desc(field["name"].as<string>(),
+                            ParseSubfields(field["subfields"]), typecode,
+                            any()),
+                access));
+            periods.push_back(std::chrono::nanoseconds(
+                rate > 0 ? (int64_t)(1e9 / rate) : 0));
+            subscribe.push_back(field["subscribe"].as<bool>(subscribe_all));
+        }
+
+        int count = board["count"].as<int>(1);
+        for (int i = 0; i < count; i++)
+        {
+            // instances are told apart by their ids
+            boost::optional<string> id;
+            if (count > 1)
+                id = std::to_string(i);
+
+            auto handler =
+                faker.FakeBoard(board["name"].as<string>(), board_fields, id);
+            auto inst = handler->GetBoard();
 
-            for (int i = 0;
-                 i < pub->GetBoard().descriptor->fieldfunctions[3]->GetFFSize();
-                 i++)
+            for (size_t ffid = 0; ffid < periods.size(); ffid++)
             {
-                data.push_back((iter + i) % 2);
+                if (!periods[ffid].count())
+                    continue;
+
+                const auto &layout = inst.descriptor->layout;
+
+                std::unique_ptr<load_field_t> field(new load_field_t());
+                field->board = handler;
+                field->ffid = ffid;
+                field->typecode = layout.typecodes[ffid];
+                field->size = layout.sizes[ffid];
+                field->period = periods[ffid];
+                field->subscribe = subscribe[ffid];
+                for (auto &sent : field->sent)
+                    sent = 0;
+
+                // spread the fields over their first period
+                field->next = start + std::chrono::nanoseconds(
+                                          rand() % field->period.count());
+
+                if (field->subscribe)
+                    SubscribeProbe(probe_n, inst, field.get(), &stats);
+
+                target_rate += 1e9 / field->period.count();
+                fields.push_back(std::move(field));
             }
-            pub->FFDataInbound(3, data);
         }
     }
+
+    LOG_INFO(log, "Scenario of " + std::to_string(fields.size()) +
+                  " published fields, " + std::to_string((int)target_rate) +
+                  " updates/s");
+
+    probe_spinner.start();
+
+    BoardManager::inst().scheduler.SchedulePeriodic(
+        std::chrono::seconds(1), [&frontend]() {
+            auto cans_count = frontend->GetCansNames().size();
+            frontend->ReportCansUtilization(vector<float>(cans_count, 0.03f),
+                                            vector<float>(cans_count, 0.02f));
+        });
+
+    // open loop: updates are injected when they are scheduled, however long
+    // the frontend takes, and latencies are counted from the schedule
+    auto later = [](load_field_t *a, load_field_t *b) {
+        return a->next > b->next;
+    };
+    std::priority_queue<load_field_t *, vector<load_field_t *>,
+                        decltype(later)>
+        due(later);
+    for (auto &field : fields)
+        due.push(field.get());
+
+    auto last_report = start;
+    auto cpu_start = GetCpuTime(RUSAGE_SELF);
+    auto cpu_thread_start = GetCpuTime(RUSAGE_THREAD);
+    auto cpu_report = cpu_start;
+    uint64_t injected_report = 0, late_report = 0, delivered_report = 0;
+    vector<uint8_t> data;
+
+    while (ros::ok())
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        if (duration.count() && now - start >= duration)
+            break;
+
+        // bounded, so that callbacks are still served when falling behind
+        for (int i = 0; i < 10000 && !due.empty() && due.top()->next <= now;
+             i++)
+        {
+            auto field = due.top();
+            due.pop();
+
+            field->sent[field->seq % load_field_t::sent_n] =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    field->next.time_since_epoch())
+                    .count();
+            FillUpdate(*field, data);
+            field->board->FFDataInbound(field->ffid, data);
+
+            stats.injected += 1;
+            if (now - field->next > field->period)
+                stats.late += 1;
+
+            field->seq += 1;
+            field->next += field->period;
+            due.push(field);
+        }
+
+        frontend->Spin();
+        Logger::Drain();
+        BoardManager::inst().scheduler.Advance(
+            std::chrono::system_clock::now());
+
+        if (now - last_report >= report_period)
+        {
+            double elapsed =
+                std::chrono::duration<double>(now - last_report).count();
+            auto cpu = GetCpuTime(RUSAGE_SELF);
+            uint64_t injected = stats.injected - injected_report;
+            uint64_t delivered = stats.delivered - delivered_report;
+
+            LOG_INFO(log,
+                "injected " + std::to_string((int)(injected / elapsed)) +
+                "/s (" + std::to_string((int)target_rate) + "/s scheduled, " +
+                std::to_string(stats.late - late_report) +
+                " late), delivered " +
+                std::to_string((int)(delivered / elapsed)) +
+                "/s, latency p50 " +
+                std::to_string(stats.latency_window.GetPercentile(50) / 1000) +
+                " us, p99 " +
+                std::to_string(stats.latency_window.GetPercentile(99) / 1000) +
+                " us, cpu " +
+                std::to_string(
+                    injected ? (cpu - cpu_report).count() / 1000.0 / injected
+                             : 0) +
+                " us/update");
+
+            stats.latency_window.Reset();
+            injected_report = stats.injected;
+            late_report = stats.late;
+            delivered_report += delivered;
+            cpu_report = cpu;
+            last_report = now;
+        }
+
+        // sleep until the next update is due or ROS has work for us, in ns
+        // as at thousands of updates/s they are mostly due within a ms
+        std::chrono::nanoseconds timeout = std::chrono::milliseconds(10);
+        if (!due.empty())
+            timeout = std::min(
+                timeout,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    due.top()->next - std::chrono::steady_clock::now()));
+
+        if (timeout.count() > 0)
+        {
+            pollfd fd = {frontend->GetEventFd(), POLLIN, 0};
+            timespec wait = {(time_t)(timeout.count() / 1000000000),
+                             (long)(timeout.count() % 1000000000)};
+            ppoll(&fd, 1, &wait, nullptr);
+        }
+    }
+
+    probe_spinner.stop();
+
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    double cpu = (GetCpuTime(RUSAGE_SELF) - cpu_start).count() / 1000.0;
+    double cpu_thread =
+        (GetCpuTime(RUSAGE_THREAD) - cpu_thread_start).count() / 1000.0;
+
+    YAML::Emitter report;
+    report << YAML::BeginMap;
+    report << YAML::Key << "duration" << YAML::Value << elapsed;
+    report << YAML::Key << "scheduled_rate" << YAML::Value << target_rate;
+    report << YAML::Key << "injected_rate" << YAML::Value
+           << stats.injected / elapsed;
+    report << YAML::Key << "delivered_rate" << YAML::Value
+           << stats.delivered / elapsed;
+    report << YAML::Key << "late" << YAML::Value << stats.late;
+    report << YAML::Key << "latency_us" << YAML::Value << YAML::Flow
+           << YAML::BeginMap;
+    report << YAML::Key << "p50" << YAML::Value
+           << stats.latency.GetPercentile(50) / 1000.0;
+    report << YAML::Key << "p99" << YAML::Value
+           << stats.latency.GetPercentile(99) / 1000.0;
+    report << YAML::Key << "p99.9" << YAML::Value
+           << stats.latency.GetPercentile(99.9) / 1000.0;
+    report << YAML::Key << "max" << YAML::Value
+           << stats.latency.GetMax() / 1000.0;
+    report << YAML::EndMap;
+    // the whole process, and only the thread running the frontend
+    report << YAML::Key << "cpu_us_per_update" << YAML::Value
+           << (stats.injected ? cpu / stats.injected : 0);
+    report << YAML::Key << "frontend_cpu_us_per_update" << YAML::Value
+           << (stats.injected ? cpu_thread / stats.injected : 0);
+    report << YAML::EndMap;
+
+    LOG_INFO(log, string("Summary:\n") + report.c_str());
+    Logger::Drain();
+
+    if (!report_path.empty())
+        std::ofstream(report_path) << report.c_str() << std::endl;
 }
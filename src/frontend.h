@@ -21,11 +21,22 @@ class RubiFrontend
     virtual void Spin() = 0;
     virtual bool Quit() = 0;
 
+    // readable when Spin() has work to do, -1 if it has to be polled
+    virtual int GetEventFd() = 0;
+
     virtual void LogInfo(std::string msg) = 0;
     virtual void LogWarning(std::string msg) = 0;
     virtual void LogError(std::string msg) = 0;
 
-    virtual void ReportCansUtilization(std::vector<float> util) = 0;
+    // fractions of each bus' bitrate, over a sliding window and as an EWMA
+    virtual void ReportCansUtilization(std::vector<float> util,
+                                       std::vector<float> util_ewma) = 0;
+    virtual void ReportFailover(BoardInstance inst, float latency_ms) = 0;
+    virtual void ReportEmergencyStop(std::vector<float> latencies_us) = 0;
+    virtual void ReportGroupCommandStatus(uint32_t request_id,
+                                          uint8_t command_id,
+                                          BoardInstance inst,
+                                          bool success) = 0;
 
     virtual std::shared_ptr<FrontendBoardHandler>
     NewBoard(BoardInstance inst) = 0;
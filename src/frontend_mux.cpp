@@ -0,0 +1,257 @@
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "exceptions.h"
+#include "frontend_mux.h"
+#include "protocol.h"
+
+FrontendQueue::FrontendQueue(size_t max_length) : items(max_length)
+{
+    ASSERT(max_length > 0);
+
+    for (auto &item : items)
+        item.data.reserve(RUBI_MAX_MESSAGE_SIZE);
+
+    worker = std::thread(&FrontendQueue::Worker, this);
+}
+
+FrontendQueue::~FrontendQueue()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+
+    wakeup.notify_one();
+    worker.join();
+}
+
+void FrontendQueue::Push(const sptr<FrontendBoardHandler> &handler, int ffid,
+                         const std::vector<uint8_t> &data)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (length == items.size())
+        {
+            first = (first + 1) % items.size();
+            length -= 1;
+            dropped += 1;
+        }
+
+        auto &item = items[(first + length) % items.size()];
+        item.handler = handler;
+        item.ffid = ffid;
+        item.data.assign(data.begin(), data.end());
+        length += 1;
+    }
+
+    wakeup.notify_one();
+}
+
+uint64_t FrontendQueue::GetDropped()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return dropped;
+}
+
+void FrontendQueue::Worker()
+{
+    // swapped with the slot being handled, so that the slot keeps a buffer
+    // of the same capacity and can be refilled while the frontend runs
+    item_t current;
+    current.data.reserve(RUBI_MAX_MESSAGE_SIZE);
+
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true)
+    {
+        wakeup.wait(guard, [this]() { return quit || length; });
+
+        if (quit)
+            return;
+
+        auto &item = items[first];
+        current.handler = std::move(item.handler);
+        current.ffid = item.ffid;
+        current.data.swap(item.data);
+        first = (first + 1) % items.size();
+        length -= 1;
+
+        guard.unlock();
+        current.handler->FFDataInbound(current.data, current.ffid);
+        current.handler.reset();
+        guard.lock();
+    }
+}
+
+FrontendMux::FrontendMux(std::vector<sptr<RubiFrontend>> frontends,
+                         size_t queue_length)
+    : frontends(frontends)
+{
+    ASSERT(!frontends.empty());
+
+    for (unsigned int i = 0; i < frontends.size(); i++)
+        queues.emplace_back(new FrontendQueue(queue_length));
+    dropped_reported.resize(frontends.size(), 0);
+}
+
+FrontendMux::~FrontendMux()
+{
+    // the workers may still reference the frontends
+    queues.clear();
+
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+}
+
+bool FrontendMux::Init(int argc, char **argv)
+{
+    bool ret = true;
+
+    epoll_fd = epoll_create1(0);
+    ASSERT(epoll_fd >= 0);
+
+    for (const auto &frontend : frontends)
+    {
+        ret = frontend->Init(argc, argv) && ret;
+
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = frontend->GetEventFd();
+
+        if (event.data.fd >= 0)
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event);
+    }
+
+    // the primary frontend has read the configuration by now
+    auto &realtime = BoardManager::inst().realtime;
+    if (realtime.enabled)
+    {
+        for (size_t i = 0; i < queues.size(); i++)
+            realtime.ApplyToThread(queues[i]->GetThread(),
+                                   realtime.frontend_threads,
+                                   "frontend " + std::to_string(i));
+    }
+
+    BoardManager::inst().scheduler.SchedulePeriodic(
+        std::chrono::seconds(1), [this]() { ReportDropped(); });
+
+    return ret;
+}
+
+void FrontendMux::ReportDropped()
+{
+    for (size_t i = 0; i < queues.size(); i++)
+    {
+        uint64_t dropped = queues[i]->GetDropped();
+        if (dropped == dropped_reported[i])
+            continue;
+
+        LOG_WARNING(log, std::to_string(dropped - dropped_reported[i]) +
+                             " field updates dropped by frontend " +
+                             std::to_string(i) + ", it can't keep up!");
+        dropped_reported[i] = dropped;
+    }
+}
+
+std::vector<std::string> FrontendMux::GetCansNames()
+{
+    return frontends[0]->GetCansNames();
+}
+
+void FrontendMux::Spin()
+{
+    for (const auto &frontend : frontends)
+        frontend->Spin();
+}
+
+bool FrontendMux::Quit()
+{
+    for (const auto &frontend : frontends)
+        if (frontend->Quit())
+            return true;
+
+    return false;
+}
+
+int FrontendMux::GetEventFd() { return epoll_fd; }
+
+void FrontendMux::LogInfo(std::string msg) { frontends[0]->LogInfo(msg); }
+
+void FrontendMux::LogWarning(std::string msg)
+{
+    frontends[0]->LogWarning(msg);
+}
+
+void FrontendMux::LogError(std::string msg) { frontends[0]->LogError(msg); }
+
+void FrontendMux::ReportCansUtilization(std::vector<float> util,
+                                        std::vector<float> util_ewma)
+{
+    for (const auto &frontend : frontends)
+        frontend->ReportCansUtilization(util, util_ewma);
+}
+
+void FrontendMux::ReportFailover(BoardInstance inst, float latency_ms)
+{
+    for (const auto &frontend : frontends)
+        frontend->ReportFailover(inst, latency_ms);
+}
+
+void FrontendMux::ReportEmergencyStop(std::vector<float> latencies_us)
+{
+    for (const auto &frontend : frontends)
+        frontend->ReportEmergencyStop(latencies_us);
+}
+
+void FrontendMux::ReportGroupCommandStatus(uint32_t request_id,
+                                           uint8_t command_id,
+                                           BoardInstance inst, bool success)
+{
+    for (const auto &frontend : frontends)
+        frontend->ReportGroupCommandStatus(request_id, command_id, inst,
+                                           success);
+}
+
+std::shared_ptr<FrontendBoardHandler> FrontendMux::NewBoard(BoardInstance inst)
+{
+    auto handler = std::make_shared<MuxBoardHandler>();
+
+    for (unsigned int i = 0; i < frontends.size(); i++)
+        handler->AddHandler(frontends[i]->NewBoard(inst), queues[i].get());
+
+    return handler;
+}
+
+void MuxBoardHandler::AddHandler(sptr<FrontendBoardHandler> handler,
+                                 FrontendQueue *queue)
+{
+    handlers.push_back(std::make_pair(handler, queue));
+}
+
+void MuxBoardHandler::FFDataInbound(std::vector<uint8_t> &data, int ffid)
+{
+    for (const auto &handler : handlers)
+        handler.second->Push(handler.first, ffid, data);
+}
+
+void MuxBoardHandler::ReplaceBackendHandler(
+    sptr<BoardCommunicationHandler> new_handler)
+{
+    for (const auto &handler : handlers)
+        handler.first->ReplaceBackendHandler(new_handler);
+}
+
+void MuxBoardHandler::Shutdown()
+{
+    for (const auto &handler : handlers)
+        handler.first->Shutdown();
+}
+
+void MuxBoardHandler::ConnectionLost()
+{
+    for (const auto &handler : handlers)
+        handler.first->ConnectionLost();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+#include "frontend.h"
+#include "logger.h"
+
+// Runs the field updates of one frontend on its own thread. The queue is a
+// ring of slots taken up front, each with room for the largest message, so
+// pushing an update doesn't allocate. When it's full the oldest update is
+// dropped and counted, so a slow frontend only ever loses its own updates
+// and never stalls the server or the other frontends.
+class FrontendQueue
+{
+    struct item_t
+    {
+        sptr<FrontendBoardHandler> handler;
+        int ffid;
+        std::vector<uint8_t> data;
+    };
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::vector<item_t> items;
+    // oldest item of the ring, and the number of items in it
+    size_t first = 0;
+    size_t length = 0;
+    bool quit = false;
+    uint64_t dropped = 0;
+
+    void Worker();
+
+  public:
+    FrontendQueue(size_t max_length);
+    ~FrontendQueue();
+
+    void Push(const sptr<FrontendBoardHandler> &handler, int ffid,
+              const std::vector<uint8_t> &data);
+    uint64_t GetDropped();
+    pthread_t GetThread() { return worker.native_handle(); }
+};
+
+// Serves the boards to several frontends at once. Field updates are copied
+// into the queue of every frontend, each of which decodes them on its own
+// thread, as the frontends don't share a representation of the values.
+// Commands from all of them reach the boards through their Spin(). The
+// first frontend is the primary one, which provides the configuration and
+// gets the logs.
+class FrontendMux : public RubiFrontend
+{
+    std::vector<sptr<RubiFrontend>> frontends;
+    std::vector<uptr<FrontendQueue>> queues;
+    std::vector<uint64_t> dropped_reported;
+    int epoll_fd = -1;
+
+    Logger log{"FrontendMux"};
+
+    void ReportDropped();
+
+  public:
+    FrontendMux(std::vector<sptr<RubiFrontend>> frontends,
+                size_t queue_length = 1024);
+    ~FrontendMux();
+
+    bool Init(int argc, char **argv) override;
+    std::vector<std::string> GetCansNames() override;
+
+    void Spin() override;
+    bool Quit() override;
+    int GetEventFd() override;
+
+    void LogInfo(std::string msg) override;
+    void LogWarning(std::string msg) override;
+    void LogError(std::string msg) override;
+
+    void ReportCansUtilization(std::vector<float> util,
+                               std::vector<float> util_ewma) override;
+    void ReportFailover(BoardInstance inst, float latency_ms) override;
+    void ReportEmergencyStop(std::vector<float> latencies_us) override;
+    void ReportGroupCommandStatus(uint32_t request_id, uint8_t command_id,
+                                  BoardInstance inst, bool success) override;
+
+    std::shared_ptr<FrontendBoardHandler> NewBoard(BoardInstance inst) override;
+};
+
+class MuxBoardHandler : public FrontendBoardHandler
+{
+    std::vector<std::pair<sptr<FrontendBoardHandler>, FrontendQueue *>>
+        handlers;
+
+  public:
+    void FFDataInbound(std::vector<uint8_t> &data, int ffid) override;
+
+    virtual void
+        ReplaceBackendHandler(sptr<BoardCommunicationHandler>) override;
+    virtual void Shutdown() override;
+    virtual void ConnectionLost() override;
+
+    void AddHandler(sptr<FrontendBoardHandler> handler, FrontendQueue *queue);
+};
@@ -0,0 +1,77 @@
+#include "histogram.h"
+
+#include <algorithm>
+
+static int BucketOf(uint64_t value)
+{
+    int bucket = 0;
+
+    while (value > 1 && bucket < 63)
+    {
+        value >>= 1;
+        bucket += 1;
+    }
+
+    return bucket;
+}
+
+LatencyHistogram::LatencyHistogram() { Reset(); }
+
+void LatencyHistogram::Record(uint64_t value)
+{
+    buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current_max = max.load(std::memory_order_relaxed);
+    while (value > current_max &&
+           !max.compare_exchange_weak(current_max, value,
+                                      std::memory_order_relaxed))
+        ;
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto &bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetCount()
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetMax()
+{
+    return max.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::GetMean()
+{
+    uint64_t samples = GetCount();
+    return samples ? (double)sum.load(std::memory_order_relaxed) / samples
+                   : 0.0;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile)
+{
+    uint64_t samples = GetCount();
+    if (!samples)
+        return 0;
+
+    uint64_t rank = (uint64_t)(samples * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for (int bucket = 0; bucket < buckets_n; bucket++)
+    {
+        seen += buckets[bucket].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return std::min((uint64_t)2 << bucket, GetMax());
+    }
+
+    return GetMax();
+}
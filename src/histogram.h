@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <inttypes.h>
+
+// Lock-free latency histogram with power-of-two buckets. Safe to record
+// into from any thread, percentiles are upper bounds of their bucket.
+class LatencyHistogram
+{
+    static const int buckets_n = 64;
+
+    std::array<std::atomic<uint64_t>, buckets_n> buckets;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+  public:
+    LatencyHistogram();
+
+    void Record(uint64_t value);
+    void Reset();
+
+    uint64_t GetCount();
+    uint64_t GetMax();
+    double GetMean();
+    uint64_t GetPercentile(double percentile);
+};
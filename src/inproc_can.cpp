@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include "inproc_can.h"
+
+class InprocCanBus
+{
+    std::mutex lock;
+    std::vector<InprocCanEndpoint *> endpoints;
+
+    static std::mutex buses_lock;
+    static std::map<std::string, std::weak_ptr<InprocCanBus>> buses;
+
+  public:
+    static std::shared_ptr<InprocCanBus> Get(const std::string &name)
+    {
+        std::lock_guard<std::mutex> guard(buses_lock);
+
+        auto bus = buses[name].lock();
+        if (!bus)
+        {
+            bus = std::make_shared<InprocCanBus>();
+            buses[name] = bus;
+        }
+
+        return bus;
+    }
+
+    void Attach(InprocCanEndpoint *endpoint)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        endpoints.push_back(endpoint);
+    }
+
+    void Detach(InprocCanEndpoint *endpoint)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        endpoints.erase(
+            std::remove(endpoints.begin(), endpoints.end(), endpoint),
+            endpoints.end());
+    }
+
+    // frames are delivered under the bus lock, so every endpoint sees the
+    // frames of the bus in the same order, like on a real bus
+    void Send(InprocCanEndpoint *sender, const can_frame &frame)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (auto endpoint : endpoints)
+        {
+            if (endpoint != sender)
+                endpoint->Deliver(frame);
+        }
+    }
+};
+
+std::mutex InprocCanBus::buses_lock;
+std::map<std::string, std::weak_ptr<InprocCanBus>> InprocCanBus::buses;
+
+InprocCanEndpoint::InprocCanEndpoint(std::string bus_name)
+{
+    event_fd = eventfd(0, EFD_NONBLOCK);
+    bus = InprocCanBus::Get(bus_name);
+    bus->Attach(this);
+}
+
+InprocCanEndpoint::~InprocCanEndpoint()
+{
+    bus->Detach(this);
+    close(event_fd);
+}
+
+void InprocCanEndpoint::Deliver(const can_frame &frame)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (!receive)
+        return;
+
+    if (queue.size() >= max_queued)
+    {
+        dropped += 1;
+        return;
+    }
+
+    queue.push_back(frame);
+
+    if (queue.size() == 1)
+    {
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+    }
+}
+
+void InprocCanEndpoint::Send(const can_frame &frame)
+{
+    bus->Send(this, frame);
+}
+
+bool InprocCanEndpoint::Receive(can_frame &frame)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (queue.empty())
+        return false;
+
+    frame = queue.front();
+    queue.pop_front();
+
+    // the fd stays readable for as long as there is something queued
+    if (queue.empty())
+    {
+        uint64_t count;
+        if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            perror("eventfd read");
+    }
+
+    return true;
+}
+
+void InprocCanEndpoint::DisableReceive()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    receive = false;
+    queue.clear();
+}
+
+int InprocCanEndpoint::GetFd() { return event_fd; }
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <linux/can.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class InprocCanBus;
+
+// Endpoint of a CAN bus within the process, for running the rubi_server
+// against emulated boards without a (v)can interface. Frames sent by an
+// endpoint are delivered to every other endpoint of the same bus. The
+// event fd is readable while frames are queued, so it can be polled like a
+// socket.
+class InprocCanEndpoint
+{
+    friend class InprocCanBus;
+
+    std::shared_ptr<InprocCanBus> bus;
+
+    std::mutex lock;
+    std::deque<can_frame> queue;
+    int event_fd;
+    bool receive = true;
+
+    void Deliver(const can_frame &frame);
+
+  public:
+    // frames which did not fit in the queue
+    std::atomic<uint64_t> dropped{0};
+
+    static const size_t max_queued = 65536;
+
+    InprocCanEndpoint(std::string bus_name);
+    ~InprocCanEndpoint();
+    InprocCanEndpoint(InprocCanEndpoint const &) = delete;
+    void operator=(InprocCanEndpoint const &) = delete;
+
+    void Send(const can_frame &frame);
+    bool Receive(can_frame &frame);
+    void DisableReceive();
+    int GetFd();
+};
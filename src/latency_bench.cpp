@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/make_shared.hpp>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <yaml-cpp/yaml.h>
+
+#include <ros/ros.h>
+
+#include "board_emulator.h"
+#include "rubi_autodefs.h"
+#include "rubi_server/BoardSnapshot.h"
+#include "rubi_server/RubiUnsignedInt.h"
+#include "rubi_server/Stats.h"
+
+using std::string;
+using std::vector;
+
+// End-to-end latencies of a running rubi_server, with a probe board and
+// optional background boards emulated on the same bus. The probe publishes
+// a sequence number in "ping", which is written back to its "echo" field
+// as soon as it reaches ROS:
+//   board -> ROS: ping written to the bus until the subscriber's callback
+//   ROS -> board: echo published until it's read from the bus
+//   round trip:   ping written to the bus until echo is read from it
+// It also reports how long it took until every board completed its
+// handshake, and the memory the server holds for the boards. With
+// _snapshot:=true, pings are taken from the probe's snapshot topic instead,
+// which the server has to publish (_snapshot_batch or _snapshot_period).
+
+static int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// value of a "_name:=value" argument
+static string GetArgument(int argc, char **argv, string name, string fallback)
+{
+    string prefix = "_" + name + ":=";
+
+    for (int i = 1; i < argc; i++)
+        if (string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return string(argv[i]).substr(prefix.size());
+
+    return fallback;
+}
+
+static uint32_t GetSeq(const vector<uint8_t> &data)
+{
+    uint32_t seq;
+    memcpy(&seq, data.data(), sizeof(seq));
+    return seq;
+}
+
+// latencies of one path, appended from one thread and read once it stopped
+struct latencies_t
+{
+    static const int sent_n = 1 << 16;
+
+    std::array<std::atomic<int64_t>, sent_n> sent;
+    vector<int64_t> samples;
+
+    latencies_t()
+    {
+        for (auto &time : sent)
+            time = 0;
+    }
+
+    void Sent(uint32_t seq, int64_t time) { sent[seq % sent_n] = time; }
+
+    void Received(uint32_t seq, int64_t time, bool record)
+    {
+        int64_t sent_time = sent[seq % sent_n];
+        if (record && sent_time)
+            samples.push_back(time - sent_time);
+    }
+
+    double GetPercentile(double percentile)
+    {
+        if (samples.empty())
+            return 0;
+
+        size_t n = std::min(samples.size() - 1,
+                            (size_t)(samples.size() * percentile / 100));
+        std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+        return samples[n] / 1000.0;
+    }
+};
+
+// background boards, like the ones of rubi_board_emulator_node
+static emulated_board_t MakeBackgroundBoard(int id,
+                                            std::chrono::microseconds period)
+{
+    emulated_board_t board;
+    board.name = "emulated";
+    board.id = std::to_string(id);
+    board.driver = "emulated";
+    board.description = "Background load of rubi_latency_bench";
+
+    emulated_field_t field;
+    field.name = "position";
+    field.typecode = _RUBI_TYPECODES_uint16_t;
+    field.access = RUBI_WRITEONLY;
+    field.subfields = {"a", "b", "c"};
+    field.period = period;
+    board.fields.push_back(field);
+
+    return board;
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "rubi_latency_bench");
+    ros::NodeHandle n;
+
+    string port = GetArgument(argc, argv, "port", "vcan0");
+    int boards = std::stoi(GetArgument(argc, argv, "boards", "0"));
+    int threads = std::stoi(GetArgument(argc, argv, "threads", "1"));
+    // updates per second of every background board, and of the probe
+    double rate = std::stod(GetArgument(argc, argv, "rate", "100"));
+    double probe_rate = std::stod(GetArgument(argc, argv, "probe_rate", "100"));
+    double duration = std::stod(GetArgument(argc, argv, "duration", "30"));
+    double warmup = std::stod(GetArgument(argc, argv, "warmup", "2"));
+    double handshake_timeout =
+        std::stod(GetArgument(argc, argv, "handshake_timeout", "60"));
+    string report_path = GetArgument(argc, argv, "report", "");
+    bool snapshot = GetArgument(argc, argv, "snapshot", "false") == "true";
+
+    if (rate <= 0 || probe_rate <= 0)
+    {
+        std::cerr << "Rates have to be positive" << std::endl;
+        return 1;
+    }
+
+    latencies_t board_to_ros, ros_to_board, round_trip;
+    std::atomic<bool> recording{false};
+    uint32_t seq = 0;
+
+    // both of the probe's callbacks run on the emulator's worker
+    emulated_board_t probe;
+    probe.name = "latency_probe";
+    probe.driver = "emulated";
+    probe.description = "Probe of rubi_latency_bench";
+
+    emulated_field_t ping;
+    ping.name = "ping";
+    ping.typecode = _RUBI_TYPECODES_uint32_t;
+    ping.access = RUBI_WRITEONLY;
+    ping.period = std::chrono::microseconds((int64_t)(1e6 / probe_rate));
+    ping.fill = [&](vector<uint8_t> &data) {
+        seq += 1;
+        memcpy(data.data(), &seq, sizeof(seq));
+        int64_t now = Now();
+        board_to_ros.Sent(seq, now);
+        round_trip.Sent(seq, now);
+    };
+    probe.fields.push_back(ping);
+
+    emulated_field_t echo;
+    echo.name = "echo";
+    echo.typecode = _RUBI_TYPECODES_uint32_t;
+    echo.access = RUBI_READONLY;
+    echo.written = [&](const vector<uint8_t> &data) {
+        int64_t now = Now();
+        ros_to_board.Received(GetSeq(data), now, recording);
+        round_trip.Received(GetSeq(data), now, recording);
+    };
+    probe.fields.push_back(echo);
+
+    auto prefix = string("/rubi/boards/") + probe.name + "/";
+    auto echo_publisher = n.advertise<rubi_server::RubiUnsignedInt>(
+        prefix + "fields_to_board/echo", 100);
+    std::atomic<uint64_t> pings{0};
+
+    // the callbacks run on the spinner's thread
+    auto on_ping = [&](uint32_t ping_seq) {
+        board_to_ros.Received(ping_seq, Now(), recording);
+        pings += 1;
+
+        auto reply = boost::make_shared<rubi_server::RubiUnsignedInt>();
+        reply->data = {ping_seq};
+        ros_to_board.Sent(ping_seq, Now());
+        echo_publisher.publish(reply);
+    };
+
+    ros::Subscriber ping_subscriber;
+    if (snapshot)
+    {
+        // a snapshot is published again for other fields' updates, so only
+        // a new ping counts
+        uint32_t last_ping = 0;
+        ping_subscriber = n.subscribe<rubi_server::BoardSnapshot>(
+            prefix + "snapshot", 100,
+            boost::function<void(const rubi_server::BoardSnapshot::ConstPtr &)>(
+                [&, last_ping](
+                    const rubi_server::BoardSnapshot::ConstPtr &msg) mutable {
+                    for (const auto &field : msg->fields)
+                    {
+                        if (field.name != "ping" || field.uints.empty() ||
+                            field.uints[0] == last_ping)
+                            continue;
+
+                        last_ping = field.uints[0];
+                        on_ping(last_ping);
+                    }
+                }));
+    }
+    else
+    {
+        ping_subscriber = n.subscribe<rubi_server::RubiUnsignedInt>(
+            prefix + "fields_from_board/ping", 100,
+            boost::function<void(
+                const rubi_server::RubiUnsignedInt::ConstPtr &)>(
+                [&](const rubi_server::RubiUnsignedInt::ConstPtr &msg) {
+                    on_ping(msg->data[0]);
+                }));
+    }
+
+    // the boards' memory is taken from the last statistics of the server
+    std::mutex stats_mutex;
+    rubi_server::Stats last_stats;
+    auto stats_subscriber = n.subscribe<rubi_server::Stats>(
+        "/rubi/stats", 1,
+        boost::function<void(const rubi_server::Stats::ConstPtr &)>(
+            [&](const rubi_server::Stats::ConstPtr &msg) {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                last_stats = *msg;
+            }));
+
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+
+    BoardEmulator emulator(port, threads);
+    emulator.AddBoard(probe);
+    for (int i = 0; i < boards; i++)
+        emulator.AddBoard(MakeBackgroundBoard(
+            i, std::chrono::microseconds((int64_t)(1e6 / rate))));
+    emulator.Start();
+
+    // from the start of the first lottery window, see lottery_spread
+    auto handshakes_start = std::chrono::steady_clock::now();
+    auto handshakes_deadline =
+        handshakes_start +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(handshake_timeout));
+    while (ros::ok() && emulator.GetOperationalCount() < boards + 1 &&
+           std::chrono::steady_clock::now() < handshakes_deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    double handshakes_s = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() -
+                              handshakes_start)
+                              .count();
+    int handshakes_completed = emulator.GetOperationalCount();
+
+    std::cout << "Waiting for rubi_server to take over the probe..."
+              << std::endl;
+    while (ros::ok() && !pings)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+    recording = true;
+
+    auto end = std::chrono::steady_clock::now() +
+               std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::duration<double>(duration));
+    while (ros::ok() && std::chrono::steady_clock::now() < end)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // nothing records anymore once both threads are stopped
+    recording = false;
+    spinner.stop();
+    emulator.Stop();
+
+    YAML::Emitter report;
+    report << YAML::BeginMap;
+    report << YAML::Key << "boards" << YAML::Value << boards;
+    report << YAML::Key << "rate" << YAML::Value << rate;
+    report << YAML::Key << "probe_rate" << YAML::Value << probe_rate;
+    report << YAML::Key << "snapshot" << YAML::Value << snapshot;
+    report << YAML::Key << "operational" << YAML::Value
+           << emulator.GetOperationalCount();
+    report << YAML::Key << "handshakes_completed" << YAML::Value
+           << handshakes_completed;
+    report << YAML::Key << "handshakes_s" << YAML::Value << handshakes_s;
+    report << YAML::Key << "lottery_spread_s" << YAML::Value
+           << emulator.lottery_spread.count() / 1000.0;
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+
+        uint64_t memory = 0;
+        for (const auto &board : last_stats.boards)
+            memory += board.memory;
+
+        report << YAML::Key << "boards_reported" << YAML::Value
+               << last_stats.boards.size();
+        report << YAML::Key << "boards_memory_bytes" << YAML::Value << memory;
+    }
+
+    std::pair<const char *, latencies_t *> paths[] = {
+        {"board_to_ros_us", &board_to_ros},
+        {"ros_to_board_us", &ros_to_board},
+        {"round_trip_us", &round_trip}};
+
+    for (auto &path : paths)
+    {
+        report << YAML::Key << path.first << YAML::Value << YAML::Flow
+               << YAML::BeginMap;
+        report << YAML::Key << "samples" << YAML::Value
+               << path.second->samples.size();
+        report << YAML::Key << "p50" << YAML::Value
+               << path.second->GetPercentile(50);
+        report << YAML::Key << "p99" << YAML::Value
+               << path.second->GetPercentile(99);
+        report << YAML::Key << "p99.9" << YAML::Value
+               << path.second->GetPercentile(99.9);
+        report << YAML::Key << "max" << YAML::Value
+               << path.second->GetPercentile(100);
+        report << YAML::EndMap;
+    }
+
+    report << YAML::EndMap;
+
+    std::cout << report.c_str() << std::endl;
+    if (!report_path.empty())
+        std::ofstream(report_path) << report.c_str() << std::endl;
+}
@@ -1,34 +1,245 @@
 #include "logger.h"
 #include "board.h"
 
-int Logger::longest_module_name = 0;
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <time.h>
+#include <unordered_map>
 
-Logger::Logger(std::string module_name) : module(module_name)
+#define LOG_RING_SIZE 1024 // power of two
+#define LOG_REPEAT_WINDOW std::chrono::seconds(1)
+
+typedef std::chrono::steady_clock::time_point log_time_t;
+
+struct log_entry_t
+{
+    std::atomic<uint64_t> seq;
+    Logger::level_t level;
+    const std::string *module;
+    std::string msg;
+};
+
+struct log_repeat_t
+{
+    log_time_t window_start;
+    Logger::level_t level;
+    const std::string *module;
+    std::string msg;
+    int repeats;
+};
+
+// bounded MPMC queue after D. Vyukov
+struct log_ring_t
+{
+    log_entry_t entries[LOG_RING_SIZE];
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+
+    log_ring_t()
+    {
+        for (uint64_t i = 0; i < LOG_RING_SIZE; i++)
+            entries[i].seq.store(i, std::memory_order_relaxed);
+    }
+};
+
+static log_ring_t &GetRing()
+{
+    static log_ring_t ring;
+    return ring;
+}
+
+static std::mutex drain_lock;
+static std::unordered_map<std::string, log_repeat_t> repeats;
+
+const uint32_t Logger::site_budget;
+std::atomic<int> Logger::min_level{Logger::level_info};
+std::atomic<int> Logger::longest_module_name{0};
+
+Logger::Logger(std::string module_name)
 {
-    longest_module_name =
-        std::max(longest_module_name, (int)module_name.length());
+    static std::mutex modules_lock;
+    static std::set<std::string> modules;
+
+    std::lock_guard<std::mutex> guard(modules_lock);
+    module = &*modules.insert(module_name).first;
+
+    // only ever grows, and only under the lock
+    if ((int)module_name.length() > longest_module_name.load())
+        longest_module_name = module_name.length();
 }
 
-std::string Logger::GetSpacing()
+std::string Logger::GetSpacing(const std::string &module)
 {
-    return std::string(Logger::longest_module_name - module.length() + 1, ' ');
+    int longest = longest_module_name.load(std::memory_order_relaxed);
+    return std::string(std::max(longest - (int)module.length(), 0) + 1, ' ');
 }
 
-void Logger::Info(std::string msg)
+void Logger::SetLevel(level_t level)
+{
+    min_level = std::min(level, level_error);
+}
+
+bool Logger::Admit(site_t &site, level_t level)
+{
+    // a coarse clock is plenty for whole seconds, and much cheaper
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+    int64_t now = time.tv_sec;
+    int64_t window = site.window.load(std::memory_order_relaxed);
+
+    // only one thread starts the new second
+    if (window != now && site.window.compare_exchange_strong(window, now))
+    {
+        uint32_t count = site.count.exchange(0);
+        if (count > site_budget)
+            Push(level, std::to_string(count - site_budget) +
+                            " more messages of a call site were suppressed.");
+    }
+
+    // no read-modify-write, counts may be a bit off when threads share a
+    // site but suppressing stays cheap
+    uint32_t count = site.count.load(std::memory_order_relaxed);
+    site.count.store(count + 1, std::memory_order_relaxed);
+
+    return count < site_budget;
+}
+
+void Logger::Push(level_t level, std::string &&msg)
 {
+    auto &ring = GetRing();
+    uint64_t pos = ring.head.load(std::memory_order_relaxed);
+    log_entry_t *entry;
 
-    BoardManager::inst().frontend->LogInfo("[" + module + "]" + GetSpacing() +
-                                           msg);
+    for (;;)
+    {
+        entry = &ring.entries[pos % LOG_RING_SIZE];
+        int64_t diff = (int64_t)entry->seq.load(std::memory_order_acquire) -
+                       (int64_t)pos;
+
+        if (diff == 0)
+        {
+            if (ring.head.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = ring.head.load(std::memory_order_relaxed);
+        }
+    }
+
+    entry->level = level;
+    entry->module = module;
+    entry->msg = std::move(msg);
+    entry->seq.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::Info(std::string msg)
+{
+    if (IsEnabled(level_info))
+        Push(level_info, std::move(msg));
 }
 
 void Logger::Warning(std::string msg)
 {
-    BoardManager::inst().frontend->LogWarning("[" + module + "]" +
-                                              GetSpacing() + msg);
+    if (IsEnabled(level_warning))
+        Push(level_warning, std::move(msg));
 }
 
-void Logger::Error(std::string msg)
+void Logger::Error(std::string msg) { Push(level_error, std::move(msg)); }
+
+void Logger::Emit(level_t level, const std::string &module,
+                  const std::string &msg)
 {
-    BoardManager::inst().frontend->LogError("[" + module + "]" + GetSpacing() +
-                                            msg);
-}
\ No newline at end of file
+    auto line = "[" + module + "]" + GetSpacing(module) + msg;
+
+    switch (level)
+    {
+    case level_info:
+        BoardManager::inst().frontend->LogInfo(line);
+        break;
+    case level_warning:
+        BoardManager::inst().frontend->LogWarning(line);
+        break;
+    case level_error:
+        BoardManager::inst().frontend->LogError(line);
+        break;
+    }
+}
+
+void Logger::Drain()
+{
+    if (!BoardManager::inst().frontend)
+        return;
+
+    std::unique_lock<std::mutex> guard(drain_lock, std::try_to_lock);
+    if (!guard)
+        return;
+
+    auto &ring = GetRing();
+    auto now = std::chrono::steady_clock::now();
+
+    for (;;)
+    {
+        uint64_t pos = ring.tail.load(std::memory_order_relaxed);
+        log_entry_t *entry = &ring.entries[pos % LOG_RING_SIZE];
+
+        if (entry->seq.load(std::memory_order_acquire) != pos + 1)
+            break;
+
+        level_t level = entry->level;
+        const std::string *module = entry->module;
+        std::string msg = std::move(entry->msg);
+
+        entry->seq.store(pos + LOG_RING_SIZE, std::memory_order_release);
+        ring.tail.store(pos + 1, std::memory_order_relaxed);
+
+        auto key = *module + '\0' + msg;
+        auto repeat = repeats.find(key);
+
+        if (repeat != repeats.end() &&
+            now - repeat->second.window_start < LOG_REPEAT_WINDOW)
+        {
+            repeat->second.repeats += 1;
+            continue;
+        }
+
+        if (repeat != repeats.end() && repeat->second.repeats)
+            Emit(level, *module,
+                 msg + " (repeated " +
+                     std::to_string(repeat->second.repeats) + " times)");
+        else
+            Emit(level, *module, msg);
+
+        repeats[key] = {now, level, module, msg, 0};
+    }
+
+    for (auto repeat = repeats.begin(); repeat != repeats.end();)
+    {
+        if (now - repeat->second.window_start < LOG_REPEAT_WINDOW)
+        {
+            ++repeat;
+            continue;
+        }
+
+        if (repeat->second.repeats)
+            Emit(repeat->second.level, *repeat->second.module,
+                 repeat->second.msg + " (repeated " +
+                     std::to_string(repeat->second.repeats) + " times)");
+
+        repeat = repeats.erase(repeat);
+    }
+
+    if (auto dropped = ring.dropped.exchange(0))
+        Emit(level_warning, "Logger",
+             std::to_string(dropped) + " log messages dropped!");
+}
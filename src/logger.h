@@ -2,19 +2,82 @@
 #define H_LOGGER
 
 #include "types.h"
+#include <atomic>
 #include <string>
 
+// Messages are queued in a lock-free ring and handed to the frontend by
+// Drain(), which the server loop calls. Repeats of a message within a
+// second are summarized instead of being passed on one by one. Messages
+// below the level set are discarded, the LOG_* macros don't even format
+// them. Neither do they format infos and warnings of a call site which
+// already logged site_budget messages within the second, e.g. one per
+// board during a bus fault, those are only counted.
 class Logger
 {
-  static int longest_module_name;
-  std::string module;
-  std::string GetSpacing();
+public:
+  enum level_t
+  {
+    level_info = 1,
+    level_warning,
+    level_error
+  };
+
+  // state of a LOG_INFO or LOG_WARNING call site, constant initialized
+  struct site_t
+  {
+    std::atomic<int64_t> window{0}; // monotonic clock seconds
+    std::atomic<uint32_t> count{0}; // past site_budget, suppressed
+  };
+  static const uint32_t site_budget = 20;
+
+private:
+  static std::atomic<int> min_level;
+  // read when draining, possibly while another thread creates a logger
+  static std::atomic<int> longest_module_name;
+  const std::string *module; // interned, outlives the logger
+  static std::string GetSpacing(const std::string &module);
+  static void Emit(level_t level, const std::string &module,
+                   const std::string &msg);
+  void Push(level_t level, std::string &&msg);
 
 public:
   Logger(std::string module_name);
   void Info(std::string);
   void Warning(std::string);
   void Error(std::string);
+
+  // errors are never discarded
+  static void SetLevel(level_t level);
+  static bool IsEnabled(level_t level)
+  {
+    return level >= min_level.load(std::memory_order_relaxed);
+  }
+
+  // whether the site is within its budget, a message counting the ones
+  // suppressed is logged once the site's next second starts
+  bool Admit(site_t &site, level_t level);
+
+  // safe to call from any thread, returns at once if already draining
+  static void Drain();
 };
 
-#endif
\ No newline at end of file
+#define LOG_AT_LEVEL_(logger, level, method, msg)                              \
+  do                                                                           \
+  {                                                                            \
+    static Logger::site_t log_site_;                                           \
+    if (Logger::IsEnabled(level) && (logger).Admit(log_site_, level))          \
+      (logger).method(msg);                                                    \
+  } while (0)
+
+#define LOG_INFO(logger, msg)                                                  \
+  LOG_AT_LEVEL_(logger, Logger::level_info, Info, msg)
+#define LOG_WARNING(logger, msg)                                               \
+  LOG_AT_LEVEL_(logger, Logger::level_warning, Warning, msg)
+// errors are neither discarded nor suppressed
+#define LOG_ERROR(logger, msg)                                                 \
+  do                                                                           \
+  {                                                                            \
+    (logger).Error(msg);                                                       \
+  } while (0)
+
+#endif
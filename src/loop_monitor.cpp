@@ -0,0 +1,99 @@
+#include "loop_monitor.h"
+#include "exceptions.h"
+
+LoopMonitor::LoopMonitor()
+{
+    stages[stage_bus].budget = std::chrono::microseconds(2000);
+    stages[stage_keepalive].budget = std::chrono::microseconds(1000);
+    stages[stage_timers].budget = std::chrono::microseconds(5000);
+    stages[stage_frontend].budget = std::chrono::microseconds(5000);
+    stages[stage_wake].budget = std::chrono::microseconds(2000);
+}
+
+std::string LoopMonitor::GetStageName(stage_t stage)
+{
+    switch (stage)
+    {
+    case stage_bus:
+        return "bus";
+    case stage_keepalive:
+        return "keepalive";
+    case stage_timers:
+        return "timers";
+    case stage_frontend:
+        return "frontend";
+    case stage_wake:
+        return "wake";
+    default:
+        ASSERT(0);
+    }
+
+    return "";
+}
+
+LoopMonitor::stage_stats_t &LoopMonitor::GetStage(stage_t stage)
+{
+    ASSERT(stage >= 0 && stage < stages_n);
+    return stages[stage];
+}
+
+void LoopMonitor::Record(stage_t stage, clock::duration duration,
+                         clock::time_point end)
+{
+    auto &stats = stages[stage];
+    auto duration_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+
+    stats.duration.Record(duration_ns.count());
+
+    if (stats.budget.count() && duration_ns > stats.budget)
+    {
+        stats.overrun.Record((duration_ns - stats.budget).count());
+        StatsAdd(stats.overruns);
+        late_until = end;
+    }
+}
+
+void LoopMonitor::BeginPass() { stage_start = clock::now(); }
+
+void LoopMonitor::EndStage(stage_t stage)
+{
+    auto now = clock::now();
+    Record(stage, now - stage_start, now);
+    stage_start = now;
+}
+
+void LoopMonitor::EndWait(clock::duration waited,
+                          std::chrono::milliseconds timeout, bool timed_out)
+{
+    // an event may have been pending for any part of an early wake-up
+    if (!timed_out)
+        return;
+
+    auto late = waited > timeout ? waited - timeout : clock::duration(0);
+    Record(stage_wake, late, clock::now());
+}
+
+bool LoopMonitor::WasLateSince(clock::time_point time)
+{
+    return late_until > time;
+}
+
+void LoopMonitor::ReportOverruns()
+{
+    for (int stage = 0; stage < stages_n; stage++)
+    {
+        auto &stats = stages[stage];
+        uint64_t overruns = stats.overruns;
+
+        if (overruns == stats.overruns_reported)
+            continue;
+
+        LOG_WARNING(log, std::to_string(overruns - stats.overruns_reported) +
+                         " passes of the server loop overran the " +
+                         std::to_string(stats.budget.count()) +
+                         " us budget of the " + GetStageName((stage_t)stage) +
+                         " stage!");
+        stats.overruns_reported = overruns;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <inttypes.h>
+#include <string>
+
+#include "histogram.h"
+#include "logger.h"
+#include "stats.h"
+
+// Deadline monitor of the server loop. Each pass is timed stage by stage and
+// a stage which takes longer than its budget is an overrun. Durations, and
+// by how much the budgets were exceeded, go into histograms which the
+// statistics read and reset, overruns are also logged once a second.
+class LoopMonitor
+{
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    enum stage_t
+    {
+        stage_bus,       // receiving and handling frames
+        stage_keepalive, // per bus timers, keep-alive requests and checks
+        stage_timers,    // periodic work not bound to a bus
+        stage_frontend,  // frontend spin, e.g. ROS callbacks, and the log
+        stage_wake,      // waking up later than the poll timeout asked for
+        stages_n
+    };
+
+    struct stage_stats_t
+    {
+        // 0 disables the budget
+        std::chrono::microseconds budget{0};
+        // both in nanoseconds, the latter past the budget
+        LatencyHistogram duration;
+        LatencyHistogram overrun;
+        std::atomic<uint64_t> overruns{0};
+        uint64_t overruns_reported = 0;
+    };
+
+  private:
+    Logger log{"LoopMonitor"};
+
+    std::array<stage_stats_t, stages_n> stages;
+    clock::time_point stage_start;
+    // end of the latest stage which overran its budget
+    clock::time_point late_until;
+
+    void Record(stage_t stage, clock::duration duration, clock::time_point end);
+
+  public:
+    LoopMonitor();
+
+    static std::string GetStageName(stage_t stage);
+    stage_stats_t &GetStage(stage_t stage);
+
+    void BeginPass();
+    // the stage is timed from the end of the previous one
+    void EndStage(stage_t stage);
+    // poll returned after waiting for waited with the timeout given
+    void EndWait(clock::duration waited, std::chrono::milliseconds timeout,
+                 bool timed_out);
+
+    // whether a stage overran its budget after the time point, i.e. the
+    // server rather than a board may be the one behind schedule
+    bool WasLateSince(clock::time_point time);
+
+    void ReportOverruns();
+};
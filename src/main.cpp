@@ -1,26 +1,57 @@
+#include <boost/algorithm/string.hpp>
 #include <cstring>
 #include <vector>
 
 #include "board.h"
 #include "exceptions.h"
+#include "frontend_mux.h"
 #include "ros_frontend.h"
+#include "shm_frontend.h"
 #include "socketcan.h"
 
 using std::vector;
 using std::string;
 
+// value of a "_name:=value" argument
+static string GetArgument(int argc, char **argv, string name, string fallback)
+{
+    string prefix = "_" + name + ":=";
+
+    for (int i = 1; i < argc; i++)
+        if (boost::starts_with(argv[i], prefix))
+            return string(argv[i]).substr(prefix.size());
+
+    return fallback;
+}
+
 int main(int argc, char **argv)
 {
-    sptr<RosModule> frontend = std::make_shared<RosModule>();
+    // "ros", "shm" or both, e.g. "ros,shm"; the first one is the primary
+    vector<string> frontends_names;
+    boost::split(frontends_names, GetArgument(argc, argv, "frontend", "ros"),
+                 boost::is_any_of(","));
+
+    vector<sptr<RubiFrontend>> frontends;
+    for (const auto &name : frontends_names)
+    {
+        if (name == "ros")
+            frontends.push_back(std::make_shared<RosModule>());
+        else if (name == "shm")
+            frontends.push_back(std::make_shared<ShmFrontend>(
+                frontends_names.size() == 1));
+        else
+            throw RubiException("Unknown frontend " + name);
+    }
+
+    sptr<RubiFrontend> frontend;
+    if (frontends.size() == 1)
+        frontend = frontends[0];
+    else
+        frontend = std::make_shared<FrontendMux>(frontends);
+
     BoardManager::inst().frontend = frontend;
 
     frontend->Init(argc, argv);
     BoardManager::inst().Init(frontend->GetCansNames());
-
-    while (!frontend->Quit())
-    {
-        auto time_now = std::chrono::system_clock::now();
-        BoardManager::inst().Spin(time_now);
-        frontend->Spin();
-    }
+    BoardManager::inst().Run();
 }
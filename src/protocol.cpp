@@ -1,24 +1,58 @@
 #include "protocol.h"
 #include "exceptions.h"
+#include "trace.h"
 
 #include <algorithm>
 
 ProtocolHandler::ProtocolHandler(BoardCommunicationHandler *_board_handler,
-                                 uint8_t _board_nodeid,
+                                 uint16_t _board_nodeid,
                                  CanHandler *_can_handler)
     : can_handler(_can_handler), board_handler(_board_handler),
       board_nodeid(_board_nodeid)
 {
+    board_cob = can_handler->NodeToCob(board_nodeid);
+    buffers = can_handler->buffers;
     rubi_tx_cursor_high = 0;
     rubi_tx_cursor_low = 0;
 }
 
+void ProtocolHandler::SetExpectedMessageSize(size_t size)
+{
+    rx_expected_size = std::min(size, (size_t)RUBI_MAX_MESSAGE_SIZE);
+}
+
+void ProtocolHandler::Preallocate()
+{
+    rx_hold = true;
+    if (rubi_rx_buffer.size < rx_expected_size)
+        rx_grow(rx_expected_size);
+
+    rx_message.reserve(RUBI_MAX_MESSAGE_SIZE);
+
+    // a buffer of the largest class is left in the pool for SendFFData
+    auto tx_buffer = buffers->Acquire(sizeof(rubi_dataheader) +
+                                      RUBI_MAX_MESSAGE_SIZE);
+    buffers->Release(tx_buffer);
+}
+
+size_t ProtocolHandler::GetMemoryUsage()
+{
+    return sizeof(*this) + rubi_tx_buffer.size + rubi_rx_buffer.size +
+           rx_message.capacity();
+}
+
 void ProtocolHandler::rubi_inbound(CanRxMsg rx)
 {
-    if ((rx.StdId >= RUBI_ADDRESS_RANGE1_LOW &&
-         rx.StdId <= RUBI_ADDRESS_RANGE1_HIGH) ||
-        rx.StdId == RUBI_BROADCAST1)
+    uint32_t cob = rx.IDE ? (rx.ExtId | CAN_EFF_FLAG) : rx.StdId;
+
+    if (cob == board_cob || cob == RUBI_BROADCAST1)
     {
+        int bits = can_handler->socketcan->GetLastReceivedBits();
+        board_handler->stats.frames.CountRx(rx.DLC);
+        board_handler->stats.frames.CountRxFrames(1, bits);
+        rx_pending_frames += 1;
+        rx_pending_bits += bits;
+
         uint8_t *potential_data_ptr = &rx.Data[2], data_size;
         ASSERT(rx.DLC >= 1);
 
@@ -30,40 +64,92 @@ void ProtocolHandler::rubi_inbound(CanRxMsg rx)
 
             if (rx.Data[0] & RUBI_FLAG_BLOCK_TRANSFER)
             {
-                if (rx.Data[2] != blocks_received)
+                if (rx.Data[2] != blocks_received || rx_overflow)
                 {
-                    log.Warning("Block transfer has failed.");
+                    LOG_WARNING(log, "Block transfer has failed.");
+                    StatsAdd(board_handler->stats.block_transfer_failures);
                     transfer_failed = true;
                 }
 
-                potential_data_ptr = rubi_rx_buffer;
+                // a transfer without blocks carries no data
+                if (rubi_rx_buffer.data)
+                    potential_data_ptr = rubi_rx_buffer.data;
                 data_size = rubi_rx_cursor;
+                rx_overflow = false;
                 rubi_rx_cursor = 0;
                 blocks_received = 0;
             }
 
+            uint8_t msg_type = rx.Data[0] & RUBI_MSG_MASK;
+            auto &stats = board_handler->stats;
+
+            if ((msg_type == RUBI_MSG_FIELD || msg_type == RUBI_MSG_FUNCTION) &&
+                rx.Data[1] < stats.fields_count)
+                stats.fields[rx.Data[1]].CountRxFrames(rx_pending_frames,
+                                                       rx_pending_bits);
+            rx_pending_frames = 0;
+            rx_pending_bits = 0;
+
             if (!transfer_failed)
-                rubi_data_outwrapper(rx.Data[0] & RUBI_MSG_MASK, rx.Data[1],
-                                     potential_data_ptr, data_size);
+            {
+                TRACE_INSTANT("reassembled", rx.Data[1]);
+                rubi_data_outwrapper(msg_type, rx.Data[1], potential_data_ptr,
+                                     data_size);
+            }
+
+            // the data has been copied out, the buffer is idle until the
+            // next block transfer
+            if (!rx_hold)
+                buffers->Release(rubi_rx_buffer);
         }
         else
         {
             ASSERT(rx.DLC > 1);
             uint32_t data_len = rx.DLC - 1;
 
-            memcpy(&rubi_rx_buffer[rubi_rx_cursor], &rx.Data[1], data_len);
-            rubi_rx_cursor += data_len;
+            if (rubi_rx_cursor + data_len > RUBI_MAX_MESSAGE_SIZE)
+            {
+                // counted, so that the transfer fails when it completes
+                rx_overflow = true;
+            }
+            else
+            {
+                if (rubi_rx_cursor + data_len > rubi_rx_buffer.size)
+                    rx_grow(rubi_rx_cursor + data_len);
+
+                memcpy(&rubi_rx_buffer.data[rubi_rx_cursor], &rx.Data[1],
+                       data_len);
+                rubi_rx_cursor += data_len;
+            }
+
             blocks_received += 1;
         }
     }
 }
 
+// the first block transfer takes a buffer for the expected size, messages
+// longer than expected move to a larger one
+void ProtocolHandler::rx_grow(size_t size)
+{
+    auto buffer =
+        buffers->Acquire(std::max(size, std::min(rx_expected_size,
+                                                  BufferPool::max_size)));
+
+    if (rubi_rx_cursor)
+        memcpy(buffer.data, rubi_rx_buffer.data, rubi_rx_cursor);
+
+    buffers->Release(rubi_rx_buffer);
+    rubi_rx_buffer = buffer;
+}
+
 void ProtocolHandler::InboundWrapper(
-    std::pair<uint16_t, std::vector<uint8_t>> msg)
+    const std::pair<uint32_t, std::vector<uint8_t>> &msg)
 {
     CanRxMsg rx;
     rx.DLC = msg.second.size();
-    rx.StdId = msg.first;
+    rx.IDE = (msg.first & CAN_EFF_FLAG) != 0;
+    rx.StdId = rx.IDE ? 0 : msg.first;
+    rx.ExtId = rx.IDE ? (msg.first & CAN_EFF_MASK) : 0;
     memcpy(rx.Data, msg.second.data(), rx.DLC);
 
     rubi_inbound(rx);
@@ -72,9 +158,8 @@ void ProtocolHandler::InboundWrapper(
 void ProtocolHandler::rubi_data_outwrapper(uint8_t msg_id, uint8_t id,
                                            uint8_t *data, uint8_t datasize)
 {
-    std::vector<uint8_t> vdata;
-    vdata.resize(datasize);
-    memcpy(vdata.data(), data, datasize);
+    auto &vdata = rx_message;
+    vdata.assign(data, data + datasize);
 
     switch (msg_id)
     {
@@ -104,17 +189,18 @@ uint8_t *ProtocolHandler::rubi_get_tx_chunk(uint8_t size)
 {
     static uint8_t buf[8];
 
-    if (rubi_tx_cursor_high + size > RUBI_BUFFER_SIZE)
+    if (rubi_tx_cursor_high + size > rubi_tx_buffer.size)
     {
-        memcpy(buf, &rubi_tx_buffer[rubi_tx_cursor_high],
-               RUBI_BUFFER_SIZE - rubi_tx_cursor_high);
-        memcpy(&buf[RUBI_BUFFER_SIZE - rubi_tx_cursor_high], rubi_tx_buffer,
-               size - (RUBI_BUFFER_SIZE - rubi_tx_cursor_high));
+        memcpy(buf, &rubi_tx_buffer.data[rubi_tx_cursor_high],
+               rubi_tx_buffer.size - rubi_tx_cursor_high);
+        memcpy(&buf[rubi_tx_buffer.size - rubi_tx_cursor_high],
+               rubi_tx_buffer.data,
+               size - (rubi_tx_buffer.size - rubi_tx_cursor_high));
 
         return buf;
     }
 
-    return &rubi_tx_buffer[rubi_tx_cursor_high];
+    return &rubi_tx_buffer.data[rubi_tx_cursor_high];
 }
 
 // NOT counting the header
@@ -128,7 +214,7 @@ int32_t ProtocolHandler::rubi_tx_avaliable_space()
         return rubi_tx_cursor_high - rubi_tx_cursor_low;
     }
 
-    return RUBI_BUFFER_SIZE - rubi_tx_cursor_low + rubi_tx_cursor_high;
+    return rubi_tx_buffer.size - rubi_tx_cursor_low + rubi_tx_cursor_high;
 }
 
 void ProtocolHandler::rubi_tx_checkfull()
@@ -144,19 +230,22 @@ void ProtocolHandler::rubi_tx_enqueue_back(uint8_t *data, int32_t size)
         return;
 
     if (rubi_tx_cursor_high > rubi_tx_cursor_low ||
-        RUBI_BUFFER_SIZE - rubi_tx_cursor_low >= size)
+        rubi_tx_buffer.size - rubi_tx_cursor_low >= size)
     {
-        memcpy(&rubi_tx_buffer[rubi_tx_cursor_low], data, size);
-        rubi_tx_cursor_low = (rubi_tx_cursor_low + size) % RUBI_BUFFER_SIZE;
+        memcpy(&rubi_tx_buffer.data[rubi_tx_cursor_low], data, size);
+        rubi_tx_cursor_low =
+            (rubi_tx_cursor_low + size) % rubi_tx_buffer.size;
     }
     else
     {
-        memcpy(&rubi_tx_buffer[rubi_tx_cursor_low], data,
-               RUBI_BUFFER_SIZE - rubi_tx_cursor_low);
-        memcpy(rubi_tx_buffer, &data[RUBI_BUFFER_SIZE - rubi_tx_cursor_low],
-               size - (RUBI_BUFFER_SIZE - rubi_tx_cursor_low));
-
-        rubi_tx_cursor_low = size - (RUBI_BUFFER_SIZE - rubi_tx_cursor_low);
+        memcpy(&rubi_tx_buffer.data[rubi_tx_cursor_low], data,
+               rubi_tx_buffer.size - rubi_tx_cursor_low);
+        memcpy(rubi_tx_buffer.data,
+               &data[rubi_tx_buffer.size - rubi_tx_cursor_low],
+               size - (rubi_tx_buffer.size - rubi_tx_cursor_low));
+
+        rubi_tx_cursor_low =
+            size - (rubi_tx_buffer.size - rubi_tx_cursor_low);
     }
 
     rubi_tx_checkfull();
@@ -170,17 +259,19 @@ void ProtocolHandler::rubi_tx_enqueue_front(uint8_t *data, int32_t size)
 
     if (rubi_tx_cursor_high > rubi_tx_cursor_low || rubi_tx_cursor_high >= size)
     {
-        memcpy(&rubi_tx_buffer[rubi_tx_cursor_high - size], data, size);
+        memcpy(&rubi_tx_buffer.data[rubi_tx_cursor_high - size], data, size);
         rubi_tx_cursor_high -= size;
     }
     else
     {
-        memcpy(&rubi_tx_buffer[RUBI_BUFFER_SIZE - (size - rubi_tx_cursor_high)],
+        memcpy(&rubi_tx_buffer
+                    .data[rubi_tx_buffer.size - (size - rubi_tx_cursor_high)],
                data, size - rubi_tx_cursor_high);
-        memcpy(rubi_tx_buffer, &data[size - rubi_tx_cursor_high],
+        memcpy(rubi_tx_buffer.data, &data[size - rubi_tx_cursor_high],
                rubi_tx_cursor_high);
 
-        rubi_tx_cursor_high = RUBI_BUFFER_SIZE - (size - rubi_tx_cursor_high);
+        rubi_tx_cursor_high =
+            rubi_tx_buffer.size - (size - rubi_tx_cursor_high);
     }
 
     rubi_tx_checkfull();
@@ -220,7 +311,7 @@ void ProtocolHandler::rubi_continue_tx()
     for (;;)
     { //! can_mailbox_full()
         if (rubi_tx_current_header.msg_type == 0 &&
-            rubi_tx_avaliable_space() == RUBI_BUFFER_SIZE)
+            rubi_tx_avaliable_space() == rubi_tx_buffer.size)
         {
             break;
         }
@@ -242,7 +333,7 @@ void ProtocolHandler::rubi_continue_tx()
 
             rubi_tx_cursor_high =
                 (rubi_tx_cursor_high + sizeof(rubi_dataheader)) %
-                RUBI_BUFFER_SIZE;
+                rubi_tx_buffer.size;
         }
 
         if (block_transfer && rubi_tx_current_header.data_len != 0)
@@ -252,13 +343,14 @@ void ProtocolHandler::rubi_continue_tx()
             data[0] = RUBI_MSG_BLOCK;
             memcpy((void *)&data[1], rubi_get_tx_chunk(data_size), data_size);
 
-            can_send_array(rubi_tx_current_header.cob, data_size + 1, data);
+            can_send_array(rubi_tx_current_header.cob, data_size + 1, data,
+                           tx_current_ffid());
 
             if (rubi_tx_cursor_low == -1)
                 rubi_tx_cursor_low = rubi_tx_cursor_high;
 
             rubi_tx_cursor_high =
-                (rubi_tx_cursor_high + data_size) % RUBI_BUFFER_SIZE;
+                (rubi_tx_cursor_high + data_size) % rubi_tx_buffer.size;
             rubi_tx_current_header.data_len -= data_size;
 
             blocks_sent += 1;
@@ -271,7 +363,8 @@ void ProtocolHandler::rubi_continue_tx()
             if (block_transfer)
             {
                 memcpy(data + 2, &blocks_sent, sizeof(blocks_sent));
-                can_send_array(rubi_tx_current_header.cob, 3, data);
+                can_send_array(rubi_tx_current_header.cob, 3, data,
+                               tx_current_ffid());
                 blocks_sent = 0;
             }
             else
@@ -280,7 +373,8 @@ void ProtocolHandler::rubi_continue_tx()
                        rubi_get_tx_chunk(rubi_tx_current_header.data_len),
                        rubi_tx_current_header.data_len);
                 can_send_array(rubi_tx_current_header.cob,
-                               rubi_tx_current_header.data_len + 2, data);
+                               rubi_tx_current_header.data_len + 2, data,
+                               tx_current_ffid());
             }
 
             if (rubi_tx_cursor_low == -1 && rubi_tx_current_header.data_len > 0)
@@ -290,7 +384,7 @@ void ProtocolHandler::rubi_continue_tx()
 
             rubi_tx_cursor_high =
                 (rubi_tx_cursor_high + rubi_tx_current_header.data_len) %
-                RUBI_BUFFER_SIZE;
+                rubi_tx_buffer.size;
 
             rubi_tx_current_header.msg_type = 0;
         }
@@ -299,35 +393,55 @@ void ProtocolHandler::rubi_continue_tx()
     rubi_funlock();
 }
 
-void ProtocolHandler::can_send_array(uint16_t cob, int32_t size,
-                                     const uint8_t *data)
+int ProtocolHandler::tx_current_ffid()
 {
-    std::vector<uint8_t> vdata;
-    vdata.resize(size);
-    memcpy(vdata.data(), data, size);
-    can_handler->socketcan->Send(
-        std::pair<uint16_t, std::vector<uint8_t>>(cob, vdata));
+    uint8_t msg_type = rubi_tx_current_header.msg_type & RUBI_MSG_MASK;
+
+    if (msg_type == RUBI_MSG_FIELD || msg_type == RUBI_MSG_FUNCTION)
+        return rubi_tx_current_header.submsg_type;
+
+    return -1;
+}
+
+void ProtocolHandler::can_send_array(uint32_t cob, int32_t size,
+                                     const uint8_t *data, int ffid)
+{
+    board_handler->stats.frames.CountTx(size);
+    can_handler->socketcan->Send(cob, data, size);
+
+    int bits = can_handler->socketcan->GetLastTransmittedBits();
+    auto &stats = board_handler->stats;
+
+    stats.frames.CountTxFrames(1, bits);
+    if (ffid >= 0 && ffid < (int)stats.fields_count)
+        stats.fields[ffid].CountTxFrames(1, bits);
 }
 
 void ProtocolHandler::SendFFData(uint8_t ffid, uint8_t fftype,
                                  const std::vector<uint8_t> &data)
 {
     ASSERT(data.size() < 256);
-    uint16_t cob = RUBI_ADDRESS_RANGE1_LOW + board_nodeid;
+    TRACE_INSTANT("enqueue", ffid);
+
+    rubi_dataheader h = {board_cob, fftype, ffid, (uint8_t)data.size()};
 
-    rubi_dataheader h = {cob, fftype, ffid, (uint8_t)data.size()};
+    // everything is sent before returning, so the ring only has to hold
+    // this message, and only for now
+    rubi_tx_buffer = buffers->Acquire(sizeof(h) + data.size());
+    rubi_tx_cursor_high = 0;
+    rubi_tx_cursor_low = 0;
 
     rubi_tx_enqueue_back((uint8_t *)&h, sizeof(h));
     rubi_tx_enqueue_back((uint8_t *)data.data(), data.size());
 
     rubi_continue_tx();
+    buffers->Release(rubi_tx_buffer);
 }
 
 void ProtocolHandler::SendCommand(uint8_t command_id,
                                   const std::vector<uint8_t> &data)
 {
     ASSERT(data.size() < 7);
-    uint16_t cob = RUBI_ADDRESS_RANGE1_LOW + board_nodeid;
 
     auto data_and_header = std::vector<uint8_t>();
     data_and_header.resize(2 + data.size());
@@ -335,6 +449,5 @@ void ProtocolHandler::SendCommand(uint8_t command_id,
     data_and_header[1] = command_id;
     std::copy(data.begin(), data.end(), std::back_inserter(data_and_header));
 
-    can_send_array(RUBI_ADDRESS_RANGE1_LOW + board_nodeid,
-                   data_and_header.size(), data_and_header.data());
+    can_send_array(board_cob, data_and_header.size(), data_and_header.data());
 }
@@ -4,19 +4,21 @@
 #include <memory>
 
 #include "board.h"
+#include "buffer_pool.h"
 #include "communication.h"
 #include "logger.h"
 #include "protocol_defs.h"
 #include "socketcan.h"
 
-#define RUBI_BUFFER_SIZE (0xfff + 8 * sizeof(rubi_dataheader))
+// messages carry their length in a byte
+#define RUBI_MAX_MESSAGE_SIZE 0xff
 
 class BoardCommunicationHandler;
 class CanHandler;
 
 struct rubi_dataheader
 {
-    uint16_t cob;
+    uint32_t cob;
     uint8_t msg_type;
     uint8_t submsg_type;
     uint8_t data_len;
@@ -35,14 +37,31 @@ class ProtocolHandler
         uint8_t FMI;
     } CanRxMsg;
 
+    // drawn from the bus' pool for the time of a send or of a block
+    // transfer, the tx buffer is a ring of rubi_tx_buffer.size bytes
+    std::shared_ptr<BufferPool> buffers;
+    BufferPool::buffer_t rubi_tx_buffer;
+    BufferPool::buffer_t rubi_rx_buffer;
+    // size of the rx buffer a block transfer starts with, it grows if needed
+    size_t rx_expected_size = RUBI_MAX_MESSAGE_SIZE;
+    bool rx_overflow = false;
+    // keep the rx buffer between block transfers, see Preallocate
+    bool rx_hold = false;
+    // received messages are handed over in it, it keeps its capacity
+    std::vector<uint8_t> rx_message;
+
     int32_t rubi_rx_cursor = 0;
-    uint8_t rubi_tx_buffer[RUBI_BUFFER_SIZE];
-    uint8_t rubi_rx_buffer[RUBI_BUFFER_SIZE];
     int32_t rubi_tx_cursor_low;
     int32_t rubi_tx_cursor_high;
     rubi_dataheader rubi_tx_current_header = {0, 0, 0};
     uint16_t board_nodeid;
-    uint32_t block_transfer, blocks_sent, blocks_received;
+    uint32_t board_cob;
+    uint32_t block_transfer, blocks_sent, blocks_received = 0;
+
+    // frames of the message being received, attributed to its ffid once it
+    // is complete
+    uint32_t rx_pending_frames = 0;
+    uint64_t rx_pending_bits = 0;
 
     BoardCommunicationHandler *board_handler;
     CanHandler *can_handler;
@@ -55,11 +74,15 @@ class ProtocolHandler
     void rubi_wait_for_tx_and_flock(int32_t);
     void rubi_tx_enqueue_back(uint8_t *data, int32_t size);
     void rubi_tx_enqueue_front(uint8_t *data, int32_t size);
-    void can_send_array(uint16_t cob, int32_t size, const uint8_t *data);
+    // ffid of the field or function the frame carries, or -1
+    void can_send_array(uint32_t cob, int32_t size, const uint8_t *data,
+                        int ffid = -1);
+    int tx_current_ffid();
     void rubi_funlock(){};
     void rubi_flock(){};
 
     void rubi_inbound(CanRxMsg rx);
+    void rx_grow(size_t size);
     void rubi_data_outwrapper(uint8_t msg_id, uint8_t id, uint8_t *data,
                               uint8_t datasize);
 
@@ -67,9 +90,23 @@ class ProtocolHandler
 
   public:
     ProtocolHandler(BoardCommunicationHandler *_board_handler,
-                    uint8_t _board_nodeid, CanHandler *_can_handler);
+                    uint16_t _board_nodeid, CanHandler *_can_handler);
+    // inline, the fake server destroys handlers without linking protocol.cpp
+    ~ProtocolHandler()
+    {
+        buffers->Release(rubi_tx_buffer);
+        buffers->Release(rubi_rx_buffer);
+    }
+
+    // largest message the board is expected to send, from its descriptor
+    void SetExpectedMessageSize(size_t size);
+    // takes everything receiving and sending the expected messages needs,
+    // and keeps it for the lifetime of the handler
+    void Preallocate();
+    // bytes of the handler and of the buffers it holds at the moment
+    size_t GetMemoryUsage();
 
-    void InboundWrapper(std::pair<uint16_t, std::vector<uint8_t>> msg);
+    void InboundWrapper(const std::pair<uint32_t, std::vector<uint8_t>> &msg);
     void SendFFData(uint8_t ffid, uint8_t fftype,
                     const std::vector<uint8_t> &data);
     void SendCommand(uint8_t command_id, const std::vector<uint8_t> &data);
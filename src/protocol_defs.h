@@ -12,6 +12,10 @@
 #define RUBI_ADDRESS_RANGE2_LOW (0x441) // no interrupt
 #define RUBI_ADDRESS_RANGE2_HIGH (0x4ff)
 
+// 29-bit identifiers, sent with CAN_EFF_FLAG
+#define RUBI_EXTENDED_ADDRESS_LOW (0x10000)
+#define RUBI_EXTENDED_ADDRESS_HIGH (0x1ffff)
+
 #define RUBI_LOTTERY_RANGE_LOW (0x480)
 #define RUBI_LOTTERY_RANGE_HIGH (0x7ff)
 
@@ -0,0 +1,77 @@
+#include "realtime.h"
+
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+#include <inttypes.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+bool RealtimeProfile::ApplyToThread(pthread_t thread, const thread_t &profile,
+                                    const std::string &name)
+{
+    bool ret = true;
+    int error;
+
+    if (profile.priority > 0)
+    {
+        sched_param param;
+        param.sched_priority = profile.priority;
+
+        if ((error = pthread_setschedparam(thread, SCHED_FIFO, &param)))
+        {
+            LOG_WARNING(log, "Can't run the " + name +
+                             " thread with SCHED_FIFO priority " +
+                             std::to_string(profile.priority) + ": " +
+                             strerror(error));
+            ret = false;
+        }
+    }
+
+    if (profile.cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(profile.cpu, &cpus);
+
+        if ((error = pthread_setaffinity_np(thread, sizeof(cpus), &cpus)))
+        {
+            LOG_WARNING(log, "Can't pin the " + name + " thread to CPU " +
+                                 std::to_string(profile.cpu) + ": " +
+                                 strerror(error));
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+// touches the pages of the stack below the caller, so that they are
+// faulted in while it's still cheap
+static void PrefaultStack(size_t size)
+{
+    volatile uint8_t *stack = (volatile uint8_t *)alloca(size);
+
+    for (size_t i = 0; i < size; i += 4096)
+        stack[i] = 0;
+}
+
+bool RealtimeProfile::LockMemory()
+{
+    // freed memory stays in the heap instead of being unmapped and faulted
+    // in again by the next allocation
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+    {
+        LOG_WARNING(log, std::string("Can't lock the memory of the server: ") +
+                         strerror(errno));
+        return false;
+    }
+
+    PrefaultStack(stack_prefault);
+
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string>
+
+#include "logger.h"
+
+// Real-time execution profile, for hosts which also run the motor
+// controllers. The thread running the buses and the frontend threads get a
+// SCHED_FIFO priority and optionally a CPU of their own, and the memory of
+// the process is locked, so that neither other processes nor page faults
+// delay the frame path. Missing privileges are logged, the server then runs
+// as it would without the profile.
+class RealtimeProfile
+{
+    Logger log{"Realtime"};
+
+  public:
+    struct thread_t
+    {
+        // SCHED_FIFO priority, 0 keeps the default policy
+        int priority;
+        // -1 lets the thread run on any CPU
+        int cpu;
+    };
+
+    bool enabled = false;
+
+    // below the emergency stop's thread, which preempts both
+    thread_t bus_thread{80, -1};
+    thread_t frontend_threads{70, -1};
+
+    // of the whole process, never done inside of a nodelet manager
+    bool lock_memory = true;
+    // of the stack of the bus thread, touched once it's locked
+    size_t stack_prefault = 256 * 1024;
+
+    // per board buffers are taken when a board registers and kept
+    bool preallocate = true;
+
+    // false if any part of the profile couldn't be applied
+    bool ApplyToThread(pthread_t thread, const thread_t &profile,
+                       const std::string &name);
+
+    // mlockall, and glibc's malloc is kept from giving memory back
+    bool LockMemory();
+};
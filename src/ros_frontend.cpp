@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast/try_lexical_convert.hpp>
+#include <boost/make_shared.hpp>
 #include <functional>
 #include <thread>
 
@@ -10,32 +13,106 @@
 #include <rubi_server/ShowBoards.h>
 
 #include <rubi_server/BoardOnline.h>
+#include <rubi_server/BoardSnapshot.h>
 #include <rubi_server/BoardWake.h>
+#include <rubi_server/CansLoad.h>
 #include <rubi_server/CansNames.h>
+#include <rubi_server/DumpTrace.h>
+#include <rubi_server/Failover.h>
+#include <rubi_server/GroupCommand.h>
+#include <rubi_server/GroupCommandStatus.h>
 #include <rubi_server/RubiBool.h>
 #include <rubi_server/RubiFloat.h>
 #include <rubi_server/RubiInt.h>
 #include <rubi_server/RubiString.h>
 #include <rubi_server/RubiUnsignedInt.h>
+#include <rubi_server/Stats.h>
+#include <rubi_server/TopTalkers.h>
 
 #include <std_msgs/Empty.h>
 #include <std_msgs/Float32MultiArray.h>
 
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
+#include <sys/eventfd.h>
 
 #include "descriptors.h"
 #include "exceptions.h"
+#include "histogram.h"
+#include "protocol_defs.h"
 #include "ros_frontend.h"
 #include "rubi_autodefs.h"
+#include "trace.h"
 
 using std::string;
 
+// Callback queue which signals an eventfd whenever a callback is queued,
+// so that the main loop can sleep on it together with the CAN sockets.
+class NotifyingCallbackQueue : public ros::CallbackQueue
+{
+    std::mutex queued_lock;
+    std::deque<std::chrono::steady_clock::time_point> queued;
+
+  public:
+    int event_fd;
+
+    // time from a message arriving to its callback having been run
+    LatencyHistogram latency;
+
+    NotifyingCallbackQueue() { event_fd = eventfd(0, EFD_NONBLOCK); }
+
+    void addCallback(const ros::CallbackInterfacePtr &callback,
+                     uint64_t removal_id) override
+    {
+        {
+            std::lock_guard<std::mutex> guard(queued_lock);
+            queued.push_back(std::chrono::steady_clock::now());
+        }
+
+        ros::CallbackQueue::addCallback(callback, removal_id);
+        TRACE_INSTANT("ros_queued", 0);
+
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+    }
+
+    void Dispatch()
+    {
+        uint64_t count;
+        if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            perror("eventfd read");
+
+        std::deque<std::chrono::steady_clock::time_point> dispatched;
+        {
+            std::lock_guard<std::mutex> guard(queued_lock);
+            dispatched.swap(queued);
+        }
+
+        {
+            TRACE_SCOPE("ros_callbacks", dispatched.size());
+            callAvailable(ros::WallDuration(0));
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (const auto &time : dispatched)
+            latency.Record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - time)
+                    .count());
+    }
+};
+
 struct RosModule::ros_stuff_t
 {
     ros::NodeHandle *n;
     ros::Publisher board_announcer;
     ros::ServiceServer can_names_server;
     ros::Publisher can_load_publisher;
+    ros::Publisher can_load_ewma_publisher;
+    ros::Publisher failover_publisher;
+    ros::Publisher emergency_stop_publisher;
+    ros::Publisher group_command_publisher;
+    ros::ServiceServer group_command_server;
     ros::Subscriber panic_subscriber;
 
     ros::ServiceServer field_server;
@@ -44,7 +121,14 @@ struct RosModule::ros_stuff_t
     ros::ServiceServer board_descriptor;
     ros::ServiceServer board_instances;
 
-    ros::Rate *loop_rate;
+    NotifyingCallbackQueue callback_queue;
+    ros::Publisher ros_latency_publisher;
+
+    ros::Publisher stats_publisher;
+    ros::ServiceServer cans_load_server;
+    ros::ServiceServer top_talkers_server;
+    ros::ServiceServer dump_trace_server;
+    rubi_server::Stats stats;
 };
 
 struct RosBoardHandler::roshandler_stuff_t
@@ -57,6 +141,9 @@ struct RosBoardHandler::roshandler_stuff_t
     ros::Subscriber wake_subscriber;
     ros::ServiceServer board_online;
     ros::ServiceServer board_wake;
+
+    ros::Publisher snapshot_publisher;
+    rubi_server::BoardSnapshot snapshot;
 };
 
 RosModule::RosModule() { ros_stuff = new ros_stuff_t; }
@@ -131,7 +218,10 @@ void DeinterpretShortString(uint8_t *target, std::string num, int typecode)
     strcpy((char *)target, num.c_str());
 }
 
-void PanicHandler(const std_msgs::Empty::ConstPtr &data) { ASSERT(0); }
+void PanicHandler(const std_msgs::Empty::ConstPtr &data)
+{
+    BoardManager::inst().Panic();
+}
 
 bool CansNamesHandler(std::vector<string> names,
                       rubi_server::CansNames::Request &req,
@@ -183,14 +273,10 @@ bool BoardDescriptorHandler(rubi_server::BoardDescriptor::Request &req,
     if (board_type == BoardManager::inst().descriptor_map.end())
         return false;
 
-    for (const auto &ff : board_type->second->fieldfunctions)
-    {
-        auto field = std::dynamic_pointer_cast<FieldDescriptor>(ff);
-        if (field)
-        {
-            res.fields.push_back(field->name);
-        }
-    }
+    const auto &layout = board_type->second->layout;
+    for (size_t ffid = 0; ffid < layout.Size(); ffid++)
+        if (layout.IsField(ffid))
+            res.fields.push_back(layout.GetName(ffid));
 
     res.description = board_type->second->description;
     res.driver = board_type->second->driver;
@@ -242,25 +328,18 @@ bool FieldDescriptorHandler(rubi_server::FieldDescriptor::Request &req,
     if (boards.find(req.board_name) == boards.end())
         return false;
 
-    auto &board = boards[req.board_name];
-
-    unsigned int field_id = 0;
-    for (field_id = 0; field_id < board->fieldfunctions.size(); field_id++)
-        if (board->fieldfunctions[field_id]->name == req.field_name)
-            break;
+    const auto &layout = boards[req.board_name]->layout;
 
-    if (field_id == board->fieldfunctions.size())
+    int ffid = layout.Find(req.field_name);
+    if (ffid < 0 || !layout.IsField(ffid))
         return false;
 
-    const auto &field = std::static_pointer_cast<FieldDescriptor>(
-        board->fieldfunctions[field_id]);
-
-    res.subfields = std::vector<std::string>(field->subfields_names);
-    res.typecode = field->typecode;
-    res.input =
-        field->access == RUBI_READONLY || field->access == RUBI_READWRITE;
-    res.output =
-        field->access == RUBI_WRITEONLY || field->access == RUBI_READWRITE;
+    res.subfields = layout.GetSubnames(ffid);
+    res.typecode = layout.typecodes[ffid];
+    res.input = layout.accesses[ffid] == RUBI_READONLY ||
+                layout.accesses[ffid] == RUBI_READWRITE;
+    res.output = layout.accesses[ffid] == RUBI_WRITEONLY ||
+                 layout.accesses[ffid] == RUBI_READWRITE;
 
     return true;
 }
@@ -271,6 +350,69 @@ bool FuncDescriptorHandler(rubi_server::FuncDescriptor::Request &req,
     ASSERT(0);
 }
 
+bool GroupCommandHandler(rubi_server::GroupCommand::Request &req,
+                         rubi_server::GroupCommand::Response &res)
+{
+    uint8_t command_id;
+
+    if (req.command == "wake")
+        command_id = RUBI_COMMAND_WAKE;
+    else if (req.command == "sleep")
+        command_id = RUBI_COMMAND_SOFTSLEEP;
+    else if (req.command == "reboot")
+        command_id = RUBI_COMMAND_REBOOT;
+    else
+        return false;
+
+    if (req.selector != "all" && req.selector != "name" &&
+        req.selector != "tag" && req.selector != "bus")
+        return false;
+
+    std::vector<BoardInstance> targets;
+    res.request_id = BoardManager::inst().GroupCommand(
+        command_id, req.selector, req.value, targets);
+
+    for (const auto &target : targets)
+        res.boards.push_back((string)target);
+
+    return true;
+}
+
+bool TopTalkersHandler(rubi_server::TopTalkers::Request &req,
+                       rubi_server::TopTalkers::Response &res)
+{
+    auto talkers = BoardManager::inst().traffic_analyzer.GetTopTalkers(
+        req.top, req.windows, req.by_field);
+
+    for (const auto &talker : talkers)
+    {
+        rubi_server::Talker msg;
+        msg.bus = talker.bus;
+        msg.can_id = talker.can_id;
+        msg.board = talker.board;
+        msg.id = talker.id;
+        msg.field = talker.field;
+        msg.frame_rate = talker.frame_rate;
+        msg.bit_rate = talker.bit_rate;
+        msg.load = talker.load;
+        msg.rate_changed = talker.rate_changed;
+
+        res.talkers.push_back(msg);
+    }
+
+    return true;
+}
+
+bool DumpTraceHandler(rubi_server::DumpTrace::Request &req,
+                      rubi_server::DumpTrace::Response &res)
+{
+    res.events = Trace::Dump(req.path.empty() ? "/tmp/rubi_server_trace.json"
+                                              : req.path);
+    res.success = res.events >= 0;
+
+    return true;
+}
+
 void InboundFieldCallbackInt(std::shared_ptr<RosBoardHandler> handler,
                              int field_id,
                              const rubi_server::RubiInt::ConstPtr &data)
@@ -282,20 +424,16 @@ void InboundFieldCallbackInt(std::shared_ptr<RosBoardHandler> handler,
     std::vector<uint8_t> ffdata;
 
     unsigned int ffid = handler->GetFieldFfid(field_id);
-    unsigned int element_size = rubi_type_size(
-        handler->board.descriptor->fieldfunctions[ffid]->typecode);
-    unsigned int datasize =
-        handler->board.descriptor->fieldfunctions[ffid]->GetFFSize();
-    ffdata.resize(datasize);
-    ASSERT(datasize / element_size == data->data.size());
+    const auto &layout = handler->board.descriptor->layout;
+    unsigned int element_size = layout.element_sizes[ffid];
+    ffdata.resize(layout.sizes[ffid]);
+    ASSERT(layout.counts[ffid] == data->data.size());
 
     for (unsigned int i = 0; i < data->data.size(); i++)
-        DeinterpretInt(
-            &ffdata.data()[i * element_size], data->data[i],
-            handler->board.descriptor->fieldfunctions[ffid]->typecode);
+        DeinterpretInt(&ffdata.data()[i * element_size], data->data[i],
+                        layout.typecodes[ffid]);
 
-    backend_handler->FFDataOutbound(
-        handler->board.descriptor->fieldfunctions[ffid], ffdata);
+    backend_handler->FFDataOutbound(ffid, ffdata);
 }
 
 void InboundFieldCallbackUnsignedInt(
@@ -309,20 +447,16 @@ void InboundFieldCallbackUnsignedInt(
     std::vector<uint8_t> ffdata;
 
     unsigned int ffid = handler->GetFieldFfid(field_id);
-    unsigned int element_size = rubi_type_size(
-        handler->board.descriptor->fieldfunctions[ffid]->typecode);
-    unsigned int datasize =
-        handler->board.descriptor->fieldfunctions[ffid]->GetFFSize();
-    ffdata.resize(datasize);
-    ASSERT(datasize / element_size == data->data.size());
+    const auto &layout = handler->board.descriptor->layout;
+    unsigned int element_size = layout.element_sizes[ffid];
+    ffdata.resize(layout.sizes[ffid]);
+    ASSERT(layout.counts[ffid] == data->data.size());
 
     for (unsigned int i = 0; i < data->data.size(); i++)
-        DeinterpretInt(
-            &ffdata.data()[i * element_size], data->data[i],
-            handler->board.descriptor->fieldfunctions[ffid]->typecode);
+        DeinterpretInt(&ffdata.data()[i * element_size], data->data[i],
+                        layout.typecodes[ffid]);
 
-    backend_handler->FFDataOutbound(
-        handler->board.descriptor->fieldfunctions[ffid], ffdata);
+    backend_handler->FFDataOutbound(ffid, ffdata);
 }
 
 void InboundFieldCallbackBool(std::shared_ptr<RosBoardHandler> handler,
@@ -337,15 +471,13 @@ void InboundFieldCallbackBool(std::shared_ptr<RosBoardHandler> handler,
 
     unsigned int ffid = handler->GetFieldFfid(field_id);
     ffdata.resize(data->data.size());
-    ASSERT(backend_handler->GetBoard()
-               .descriptor->fieldfunctions[ffid]
-               ->GetFFSize() == data->data.size());
+    ASSERT(handler->board.descriptor->layout.sizes[ffid] ==
+           data->data.size());
 
     for (unsigned int i = 0; i < data->data.size(); i++)
         ffdata[i] = data->data[i];
 
-    backend_handler->FFDataOutbound(
-        handler->board.descriptor->fieldfunctions[ffid], ffdata);
+    backend_handler->FFDataOutbound(ffid, ffdata);
 }
 
 void InboundFieldCallbackFloat(std::shared_ptr<RosBoardHandler> handler,
@@ -359,20 +491,16 @@ void InboundFieldCallbackFloat(std::shared_ptr<RosBoardHandler> handler,
     std::vector<uint8_t> ffdata;
 
     unsigned int ffid = handler->GetFieldFfid(field_id);
-    unsigned int element_size = rubi_type_size(
-        handler->board.descriptor->fieldfunctions[ffid]->typecode);
-    unsigned int datasize =
-        handler->board.descriptor->fieldfunctions[ffid]->GetFFSize();
-    ffdata.resize(datasize);
-    ASSERT(datasize / element_size == data->data.size());
+    const auto &layout = handler->board.descriptor->layout;
+    unsigned int element_size = layout.element_sizes[ffid];
+    ffdata.resize(layout.sizes[ffid]);
+    ASSERT(layout.counts[ffid] == data->data.size());
 
     for (unsigned int i = 0; i < data->data.size(); i++)
-        DeinterpretFloat(
-            &ffdata.data()[i * element_size], data->data[i],
-            handler->board.descriptor->fieldfunctions[ffid]->typecode);
+        DeinterpretFloat(&ffdata.data()[i * element_size], data->data[i],
+                          layout.typecodes[ffid]);
 
-    backend_handler->FFDataOutbound(
-        handler->board.descriptor->fieldfunctions[ffid], ffdata);
+    backend_handler->FFDataOutbound(ffid, ffdata);
 }
 
 void InboundFieldCallbackString(std::shared_ptr<RosBoardHandler> handler,
@@ -386,20 +514,16 @@ void InboundFieldCallbackString(std::shared_ptr<RosBoardHandler> handler,
     std::vector<uint8_t> ffdata;
 
     unsigned int ffid = handler->GetFieldFfid(field_id);
-    unsigned int element_size = rubi_type_size(
-        handler->board.descriptor->fieldfunctions[ffid]->typecode);
-    unsigned int datasize =
-        handler->board.descriptor->fieldfunctions[ffid]->GetFFSize();
-    ffdata.resize(datasize);
-    ASSERT(datasize / element_size == data->data.size());
+    const auto &layout = handler->board.descriptor->layout;
+    unsigned int element_size = layout.element_sizes[ffid];
+    ffdata.resize(layout.sizes[ffid]);
+    ASSERT(layout.counts[ffid] == data->data.size());
 
     for (unsigned int i = 0; i < data->data.size(); i++)
-        DeinterpretShortString(
-            &ffdata.data()[i * element_size], data->data[i],
-            handler->board.descriptor->fieldfunctions[ffid]->typecode);
+        DeinterpretShortString(&ffdata.data()[i * element_size], data->data[i],
+                                layout.typecodes[ffid]);
 
-    backend_handler->FFDataOutbound(
-        handler->board.descriptor->fieldfunctions[ffid], ffdata);
+    backend_handler->FFDataOutbound(ffid, ffdata);
 }
 
 void BoardWakeCallback(std::shared_ptr<RosBoardHandler> handler,
@@ -432,23 +556,256 @@ void BoardSleepCallback(std::shared_ptr<RosBoardHandler> handler,
     backend_handler->CommandSleep();
 }
 
-bool RosModule::Init(int argc, char **argv)
+// the publishers belong to the handler, so their status callbacks only
+// hold weak references to it
+void FieldConnectCallback(std::weak_ptr<RosBoardHandler> weak_handler,
+                          int field_id,
+                          const ros::SingleSubscriberPublisher &pub)
 {
-    string cans_names_raw;
+    auto handler = weak_handler.lock();
+    if (!handler)
+        return;
+
+    std::vector<uint8_t> data;
+
+    {
+        std::lock_guard<std::mutex> guard(handler->lock);
+        handler->subscribers_count[field_id] += 1;
+
+        // a dead board's last value is no news to the newcomer
+        auto backend_handler = handler->board.backend_handler.lock();
+        if (!backend_handler || backend_handler->IsDead())
+            handler->last_value_stale[field_id] = false;
+        else if (handler->last_value_stale[field_id])
+            data = handler->last_values[field_id];
+    }
+
+    // the latched message is outdated, bring the newcomer up to date
+    if (data.size())
+        handler->FFDataInbound(data, handler->GetFieldFfid(field_id));
+}
+
+void FieldDisconnectCallback(std::weak_ptr<RosBoardHandler> weak_handler,
+                             int field_id,
+                             const ros::SingleSubscriberPublisher &pub)
+{
+    auto handler = weak_handler.lock();
+    if (!handler)
+        return;
+
+    std::lock_guard<std::mutex> guard(handler->lock);
+    handler->subscribers_count[field_id] -= 1;
+}
 
+bool RosModule::Init(int argc, char **argv)
+{
     ros::init(argc, argv, "rubi_server");
     ros_stuff->n = new ros::NodeHandle("~");
 
+    return Setup();
+}
+
+bool RosModule::Init(ros::NodeHandle &private_nh)
+{
+    standalone = false;
+    ros_stuff->n = new ros::NodeHandle(private_nh);
+
+    return Setup();
+}
+
+bool RosModule::Setup()
+{
+    string cans_names_raw;
+
+    // all of our callbacks are run from the server loop, never by the spinners
+    ros_stuff->n->setCallbackQueue(&ros_stuff->callback_queue);
+
     if (ros_stuff->n->getParam("cans", cans_names_raw))
     {
         boost::split(cans_names, cans_names_raw, boost::is_any_of(","));
     }
     else
     {
-        log.Warning("No can interfaces given! Assuming its can0.");
+        LOG_WARNING(log, "No can interfaces given! Assuming its can0.");
         cans_names = {"can0"};
     }
 
+    int keepalive_interval_ms;
+    if (ros_stuff->n->getParam("keepalive_interval", keepalive_interval_ms))
+    {
+        auto &interval = BoardManager::inst().keepalive_interval;
+
+        // a negative interval would wrap around in the timer wheel
+        if (keepalive_interval_ms > 0)
+            interval = std::chrono::milliseconds(keepalive_interval_ms);
+        else
+            LOG_WARNING(log, "Keep-alive interval has to be positive, using " +
+                                 std::to_string(interval.count()) + " ms!");
+    }
+
+    ros_stuff->n->getParam("broadcast_keepalive",
+                           BoardManager::inst().broadcast_keepalive);
+
+    string addressing;
+    if (ros_stuff->n->getParam("addressing", addressing))
+    {
+        if (addressing == "legacy")
+            BoardManager::inst().addressing = BoardManager::addressing_legacy;
+        else if (addressing == "standard")
+            BoardManager::inst().addressing = BoardManager::addressing_standard;
+        else if (addressing == "extended")
+            BoardManager::inst().addressing = BoardManager::addressing_extended;
+        else
+            LOG_WARNING(log, "Unknown addressing mode " + addressing + "!");
+    }
+
+    ros_stuff->n->getParam("extended_boards_count",
+                           BoardManager::inst().extended_boards_count);
+
+    ros_stuff->n->getParam("redundancy", BoardManager::inst().redundancy);
+
+    ros_stuff->n->getParam("cans_load_window",
+                           BoardManager::inst().cans_load_collection_time);
+    ros_stuff->n->getParam("cans_load_warning",
+                           BoardManager::inst().cans_load_warning);
+    ros_stuff->n->getParam("exact_bit_stuffing",
+                           BoardManager::inst().exact_bit_stuffing);
+
+    int traffic_window_ms;
+    if (ros_stuff->n->getParam("traffic_window", traffic_window_ms))
+        BoardManager::inst().traffic_window =
+            std::chrono::milliseconds(traffic_window_ms);
+    ros_stuff->n->getParam("traffic_windows",
+                           BoardManager::inst().traffic_windows);
+    ros_stuff->n->getParam("traffic_change_ratio",
+                           BoardManager::inst().traffic_change_ratio);
+
+    int default_bitrate;
+    if (ros_stuff->n->getParam("default_bitrate", default_bitrate))
+        BoardManager::inst().default_bitrate = default_bitrate;
+
+    int snapshot_period_ms;
+    if (ros_stuff->n->getParam("snapshot_period", snapshot_period_ms))
+        snapshot_period = std::chrono::milliseconds(snapshot_period_ms);
+    ros_stuff->n->getParam("snapshot_batch", snapshot_batch);
+
+    int stats_period_ms;
+    if (ros_stuff->n->getParam("stats_period", stats_period_ms))
+        stats_period = std::chrono::milliseconds(stats_period_ms);
+
+    ros_stuff->n->getParam("emergency_stop",
+                           BoardManager::inst().emergency_stop_enabled);
+    // one socket per node, so that two servers on a host don't take over
+    // each other's trigger
+    if (!ros_stuff->n->getParam("emergency_stop_socket",
+                                BoardManager::inst().emergency_stop_socket))
+    {
+        string node_name = ros_stuff->n->getNamespace();
+        std::replace(node_name.begin(), node_name.end(), '/', '_');
+        BoardManager::inst().emergency_stop_socket =
+            "/tmp/rubi_estop" + node_name;
+    }
+    ros_stuff->n->getParam("emergency_stop_priority",
+                           BoardManager::inst().emergency_stop_priority);
+
+    auto &realtime = BoardManager::inst().realtime;
+    ros_stuff->n->getParam("realtime", realtime.enabled);
+    ros_stuff->n->getParam("realtime_priority", realtime.bus_thread.priority);
+    ros_stuff->n->getParam("realtime_cpu", realtime.bus_thread.cpu);
+    ros_stuff->n->getParam("realtime_frontend_priority",
+                           realtime.frontend_threads.priority);
+    ros_stuff->n->getParam("realtime_frontend_cpu",
+                           realtime.frontend_threads.cpu);
+    ros_stuff->n->getParam("realtime_lock_memory", realtime.lock_memory);
+    ros_stuff->n->getParam("realtime_preallocate", realtime.preallocate);
+
+    auto &loop_monitor = BoardManager::inst().loop_monitor;
+    for (int stage = 0; stage < LoopMonitor::stages_n; stage++)
+    {
+        int budget_us;
+        if (ros_stuff->n->getParam(
+                "loop_budget_" +
+                    LoopMonitor::GetStageName((LoopMonitor::stage_t)stage),
+                budget_us))
+        {
+            loop_monitor.GetStage((LoopMonitor::stage_t)stage).budget =
+                std::chrono::microseconds(budget_us);
+        }
+    }
+    ros_stuff->n->getParam("keepalive_compensation",
+                           BoardManager::inst().keepalive_compensation);
+
+    int failover_deadline_ms;
+    if (ros_stuff->n->getParam("failover_deadline", failover_deadline_ms))
+    {
+        BoardManager::inst().failover_deadline =
+            std::chrono::milliseconds(failover_deadline_ms);
+    }
+
+    // "board_name:tag,board_name:other_tag,other_board:tag"
+    string tags_raw;
+    if (ros_stuff->n->getParam("tags", tags_raw))
+    {
+        std::vector<string> entries;
+        boost::split(entries, tags_raw, boost::is_any_of(","));
+
+        for (const auto &entry : entries)
+        {
+            std::vector<string> board_and_tag;
+            boost::split(board_and_tag, entry, boost::is_any_of(":"));
+
+            if (board_and_tag.size() != 2)
+            {
+                LOG_WARNING(log, "Malformed tag entry: " + entry);
+                continue;
+            }
+
+            BoardManager::inst().board_tags.insert(
+                std::make_pair(board_and_tag[0], board_and_tag[1]));
+        }
+    }
+
+    // "board_name:interval_ms,other_board:interval_ms"
+    string keepalive_intervals_raw;
+    if (ros_stuff->n->getParam("keepalive_intervals", keepalive_intervals_raw))
+    {
+        std::vector<string> entries;
+        boost::split(entries, keepalive_intervals_raw, boost::is_any_of(","));
+
+        for (const auto &entry : entries)
+        {
+            std::vector<string> board_and_interval;
+            boost::split(board_and_interval, entry, boost::is_any_of(":"));
+
+            int interval_ms = 0;
+            if (board_and_interval.size() != 2 ||
+                !boost::conversion::try_lexical_convert(board_and_interval[1],
+                                                        interval_ms) ||
+                interval_ms <= 0)
+            {
+                LOG_ERROR(log, "Malformed keep-alive interval entry \"" +
+                                   entry + "\", ignoring it!");
+                continue;
+            }
+
+            BoardManager::inst().keepalive_intervals[board_and_interval[0]] =
+                std::chrono::milliseconds(interval_ms);
+        }
+    }
+
+    string log_level;
+    if (ros_stuff->n->getParam("log_level", log_level))
+    {
+        if (log_level == "info")
+            Logger::SetLevel(Logger::level_info);
+        else if (log_level == "warning")
+            Logger::SetLevel(Logger::level_warning);
+        else if (log_level == "error")
+            Logger::SetLevel(Logger::level_error);
+        else
+            LOG_ERROR(log, "Unknown log level " + log_level + "!");
+    }
+
     if (ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME,
                                        ros::console::levels::Info))
     {
@@ -473,6 +830,22 @@ bool RosModule::Init(int argc, char **argv)
     ros_stuff->can_load_publisher =
         ros_stuff->n->advertise<std_msgs::Float32MultiArray>("/rubi/cans_load",
                                                              1);
+    ros_stuff->can_load_ewma_publisher =
+        ros_stuff->n->advertise<std_msgs::Float32MultiArray>(
+            "/rubi/cans_load_ewma", 1);
+
+    ros_stuff->failover_publisher =
+        ros_stuff->n->advertise<rubi_server::Failover>("/rubi/failover", 10);
+
+    ros_stuff->emergency_stop_publisher =
+        ros_stuff->n->advertise<std_msgs::Float32MultiArray>(
+            "/rubi/emergency_stop_latency", 1);
+
+    ros_stuff->group_command_server = ros_stuff->n->advertiseService(
+        "/rubi/group_command", GroupCommandHandler);
+    ros_stuff->group_command_publisher =
+        ros_stuff->n->advertise<rubi_server::GroupCommandStatus>(
+            "/rubi/group_command_status", 100);
 
     ros_stuff->panic_subscriber = ros_stuff->n->subscribe<std_msgs::Empty>(
         "/rubi/panic", 1, PanicHandler);
@@ -486,19 +859,118 @@ bool RosModule::Init(int argc, char **argv)
     ros_stuff->can_names_server = ros_stuff->n->advertiseService(
         "/rubi/get_cans_names", cans_names_callback);
 
-    ros_stuff->loop_rate = new ros::Rate(30);
+    ros_stuff->ros_latency_publisher =
+        ros_stuff->n->advertise<std_msgs::Float32MultiArray>(
+            "/rubi/ros_latency", 1);
+
+    BoardManager::inst().scheduler.SchedulePeriodic(
+        std::chrono::milliseconds(
+            (int)(BoardManager::inst().cans_load_collection_time * 1000)),
+        [this]() { ReportRosLatency(); });
+
+    ros_stuff->stats_publisher =
+        ros_stuff->n->advertise<rubi_server::Stats>("/rubi/stats", 1);
+
+    // std::func inference seems broken
+    boost::function<bool(rubi_server::CansLoad::Request &,
+                         rubi_server::CansLoad::Response &)>
+        cans_load_callback = [this](rubi_server::CansLoad::Request &req,
+                                    rubi_server::CansLoad::Response &res) {
+            // without the periodic collection there is nothing cached
+            if (!stats_period.count())
+                CollectStats();
+
+            res.stats = ros_stuff->stats;
+
+            if (req.top && req.top < res.stats.boards.size())
+            {
+                auto &boards = res.stats.boards;
+                std::partial_sort(boards.begin(), boards.begin() + req.top,
+                                  boards.end(),
+                                  [](const rubi_server::BoardStats &a,
+                                     const rubi_server::BoardStats &b) {
+                                      return a.rx_byte_rate > b.rx_byte_rate;
+                                  });
+                boards.resize(req.top);
+            }
+
+            return true;
+        };
+    ros_stuff->cans_load_server = ros_stuff->n->advertiseService(
+        "/rubi/get_cans_load", cans_load_callback);
+
+    ros_stuff->top_talkers_server =
+        ros_stuff->n->advertiseService("/rubi/top_talkers", TopTalkersHandler);
+
+    ros_stuff->dump_trace_server =
+        ros_stuff->n->advertiseService("/rubi/dump_trace", DumpTraceHandler);
+
+    stats_collected = std::chrono::steady_clock::now();
+    if (stats_period.count())
+        BoardManager::inst().scheduler.SchedulePeriodic(stats_period, [this]() {
+            CollectStats();
+            ros_stuff->stats_publisher.publish(ros_stuff->stats);
+        });
 
     return true;
 }
 
-void RosModule::ReportCansUtilization(std::vector<float> util)
+void RosModule::ReportCansUtilization(std::vector<float> util,
+                                      std::vector<float> util_ewma)
 {
     ASSERT(util.size() == cans_names.size());
+    ASSERT(util_ewma.size() == cans_names.size());
 
     std_msgs::Float32MultiArray msg;
     msg.data = util;
-
     ros_stuff->can_load_publisher.publish(msg);
+
+    msg.data = util_ewma;
+    ros_stuff->can_load_ewma_publisher.publish(msg);
+}
+
+void RosModule::ReportFailover(BoardInstance inst, float latency_ms)
+{
+    rubi_server::Failover msg;
+    msg.name = inst.descriptor->board_name;
+    msg.id = inst.id.is_initialized() ? inst.id.get() : "";
+    msg.latency = latency_ms;
+
+    ros_stuff->failover_publisher.publish(msg);
+}
+
+void RosModule::ReportEmergencyStop(std::vector<float> latencies_us)
+{
+    std_msgs::Float32MultiArray msg;
+    msg.data = latencies_us;
+
+    ros_stuff->emergency_stop_publisher.publish(msg);
+}
+
+void RosModule::ReportGroupCommandStatus(uint32_t request_id,
+                                         uint8_t command_id,
+                                         BoardInstance inst, bool success)
+{
+    rubi_server::GroupCommandStatus msg;
+    msg.request_id = request_id;
+    msg.board = inst.descriptor->board_name;
+    msg.id = inst.id.is_initialized() ? inst.id.get() : "";
+    msg.success = success;
+
+    switch (command_id)
+    {
+    case RUBI_COMMAND_WAKE:
+        msg.command = "wake";
+        break;
+    case RUBI_COMMAND_SOFTSLEEP:
+        msg.command = "sleep";
+        break;
+    case RUBI_COMMAND_REBOOT:
+        msg.command = "reboot";
+        break;
+    }
+
+    ros_stuff->group_command_publisher.publish(msg);
 }
 
 void RosModule::LogInfo(string msg) { ROS_INFO("%s", msg.c_str()); }
@@ -521,22 +993,18 @@ std::shared_ptr<FrontendBoardHandler> RosModule::NewBoard(BoardInstance inst)
     msg.version = inst.descriptor->version;
     msg.id = inst.id.is_initialized() ? inst.id.get() : "";
 
-    for (auto ff : inst.descriptor->fieldfunctions)
+    const auto &layout = inst.descriptor->layout;
+    for (size_t ffid = 0; ffid < layout.Size(); ffid++)
     {
-        auto field = std::dynamic_pointer_cast<FieldDescriptor>(ff);
-        auto function = std::dynamic_pointer_cast<FieldDescriptor>(ff);
-
-        if (field)
-            msg.fields.push_back(field->name);
-        else if (function)
-            msg.functions.push_back(function->name);
+        if (layout.IsField(ffid))
+            msg.fields.push_back(layout.GetName(ffid));
         else
-            ASSERT(false);
+            msg.functions.push_back(layout.GetName(ffid));
     }
 
     ros_stuff->board_announcer.publish(msg);
-    log.Info("Frontend registered new board type: " +
-             inst.descriptor->board_name);
+    LOG_INFO(log, "Frontend registered new board type: " +
+                  inst.descriptor->board_name);
 
     return std::shared_ptr<FrontendBoardHandler>(ret);
 }
@@ -554,7 +1022,8 @@ void RosBoardHandler::Init()
     auto &n = *(ros_module->ros_stuff->n);
 
     int fc = 0, tc = 0;
-    fftable.resize(board.descriptor->fieldfunctions.size());
+    const auto &layout = board.descriptor->layout;
+    fftable.resize(layout.Size());
     auto id = board.id;
 
     auto wake_callback =
@@ -588,41 +1057,55 @@ void RosBoardHandler::Init()
     ros_stuff->board_wake = n.advertiseService(
         board.descriptor->GetBoardPrefix(id) + "is_wake", wake_handler);
 
-    for (const auto &ff : board.descriptor->fieldfunctions)
+    for (size_t ffid = 0; ffid < layout.Size(); ffid++)
     {
-        auto field = std::dynamic_pointer_cast<FieldDescriptor>(ff);
         tc += 1;
 
-        if (!field)
+        if (!layout.IsField(ffid))
             continue;
 
+        string name = layout.GetName(ffid);
+        int access = layout.accesses[ffid];
+
         fc += 1;
         fftable[tc - 1] =
             std::pair<fftype_t, int>(fftype_t::fftype_field, fc - 1);
         fieldtable.push_back(tc - 1);
-
-        switch (field->typecode)
+        subscribers_count.push_back(0);
+        last_values.emplace_back();
+        last_values.back().reserve(layout.sizes[ffid]);
+        last_value_stale.push_back(false);
+
+        std::weak_ptr<RosBoardHandler> weak_handler = shared_from_this();
+        ros::SubscriberStatusCallback connect_callback = std::bind(
+            FieldConnectCallback, weak_handler, fc - 1, std::placeholders::_1);
+        ros::SubscriberStatusCallback disconnect_callback =
+            std::bind(FieldDisconnectCallback, weak_handler, fc - 1,
+                      std::placeholders::_1);
+
+        switch (layout.typecodes[ffid])
         {
 
         case _RUBI_TYPECODES_int32_t:
         case _RUBI_TYPECODES_int16_t:
         case _RUBI_TYPECODES_int8_t:
-            if (field->access == RUBI_WRITEONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_WRITEONLY ||
+                access == RUBI_READWRITE)
             {
                 ros_stuff->field_publishers.push_back(
                     n.advertise<rubi_server::RubiInt>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_from_board/" + field->name,
-                        10, true));
+                            "fields_from_board/" + name,
+                        10, connect_callback, disconnect_callback,
+                        ros::VoidConstPtr(), true));
             }
             else
             {
                 ros_stuff->field_publishers.push_back(boost::none);
             }
 
-            if (field->access == RUBI_READONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_READONLY ||
+                access == RUBI_READWRITE)
             {
                 auto callback =
                     std::bind(InboundFieldCallbackInt, shared_from_this(),
@@ -631,7 +1114,7 @@ void RosBoardHandler::Init()
                 ros_stuff->field_subscribers.push_back(
                     n.subscribe<rubi_server::RubiInt>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_to_board/" + field->name,
+                            "fields_to_board/" + name,
                         1, callback));
             }
             break;
@@ -639,22 +1122,23 @@ void RosBoardHandler::Init()
         case _RUBI_TYPECODES_uint32_t:
         case _RUBI_TYPECODES_uint16_t:
         case _RUBI_TYPECODES_uint8_t:
-            if (field->access == RUBI_WRITEONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_WRITEONLY ||
+                access == RUBI_READWRITE)
             {
                 ros_stuff->field_publishers.push_back(
                     n.advertise<rubi_server::RubiUnsignedInt>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_from_board/" + field->name,
-                        10, true));
+                            "fields_from_board/" + name,
+                        10, connect_callback, disconnect_callback,
+                        ros::VoidConstPtr(), true));
             }
             else
             {
                 ros_stuff->field_publishers.push_back(boost::none);
             }
 
-            if (field->access == RUBI_READONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_READONLY ||
+                access == RUBI_READWRITE)
             {
                 auto callback = std::bind(InboundFieldCallbackUnsignedInt,
                                           shared_from_this(), fc - 1,
@@ -663,28 +1147,29 @@ void RosBoardHandler::Init()
                 ros_stuff->field_subscribers.push_back(
                     n.subscribe<rubi_server::RubiUnsignedInt>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_to_board/" + field->name,
+                            "fields_to_board/" + name,
                         1, callback));
             }
             break;
 
         case _RUBI_TYPECODES_bool:
-            if (field->access == RUBI_WRITEONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_WRITEONLY ||
+                access == RUBI_READWRITE)
             {
                 ros_stuff->field_publishers.push_back(
                     n.advertise<rubi_server::RubiBool>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_from_board/" + field->name,
-                        10, true));
+                            "fields_from_board/" + name,
+                        10, connect_callback, disconnect_callback,
+                        ros::VoidConstPtr(), true));
             }
             else
             {
                 ros_stuff->field_publishers.push_back(boost::none);
             }
 
-            if (field->access == RUBI_READONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_READONLY ||
+                access == RUBI_READWRITE)
             {
                 auto callback =
                     std::bind(InboundFieldCallbackBool, shared_from_this(),
@@ -693,28 +1178,29 @@ void RosBoardHandler::Init()
                 ros_stuff->field_subscribers.push_back(
                     n.subscribe<rubi_server::RubiBool>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_to_board/" + field->name,
+                            "fields_to_board/" + name,
                         1, callback));
             }
             break;
 
         case _RUBI_TYPECODES_float:
-            if (field->access == RUBI_WRITEONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_WRITEONLY ||
+                access == RUBI_READWRITE)
             {
                 ros_stuff->field_publishers.push_back(
                     n.advertise<rubi_server::RubiFloat>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_from_board/" + field->name,
-                        10, true));
+                            "fields_from_board/" + name,
+                        10, connect_callback, disconnect_callback,
+                        ros::VoidConstPtr(), true));
             }
             else
             {
                 ros_stuff->field_publishers.push_back(boost::none);
             }
 
-            if (field->access == RUBI_READONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_READONLY ||
+                access == RUBI_READWRITE)
             {
                 auto callback =
                     std::bind(InboundFieldCallbackFloat, shared_from_this(),
@@ -723,29 +1209,30 @@ void RosBoardHandler::Init()
                 ros_stuff->field_subscribers.push_back(
                     n.subscribe<rubi_server::RubiFloat>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_to_board/" + field->name,
+                            "fields_to_board/" + name,
                         1, callback));
             }
             break;
 
         case _RUBI_TYPECODES_shortstring:
         case _RUBI_TYPECODES_longstring:
-            if (field->access == RUBI_WRITEONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_WRITEONLY ||
+                access == RUBI_READWRITE)
             {
                 ros_stuff->field_publishers.push_back(
                     n.advertise<rubi_server::RubiString>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_from_board/" + field->name,
-                        10, true));
+                            "fields_from_board/" + name,
+                        10, connect_callback, disconnect_callback,
+                        ros::VoidConstPtr(), true));
             }
             else
             {
                 ros_stuff->field_publishers.push_back(boost::none);
             }
 
-            if (field->access == RUBI_READONLY ||
-                field->access == RUBI_READWRITE)
+            if (access == RUBI_READONLY ||
+                access == RUBI_READWRITE)
             {
                 auto callback =
                     std::bind(InboundFieldCallbackString, shared_from_this(),
@@ -754,7 +1241,7 @@ void RosBoardHandler::Init()
                 ros_stuff->field_subscribers.push_back(
                     n.subscribe<rubi_server::RubiString>(
                         board.descriptor->GetBoardPrefix(id) +
-                            "fields_to_board/" + field->name,
+                            "fields_to_board/" + name,
                         1, callback));
             }
             break;
@@ -763,117 +1250,389 @@ void RosBoardHandler::Init()
             throw new RubiException("RosModule::NewBoard switch default");
         }
     }
+
+    decode_time.reset(new LatencyHistogram[fieldtable.size()]);
+
+    if (ros_module->snapshot_period.count() || ros_module->snapshot_batch)
+        InitSnapshot();
+}
+
+void RosBoardHandler::InitSnapshot()
+{
+    auto &n = *(ros_module->ros_stuff->n);
+
+    ros_stuff->snapshot.name = board.descriptor->board_name;
+    ros_stuff->snapshot.id = board.id.is_initialized() ? board.id.get() : "";
+
+    // one entry for every field the board publishes, in descriptor order
+    for (unsigned int field_id = 0; field_id < fieldtable.size(); field_id++)
+    {
+        if (!ros_stuff->field_publishers[field_id])
+        {
+            snapshot_index.push_back(-1);
+            continue;
+        }
+
+        rubi_server::FieldValue value;
+        value.name = board.descriptor->layout.GetName(fieldtable[field_id]);
+
+        snapshot_index.push_back(ros_stuff->snapshot.fields.size());
+        ros_stuff->snapshot.fields.push_back(value);
+    }
+
+    ros_stuff->snapshot_publisher = n.advertise<rubi_server::BoardSnapshot>(
+        board.descriptor->GetBoardPrefix(board.id) + "snapshot", 10, true);
+
+    if (!ros_module->snapshot_period.count())
+        return;
+
+    std::weak_ptr<RosBoardHandler> weak_handler = shared_from_this();
+    snapshot_timer = BoardManager::inst().scheduler.SchedulePeriodic(
+        ros_module->snapshot_period, [weak_handler]() {
+            auto handler = weak_handler.lock();
+            if (!handler)
+                return;
+
+            std::lock_guard<std::mutex> guard(handler->lock);
+            if (handler->snapshot_changes)
+                handler->PublishSnapshot();
+        });
+}
+
+void RosBoardHandler::PublishSnapshot()
+{
+    ros_stuff->snapshot.stamp = ros::Time::now();
+    snapshot_changes = 0;
+
+    // published by pointer, so hand out a copy which is never modified again
+    ros_stuff->snapshot_publisher.publish(
+        boost::make_shared<rubi_server::BoardSnapshot>(ros_stuff->snapshot));
 }
 
 void RosBoardHandler::FFDataInbound(std::vector<uint8_t> &data, int ffid)
 {
-    // Yuck!
-    rubi_server::RubiInt i32;
-    rubi_server::RubiUnsignedInt u32;
-    rubi_server::RubiFloat f32;
-    rubi_server::RubiString str;
-    rubi_server::RubiBool bools;
-    std_msgs::Empty emp;
+    // messages are published by pointer, so that subscribers in the same
+    // process (nodelets) get them without serialization
+    boost::shared_ptr<rubi_server::RubiInt> i32;
+    boost::shared_ptr<rubi_server::RubiUnsignedInt> u32;
+    boost::shared_ptr<rubi_server::RubiFloat> f32;
+    boost::shared_ptr<rubi_server::RubiString> str;
+    boost::shared_ptr<rubi_server::RubiBool> bools;
 
     boost::optional<ros::Publisher> publisher;
 
-    ASSERT(board.descriptor->fieldfunctions[ffid]->GetFFSize() ==
-           (int)data.size());
+    // everything decoding needs, in the arrays of the shared layout
+    const auto &layout = board.descriptor->layout;
+    uint8_t typecode = layout.typecodes[ffid];
+    unsigned int element_size = layout.element_sizes[ffid];
+
+    ASSERT(layout.sizes[ffid] == data.size());
+
+    ASSERT(fftable[ffid].first == fftype_t::fftype_field);
+    int field_id = fftable[ffid].second;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    rubi_server::FieldValue *snapshot_value = nullptr;
+    if (snapshot_index.size() && snapshot_index[field_id] >= 0)
+        snapshot_value = &ros_stuff->snapshot.fields[snapshot_index[field_id]];
+
+    last_values[field_id] = data;
+
+    // nobody listens, only remember the raw value for later subscribers
+    if (!subscribers_count[field_id] && !snapshot_value)
+    {
+        last_value_stale[field_id] = true;
+        StatsAdd(updates_skipped);
+        return;
+    }
+
+    last_value_stale[field_id] = false;
+    StatsAdd(updates_decoded);
+    TRACE_SCOPE("decode", ffid);
+
+    auto decode_start = std::chrono::steady_clock::now();
 
-    switch (board.descriptor->fieldfunctions[ffid]->typecode)
+    switch (typecode)
     {
     case _RUBI_TYPECODES_int32_t:
     case _RUBI_TYPECODES_int16_t:
     case _RUBI_TYPECODES_int8_t:
-        for (unsigned int i = 0; i < data.size();
-             i +=
-             rubi_type_size(board.descriptor->fieldfunctions[ffid]->typecode))
+        i32 = boost::make_shared<rubi_server::RubiInt>();
+        i32->data.reserve(layout.counts[ffid]);
+        for (unsigned int i = 0; i < data.size(); i += element_size)
         {
-            i32.data.push_back((int32_t)InterpretInt(
-                data, board.descriptor->fieldfunctions[ffid]->typecode, i));
+            i32->data.push_back((int32_t)InterpretInt(data, typecode, i));
         }
 
-        ASSERT(fftable[ffid].first == fftype_t::fftype_field);
-        publisher = ros_stuff->field_publishers[fftable[ffid].second];
+        publisher = ros_stuff->field_publishers[field_id];
         ASSERT(publisher);
+        TRACE_INSTANT("publish", ffid);
         publisher.get().publish(i32);
 
+        if (snapshot_value)
+            snapshot_value->ints = i32->data;
+
         break;
 
     case _RUBI_TYPECODES_uint32_t:
     case _RUBI_TYPECODES_uint16_t:
     case _RUBI_TYPECODES_uint8_t:
-        for (unsigned int i = 0; i < data.size();
-             i +=
-             rubi_type_size(board.descriptor->fieldfunctions[ffid]->typecode))
+        u32 = boost::make_shared<rubi_server::RubiUnsignedInt>();
+        u32->data.reserve(layout.counts[ffid]);
+        for (unsigned int i = 0; i < data.size(); i += element_size)
         {
-            u32.data.push_back((uint32_t)InterpretInt( // FIXME
-                data, board.descriptor->fieldfunctions[ffid]->typecode, i));
+            u32->data.push_back(
+                (uint32_t)InterpretInt(data, typecode, i)); // FIXME
         }
 
-        ASSERT(fftable[ffid].first == fftype_t::fftype_field);
-        publisher = ros_stuff->field_publishers[fftable[ffid].second];
+        publisher = ros_stuff->field_publishers[field_id];
         ASSERT(publisher);
+        TRACE_INSTANT("publish", ffid);
         publisher.get().publish(u32);
 
+        if (snapshot_value)
+            snapshot_value->uints = u32->data;
+
         break;
 
     case _RUBI_TYPECODES_bool:
+        bools = boost::make_shared<rubi_server::RubiBool>();
         for (unsigned int i = 0; i < data.size(); i += 1)
         {
-            bools.data.push_back(data[i]);
+            bools->data.push_back(data[i]);
         }
 
-        ASSERT(fftable[ffid].first == fftype_t::fftype_field);
-        publisher = ros_stuff->field_publishers[fftable[ffid].second];
+        publisher = ros_stuff->field_publishers[field_id];
         ASSERT(publisher);
+        TRACE_INSTANT("publish", ffid);
         publisher.get().publish(bools);
 
+        if (snapshot_value)
+            snapshot_value->bools = bools->data;
+
         break;
     case _RUBI_TYPECODES_float:
-        for (unsigned int i = 0; i < data.size();
-             i +=
-             rubi_type_size(board.descriptor->fieldfunctions[ffid]->typecode))
+        f32 = boost::make_shared<rubi_server::RubiFloat>();
+        f32->data.reserve(layout.counts[ffid]);
+        for (unsigned int i = 0; i < data.size(); i += element_size)
         {
-            f32.data.push_back(InterpretFloat( // FIXME
-                data, board.descriptor->fieldfunctions[ffid]->typecode, i));
+            f32->data.push_back(InterpretFloat(data, typecode, i)); // FIXME
         }
 
-        ASSERT(fftable[ffid].first == fftype_t::fftype_field);
-        publisher = ros_stuff->field_publishers[fftable[ffid].second];
+        publisher = ros_stuff->field_publishers[field_id];
         ASSERT(publisher);
+        TRACE_INSTANT("publish", ffid);
         publisher.get().publish(f32);
 
+        if (snapshot_value)
+            snapshot_value->floats = f32->data;
+
         break;
 
     case _RUBI_TYPECODES_shortstring:
     case _RUBI_TYPECODES_longstring:
-        for (unsigned int i = 0; i < data.size();
-             i +=
-             rubi_type_size(board.descriptor->fieldfunctions[ffid]->typecode))
+        str = boost::make_shared<rubi_server::RubiString>();
+        str->data.reserve(layout.counts[ffid]);
+        for (unsigned int i = 0; i < data.size(); i += element_size)
         {
-            str.data.push_back(InterpretString( // FIXME
-                data, board.descriptor->fieldfunctions[ffid]->typecode, i));
+            str->data.push_back(InterpretString(data, typecode, i)); // FIXME
         }
 
-        ASSERT(fftable[ffid].first == fftype_t::fftype_field);
-        publisher = ros_stuff->field_publishers[fftable[ffid].second];
+        publisher = ros_stuff->field_publishers[field_id];
         ASSERT(publisher);
+        TRACE_INSTANT("publish", ffid);
         publisher.get().publish(str);
 
+        if (snapshot_value)
+            snapshot_value->strings = str->data;
+
         break;
     default:
         ASSERT(false);
     }
+
+    decode_time[field_id].Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - decode_start)
+            .count());
+
+    if (snapshot_value)
+    {
+        snapshot_changes += 1;
+
+        if (ros_module->snapshot_batch &&
+            snapshot_changes >= ros_module->snapshot_batch)
+            PublishSnapshot();
+    }
 }
 
 void RosModule::Spin()
 {
-    ros::spinOnce();
-    ros_stuff->loop_rate->sleep();
+    ros_stuff->callback_queue.Dispatch();
+
+    // roscpp's own services live on the global queue, which the nodelet
+    // manager spins by itself
+    if (standalone)
+        ros::spinOnce();
+}
+
+int RosModule::GetEventFd() { return ros_stuff->callback_queue.event_fd; }
+
+void RosModule::ReportRosLatency()
+{
+    auto &latency = ros_stuff->callback_queue.latency;
+
+    // [p50, p99, p99.9, max] in us
+    std_msgs::Float32MultiArray msg;
+    msg.data = {latency.GetPercentile(50) / 1000.0f,
+                latency.GetPercentile(99) / 1000.0f,
+                latency.GetPercentile(99.9) / 1000.0f,
+                latency.GetMax() / 1000.0f};
+    latency.Reset();
+
+    ros_stuff->ros_latency_publisher.publish(msg);
+}
+
+void RosModule::CollectStats()
+{
+    auto now = std::chrono::steady_clock::now();
+    float period_s =
+        std::chrono::duration<float>(now - stats_collected).count();
+    stats_collected = now;
+
+    if (period_s <= 0)
+        return;
+
+    // counters are keyed by their owner, only the ones seen now are kept
+    // so that vanished boards drop out
+    std::map<std::pair<const void *, int>, uint64_t> seen;
+    auto raw_rate = [&](const void *owner, int index, uint64_t value) {
+        auto key = std::make_pair(owner, index);
+        auto it = stats_previous.find(key);
+        uint64_t previous = it != stats_previous.end() ? it->second : 0;
+
+        // a counter which went back is a new one at a recycled address
+        if (previous > value)
+            previous = 0;
+
+        seen[key] = value;
+        return (value - previous) / period_s;
+    };
+    auto rate = [&](const std::atomic<uint64_t> &counter) {
+        return raw_rate(&counter, 0, counter);
+    };
+
+    rubi_server::Stats stats;
+    stats.stamp = ros::Time::now();
+
+    for (auto &can : BoardManager::inst().cans)
+    {
+        auto &socket = can.second->GetSocket();
+
+        rubi_server::BusStats bus;
+        bus.name = can.first;
+        bus.rx_rate = raw_rate(&socket, 0, socket.GetTotalReceivedFramesCount());
+        bus.rx_byte_rate =
+            raw_rate(&socket, 1, socket.GetTotalReceivedDataSize());
+        bus.tx_rate =
+            raw_rate(&socket, 2, socket.GetTotalTransmittedFramesCount());
+        bus.tx_byte_rate =
+            raw_rate(&socket, 3, socket.GetTotalTransmittedDataSize());
+        bus.tx_queue_depth = socket.GetTxQueueDepth();
+        bus.unknown_frames = can.second->GetUnknownFramesCount();
+        bus.buffers_allocated = can.second->GetBufferPool().GetAllocatedBytes();
+        bus.buffers_in_use = can.second->GetBufferPool().GetInUseBytes();
+
+        stats.buses.push_back(bus);
+    }
+
+    for (auto &handler : boards)
+    {
+        auto backend = handler->board.backend_handler.lock();
+        if (!backend)
+            continue;
+
+        auto &board_stats = backend->stats;
+
+        rubi_server::BoardStats board;
+        board.name = handler->board.descriptor->board_name;
+        board.id = handler->board.id.is_initialized() ? handler->board.id.get()
+                                                      : "";
+        if (backend->GetCanHandler())
+            board.bus = backend->GetCanHandler()->GetName();
+        board.rx_rate = rate(board_stats.frames.rx_messages);
+        board.rx_byte_rate = rate(board_stats.frames.rx_bytes);
+        board.tx_rate = rate(board_stats.frames.tx_messages);
+        board.tx_byte_rate = rate(board_stats.frames.tx_bytes);
+        board.block_transfer_failures = board_stats.block_transfer_failures;
+        board.keepalives_missed = board_stats.keepalives_missed;
+        board.keepalives_compensated = board_stats.keepalives_compensated;
+        board.updates_skipped = handler->updates_skipped;
+        board.keepalive_rtt = backend->GetKeepAliveRtt().count() / 1000.0f;
+        board.memory = backend->GetMemoryUsage();
+
+        for (size_t ffid = 0; ffid < board_stats.fields_count; ffid++)
+        {
+            auto &field_stats = board_stats.fields[ffid];
+
+            rubi_server::FieldStats field;
+            field.name = handler->board.descriptor->layout.GetName(ffid);
+            field.rx_rate = rate(field_stats.rx_messages);
+            field.rx_byte_rate = rate(field_stats.rx_bytes);
+            field.tx_rate = rate(field_stats.tx_messages);
+            field.tx_byte_rate = rate(field_stats.tx_bytes);
+
+            // functions are not decoded here
+            if (handler->fftable[ffid].first ==
+                RosBoardHandler::fftype_t::fftype_field)
+            {
+                auto &decode_time =
+                    handler->decode_time[handler->fftable[ffid].second];
+                field.decode_time_p50 = decode_time.GetPercentile(50) / 1000.0f;
+                field.decode_time_max = decode_time.GetMax() / 1000.0f;
+                decode_time.Reset();
+            }
+
+            board.fields.push_back(field);
+        }
+
+        stats.boards.push_back(board);
+    }
+
+    auto &loop_monitor = BoardManager::inst().loop_monitor;
+    for (int i = 0; i < LoopMonitor::stages_n; i++)
+    {
+        auto &stage = loop_monitor.GetStage((LoopMonitor::stage_t)i);
+
+        rubi_server::LoopStageStats loop;
+        loop.name = LoopMonitor::GetStageName((LoopMonitor::stage_t)i);
+        loop.budget = stage.budget.count();
+        loop.passes = stage.duration.GetCount();
+        loop.overruns = stage.overruns;
+        loop.duration_p50 = stage.duration.GetPercentile(50) / 1000.0f;
+        loop.duration_p99 = stage.duration.GetPercentile(99) / 1000.0f;
+        loop.duration_max = stage.duration.GetMax() / 1000.0f;
+        loop.overrun_max = stage.overrun.GetMax() / 1000.0f;
+        stage.duration.Reset();
+        stage.overrun.Reset();
+
+        stats.loop.push_back(loop);
+    }
+
+    stats_previous = std::move(seen);
+    ros_stuff->stats = stats;
 }
 
-bool RosModule::Quit() { return !ros::ok(); }
+bool RosModule::Quit() { return quit_requested || !ros::ok(); }
+
+void RosModule::RequestQuit() { quit_requested = true; }
+
+void RosModule::ShutdownBoards()
+{
+    for (const auto &board : boards)
+        board->Shutdown();
+}
 
 int RosBoardHandler::GetFieldFfid(int field_id) { return fieldtable[field_id]; }
 
@@ -890,9 +1649,21 @@ void RosBoardHandler::ReplaceBackendHandler(
     board.backend_handler = new_handler;
 }
 
-void RosBoardHandler::Shutdown() {}
+void RosBoardHandler::Shutdown()
+{
+    if (!snapshot_timer)
+        return;
+
+    BoardManager::inst().scheduler.Cancel(snapshot_timer);
+    snapshot_timer = 0;
+}
 
-void RosBoardHandler::ConnectionLost() {}
+void RosBoardHandler::ConnectionLost()
+{
+    // cached values of the lost board are not republished to newcomers
+    std::lock_guard<std::mutex> guard(lock);
+    std::fill(last_value_stale.begin(), last_value_stale.end(), false);
+}
 
 sptr<BoardCommunicationHandler> RosBoardHandler::BackendReady()
 {
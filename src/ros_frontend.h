@@ -1,17 +1,26 @@
 #pragma once
 
+#include <atomic>
 #include <boost/optional.hpp>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "board.h"
 #include "communication.h"
 #include "descriptors.h"
 #include "frontend.h"
+#include "histogram.h"
 
 class RosBoardHandler;
 class BoardCommunicationHandler;
 
+namespace ros
+{
+class NodeHandle;
+}
+
 class RosModule : public RubiFrontend
 {
     friend class RosBoardHandler;
@@ -23,32 +32,71 @@ class RosModule : public RubiFrontend
     std::vector<sptr<RosBoardHandler>> boards;
     std::vector<std::string> cans_names;
 
+    // false when running inside of a nodelet manager
+    bool standalone = true;
+
+    // aggregate per-board topics, disabled when both are 0
+    std::chrono::milliseconds snapshot_period{0};
+    int snapshot_batch = 0;
+
+    // /rubi/stats, counters are turned into rates over the period
+    std::chrono::milliseconds stats_period{1000};
+    std::map<std::pair<const void *, int>, uint64_t> stats_previous;
+    std::chrono::steady_clock::time_point stats_collected;
+
+    std::atomic<bool> quit_requested{false};
+
     Logger log{"RosModule"};
 
+    bool Setup();
+    void ReportRosLatency();
+    void CollectStats();
+
   public:
     RosModule();
     RosModule(RosModule const &) = delete;
     void operator=(RosModule const &) = delete;
 
     bool Init(int argc, char **argv) override;
+    // attaches to an already initialized node, e.g. from a nodelet
+    bool Init(ros::NodeHandle &private_nh);
+    void RequestQuit();
+    // stops the periodic work of the boards, once the server loop is over
+    void ShutdownBoards();
     std::vector<std::string> GetCansNames() override;
 
     void Spin() override;
     bool Quit() override;
+    int GetEventFd() override;
 
     void LogInfo(std::string msg) override;
     void LogWarning(std::string msg) override;
     void LogError(std::string msg) override;
 
-    void ReportCansUtilization(std::vector<float> util) override;
+    void ReportCansUtilization(std::vector<float> util,
+                               std::vector<float> util_ewma) override;
+    void ReportFailover(BoardInstance inst, float latency_ms) override;
+    void ReportEmergencyStop(std::vector<float> latencies_us) override;
+    void ReportGroupCommandStatus(uint32_t request_id, uint8_t command_id,
+                                  BoardInstance inst, bool success) override;
 
     std::shared_ptr<FrontendBoardHandler> NewBoard(BoardInstance inst) override;
 };
 
+namespace ros
+{
+class SingleSubscriberPublisher;
+}
+
 class RosBoardHandler : public FrontendBoardHandler,
                         public std::enable_shared_from_this<RosBoardHandler>
 {
     friend class RosModule;
+    friend void FieldConnectCallback(std::weak_ptr<RosBoardHandler>, int,
+                                     const ros::SingleSubscriberPublisher &);
+    friend void
+    FieldDisconnectCallback(std::weak_ptr<RosBoardHandler>, int,
+                            const ros::SingleSubscriberPublisher &);
     RosModule *ros_module;
 
     struct roshandler_stuff_t;
@@ -63,12 +111,38 @@ class RosBoardHandler : public FrontendBoardHandler,
     std::vector<int> fieldtable;
     std::vector<std::pair<fftype_t, int>> fftable;
 
+    // updates may be delivered from a frontend queue's thread
+    std::mutex lock;
+
+    // per field index, maintained by the publishers' status callbacks
+    std::vector<int> subscribers_count;
+    // raw value of the last update, decoded lazily once someone subscribes
+    std::vector<std::vector<uint8_t>> last_values;
+    std::vector<bool> last_value_stale;
+
+    // field index -> entry of the aggregate snapshot, -1 if not in there
+    std::vector<int> snapshot_index;
+    int snapshot_changes = 0;
+    // periodic publishing, cancelled on shutdown
+    TimerWheel::timer_id snapshot_timer = 0;
+
     Logger log{"RosBoardHandler"};
 
+    void InitSnapshot();
+    void PublishSnapshot();
+
   public:
     sptr<BoardCommunicationHandler> BackendReady();
     BoardInstance board;
 
+    // field updates which were published / only cached for lack of
+    // subscribers
+    std::atomic<uint64_t> updates_decoded{0};
+    std::atomic<uint64_t> updates_skipped{0};
+
+    // per field index, ns spent decoding and publishing an update
+    std::unique_ptr<LatencyHistogram[]> decode_time;
+
     void FFDataInbound(std::vector<uint8_t> &data, int ffid) override;
 
     int GetFieldFfid(int field_id);
@@ -0,0 +1,535 @@
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <ros/ros.h>
+
+#include "alloc_check.h"
+#include "board.h"
+#include "communication.h"
+#include "descriptors.h"
+#include "frontend.h"
+#include "logger.h"
+#include "protocol.h"
+#include "ros_frontend.h"
+#include "rubi_autodefs.h"
+#include "shm_layout.h"
+#include "socketcan.h"
+
+#include "rubi_server/RubiBool.h"
+#include "rubi_server/RubiFloat.h"
+#include "rubi_server/RubiInt.h"
+#include "rubi_server/RubiString.h"
+#include "rubi_server/RubiUnsignedInt.h"
+
+using std::vector;
+using std::string;
+
+// logs of the benchmarked code go to stderr, nothing else is reported
+class BenchFrontend : public RubiFrontend
+{
+  public:
+    bool Init(int argc, char **argv) override { return true; }
+    std::vector<std::string> GetCansNames() override { return {}; }
+    void Spin() override {}
+    bool Quit() override { return false; }
+    int GetEventFd() override { return -1; }
+
+    void LogInfo(std::string msg) override {}
+    void LogWarning(std::string msg) override { std::cerr << msg << "\n"; }
+    void LogError(std::string msg) override { std::cerr << msg << "\n"; }
+
+    void ReportCansUtilization(std::vector<float> util,
+                               std::vector<float> util_ewma) override
+    {
+    }
+    void ReportFailover(BoardInstance inst, float latency_ms) override {}
+    void ReportEmergencyStop(std::vector<float> latencies_us) override {}
+    void ReportGroupCommandStatus(uint32_t request_id, uint8_t command_id,
+                                  BoardInstance inst, bool success) override
+    {
+    }
+
+    std::shared_ptr<FrontendBoardHandler> NewBoard(BoardInstance inst) override
+    {
+        return nullptr;
+    }
+};
+
+// swallows the reassembled updates, so that only the protocol is measured
+class NullBoardHandler : public FrontendBoardHandler
+{
+  public:
+    uint64_t updates = 0;
+
+    void FFDataInbound(std::vector<uint8_t> &data, int ffid) override
+    {
+        updates += 1;
+    }
+    void ReplaceBackendHandler(sptr<BoardCommunicationHandler>) override {}
+    void Shutdown() override {}
+    void ConnectionLost() override {}
+};
+
+// frames of a message sent by a board, as rubi_continue_tx() frames them
+static vector<vector<uint8_t>> FrameMessage(uint8_t msg_type, uint8_t id,
+                                            const vector<uint8_t> &data)
+{
+    vector<vector<uint8_t>> frames;
+
+    if (data.size() <= 6)
+    {
+        frames.push_back({msg_type, id});
+        frames.back().insert(frames.back().end(), data.begin(), data.end());
+        return frames;
+    }
+
+    for (size_t i = 0; i < data.size(); i += 7)
+    {
+        frames.push_back({RUBI_MSG_BLOCK});
+        frames.back().insert(frames.back().end(), data.begin() + i,
+                             data.begin() + std::min(i + 7, data.size()));
+    }
+
+    frames.push_back({(uint8_t)(msg_type | RUBI_FLAG_BLOCK_TRANSFER), id,
+                      (uint8_t)frames.size()});
+
+    return frames;
+}
+
+// info messages of a board with fields_count fields, in the order boards
+// stream them
+static vector<std::pair<uint8_t, string>> DescriptorInfo(int fields_count)
+{
+    vector<std::pair<uint8_t, string>> info = {
+        {RUBI_INFO_BOARD_NAME, "bench_board"},
+        {RUBI_INFO_BOARD_VERSION, "1.0"},
+        {RUBI_INFO_BOARD_DRIVER, "bench_driver"},
+        {RUBI_INFO_BOARD_DESC, "Board described by rubi_bench"}};
+
+    for (int i = 0; i < fields_count; i++)
+    {
+        info.push_back({RUBI_INFO_FIELD_NAME, "field" + std::to_string(i)});
+        info.push_back(
+            {RUBI_INFO_FIELD_TYPE, string(1, _RUBI_TYPECODES_uint16_t)});
+        info.push_back({RUBI_INFO_FIELD_ACCESS, string(1, RUBI_WRITEONLY)});
+        info.push_back({RUBI_INFO_SUBFIELDS, "x,y,z"});
+    }
+
+    return info;
+}
+
+static uint64_t FramesCount(size_t size)
+{
+    return size <= 6 ? 1 : (size + 6) / 7 + 1;
+}
+
+// single frames, the largest one and block transfers
+static void MessageSizes(benchmark::internal::Benchmark *benchmark)
+{
+    for (int size : {1, 4, 6, 7, 32, 255})
+        benchmark->Arg(size);
+}
+
+// vcan interface of the round trip benchmark
+static string BenchCan()
+{
+    const char *can = std::getenv("RUBI_BENCH_CAN");
+    return can ? can : "vcan0";
+}
+
+// a field update enqueued and framed, frames go to an in-process bus
+// nobody listens on
+static void BM_ProtocolEncode(benchmark::State &state)
+{
+    CanHandler can("inproc:bench_encode");
+    auto board = std::make_shared<BoardCommunicationHandler>(&can, 0);
+    ProtocolHandler protocol(board.get(), 0, &can);
+    vector<uint8_t> data(state.range(0), 0x55);
+
+    // the first send takes a buffer of the pool
+    protocol.SendFFData(0, RUBI_MSG_FIELD, data);
+    uint64_t allocations = AllocationCheck::GetViolations();
+
+    for (auto _ : state)
+    {
+        ALLOCATION_CHECK_SCOPE();
+        protocol.SendFFData(0, RUBI_MSG_FIELD, data);
+    }
+
+    if (AllocationCheck::GetViolations() != allocations)
+        state.SkipWithError("Sending allocated from the heap after warm-up");
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+    state.counters["frames"] =
+        benchmark::Counter(state.iterations() * FramesCount(data.size()),
+                           benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ProtocolEncode)->Apply(MessageSizes);
+
+// the frames of a field update reassembled by rubi_inbound()
+static void BM_ProtocolReassembly(benchmark::State &state)
+{
+    CanHandler can("inproc:bench_reassembly");
+    auto board = std::make_shared<BoardCommunicationHandler>(&can, 0);
+    ProtocolHandler protocol(board.get(), 0, &can);
+    auto frontend = std::make_shared<NullBoardHandler>();
+    board->Launch(frontend);
+
+    uint32_t cob = can.NodeToCob(0);
+    vector<std::pair<uint32_t, vector<uint8_t>>> frames;
+    for (const auto &frame : FrameMessage(
+             RUBI_MSG_FIELD, 0, vector<uint8_t>(state.range(0), 0x55)))
+        frames.push_back({cob, frame});
+
+    // the first message takes the buffers it needs
+    for (const auto &frame : frames)
+        protocol.InboundWrapper(frame);
+    frontend->updates = 0;
+    uint64_t allocations = AllocationCheck::GetViolations();
+
+    for (auto _ : state)
+    {
+        ALLOCATION_CHECK_SCOPE();
+        for (const auto &frame : frames)
+            protocol.InboundWrapper(frame);
+    }
+
+    if (frontend->updates != state.iterations())
+        state.SkipWithError("Updates were lost in the reassembly");
+    if (AllocationCheck::GetViolations() != allocations)
+        state.SkipWithError("Reassembly allocated from the heap after warm-up");
+
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    state.counters["frames"] = benchmark::Counter(
+        state.iterations() * frames.size(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ProtocolReassembly)->Apply(MessageSizes);
+
+// a whole descriptor built from the info messages of a board, and frozen as
+// at the end of the handshake
+static void BM_ApplyInfo(benchmark::State &state)
+{
+    auto info = DescriptorInfo(state.range(0));
+
+    for (auto _ : state)
+    {
+        auto descriptor = std::make_shared<BoardDescriptor>();
+        for (const auto &message : info)
+            descriptor->ApplyInfo(message.first, message.second);
+        descriptor->Freeze();
+
+        benchmark::DoNotOptimize(descriptor);
+    }
+
+    state.SetItemsProcessed(state.iterations() * info.size());
+}
+BENCHMARK(BM_ApplyInfo)->Arg(1)->Arg(8)->Arg(32)->Arg(128);
+
+// descriptors of a board which reconnects are compared with the known ones
+static void BM_DescriptorEquality(benchmark::State &state)
+{
+    auto info = DescriptorInfo(state.range(0));
+    BoardDescriptor a, b;
+
+    for (const auto &message : info)
+    {
+        a.ApplyInfo(message.first, message.second);
+        b.ApplyInfo(message.first, message.second);
+    }
+
+    a.Freeze();
+    b.Freeze();
+
+    for (auto _ : state)
+    {
+        bool equal = a == b;
+        benchmark::DoNotOptimize(equal);
+    }
+}
+BENCHMARK(BM_DescriptorEquality)->Arg(1)->Arg(8)->Arg(32)->Arg(128);
+
+// the ROS frontend, set up on the first decode benchmark
+static RosModule *GetRosModule()
+{
+    static std::unique_ptr<RosModule> ros_module;
+    static bool tried = false;
+
+    if (tried)
+        return ros_module.get();
+    tried = true;
+
+    int argc = 1;
+    char *argv[] = {(char *)"rubi_bench", nullptr};
+    ros::init(argc, argv, "rubi_bench",
+              ros::init_options::AnonymousName |
+                  ros::init_options::NoSigintHandler);
+
+    // advertising would wait for the master forever
+    if (!ros::master::check())
+        return nullptr;
+
+    ros::NodeHandle n("~");
+    ros_module.reset(new RosModule());
+    ros_module->Init(n);
+
+    return ros_module.get();
+}
+
+template <class M>
+static ros::Subscriber Subscribe(ros::NodeHandle &n, const string &topic)
+{
+    // std::func inference seems broken
+    return n.subscribe<M>(
+        topic, 1,
+        boost::function<void(const typename M::ConstPtr &)>(
+            [](const typename M::ConstPtr &) {}));
+}
+
+// a field update decoded and published by the ROS frontend, to a
+// subscriber in the same process
+static void BM_Decode(benchmark::State &state)
+{
+    uint8_t typecode = state.range(0);
+    int subfields_count = state.range(1);
+
+    auto ros_module = GetRosModule();
+    if (!ros_module)
+    {
+        state.SkipWithError("No ROS master, decoding is not measured");
+        return;
+    }
+
+    auto descriptor = std::make_shared<BoardDescriptor>();
+    descriptor->board_name = "bench_decode_" + std::to_string(typecode) +
+                             "_" + std::to_string(subfields_count);
+
+    auto field = std::make_shared<FieldDescriptor>(0);
+    field->name = "field";
+    field->typecode = typecode;
+    field->access = RUBI_WRITEONLY;
+    for (int i = 0; i < subfields_count; i++)
+        field->subfields_names.push_back("s" + std::to_string(i));
+    descriptor->fieldfunctions.push_back(field);
+    descriptor->Freeze();
+
+    BoardInstance inst{std::weak_ptr<BoardCommunicationHandler>()};
+    inst.descriptor = descriptor;
+    auto handler =
+        std::dynamic_pointer_cast<RosBoardHandler>(ros_module->NewBoard(inst));
+
+    // only fields somebody subscribes to are decoded
+    ros::NodeHandle n;
+    ros::Subscriber subscriber;
+    auto topic =
+        descriptor->GetBoardPrefix(inst.id) + "fields_from_board/field";
+
+    switch (typecode)
+    {
+    case _RUBI_TYPECODES_int32_t:
+        subscriber = Subscribe<rubi_server::RubiInt>(n, topic);
+        break;
+    case _RUBI_TYPECODES_uint16_t:
+        subscriber = Subscribe<rubi_server::RubiUnsignedInt>(n, topic);
+        break;
+    case _RUBI_TYPECODES_float:
+        subscriber = Subscribe<rubi_server::RubiFloat>(n, topic);
+        break;
+    case _RUBI_TYPECODES_bool:
+        subscriber = Subscribe<rubi_server::RubiBool>(n, topic);
+        break;
+    case _RUBI_TYPECODES_shortstring:
+        subscriber = Subscribe<rubi_server::RubiString>(n, topic);
+        break;
+    }
+
+    vector<uint8_t> data(field->GetFFSize(), 0);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!handler->updates_decoded &&
+           std::chrono::steady_clock::now() < deadline)
+    {
+        ros_module->Spin();
+        handler->FFDataInbound(data, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    if (!handler->updates_decoded)
+    {
+        state.SkipWithError("The subscriber didn't connect");
+        return;
+    }
+
+    for (auto _ : state)
+        handler->FFDataInbound(data, 0);
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Decode)
+    ->ArgNames({"typecode", "subfields"})
+    ->ArgsProduct({{_RUBI_TYPECODES_int32_t, _RUBI_TYPECODES_uint16_t,
+                    _RUBI_TYPECODES_float, _RUBI_TYPECODES_bool,
+                    _RUBI_TYPECODES_shortstring},
+                   {0, 1, 4, 16}});
+
+// a value read from its seqlock protected slot as rubi_shm_client reads it,
+// optionally while another thread keeps updating it as the server does
+static void BM_ShmRead(benchmark::State &state)
+{
+    size_t size = state.range(0);
+    bool writer_running = state.range(1);
+
+    // a slot and its value, on a cache line of its own as in the segment
+    struct alignas(RUBI_SHM_SLOT_ALIGN) slot_storage_t
+    {
+        rubi_shm_slot slot;
+        uint8_t value[RUBI_SHM_MAX_COMMAND_SIZE];
+    };
+    slot_storage_t storage;
+    rubi_shm_slot *slot = &storage.slot;
+    slot->seq = 0;
+
+    vector<uint8_t> written(size, 0x55), read(size);
+    rubi_shm_slot_write(slot, written.data(), size, 0);
+
+    std::atomic<bool> quit{false};
+    std::atomic<uint64_t> writes{0};
+    std::thread writer;
+    if (writer_running)
+    {
+        writer = std::thread([&]() {
+            uint64_t stamp = 0;
+            while (!quit.load(std::memory_order_relaxed))
+            {
+                rubi_shm_slot_write(slot, written.data(), size, ++stamp);
+                writes.store(stamp, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    for (auto _ : state)
+    {
+        uint64_t stamp;
+        bool valid = rubi_shm_slot_read(slot, read.data(), size, &stamp);
+        benchmark::DoNotOptimize(valid);
+        benchmark::DoNotOptimize(read.data());
+    }
+
+    quit = true;
+    if (writer.joinable())
+        writer.join();
+
+    state.SetBytesProcessed(state.iterations() * size);
+    state.counters["writes"] =
+        benchmark::Counter(writes, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ShmRead)
+    ->ArgNames({"size", "writer"})
+    ->ArgsProduct({{4, 12, 64, 255}, {0, 1}})
+    ->UseRealTime();
+
+// a formatted message below the level set, which the call site discards
+static void BM_LoggerDisabled(benchmark::State &state)
+{
+    Logger log{"Bench"};
+    int i = 0;
+
+    Logger::SetLevel(Logger::level_error);
+
+    for (auto _ : state)
+        LOG_INFO(log, "Field " + std::to_string(i++ % 8) + " updated");
+
+    Logger::SetLevel(Logger::level_info);
+}
+BENCHMARK(BM_LoggerDisabled);
+
+// a call site over its budget, e.g. during a bus fault
+static void BM_LoggerSuppressed(benchmark::State &state)
+{
+    Logger log{"Bench"};
+    int i = 0;
+
+    for (auto _ : state)
+        LOG_INFO(log, "Field " + std::to_string(i++ % 8) + " updated");
+
+    Logger::Drain();
+}
+BENCHMARK(BM_LoggerSuppressed);
+
+// a formatted message queued for the frontend, bypassing the call site's
+// budget, the ring is drained outside of the measurement before it fills up
+static void BM_LoggerEnqueue(benchmark::State &state)
+{
+    Logger log{"Bench"};
+    int i = 0;
+
+    for (auto _ : state)
+    {
+        log.Info("Field " + std::to_string(i++ % 8) + " updated");
+
+        if (i % 512 == 0)
+        {
+            state.PauseTiming();
+            Logger::Drain();
+            state.ResumeTiming();
+        }
+    }
+
+    Logger::Drain();
+}
+BENCHMARK(BM_LoggerEnqueue);
+
+// a frame sent through one socket and received by another
+static void BM_SocketCanRoundTrip(benchmark::State &state, string port)
+{
+    if (port.empty())
+        port = BenchCan();
+
+    if (!SocketCan::IsInproc(port) && !SocketCan::IsInterfaceAvaliable(port))
+    {
+        state.SkipWithError(("No " + port + ", set RUBI_BENCH_CAN").c_str());
+        return;
+    }
+
+    SocketCan tx(port), rx(port);
+    std::pair<uint32_t, vector<uint8_t>> frame = {0x7ff, vector<uint8_t>(8)};
+
+    for (auto _ : state)
+    {
+        tx.Send(frame);
+
+        // other traffic on the bus is skipped
+        for (;;)
+        {
+            auto received = rx.Receive(1000);
+            if (!received)
+            {
+                state.SkipWithError("A frame was lost");
+                return;
+            }
+
+            if (std::get<0>(*received) == frame.first)
+                break;
+        }
+    }
+
+    state.counters["frames"] =
+        benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_SocketCanRoundTrip, inproc, string("inproc:bench_rt"));
+BENCHMARK_CAPTURE(BM_SocketCanRoundTrip, vcan, string());
+
+int main(int argc, char **argv)
+{
+    BoardManager::inst().frontend = std::make_shared<BenchFrontend>();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    Logger::Drain();
+}
@@ -0,0 +1,50 @@
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <thread>
+
+#include "board.h"
+#include "exceptions.h"
+#include "ros_frontend.h"
+
+namespace rubi_server
+{
+
+// Runs the rubi_server inside of a nodelet manager, so that consumers loaded
+// into the same manager receive board fields without serialization.
+class RubiServerNodelet : public nodelet::Nodelet
+{
+    sptr<RosModule> frontend;
+    std::thread worker;
+
+    void onInit() override
+    {
+        // the BoardManager is a per-process singleton
+        ASSERT(!BoardManager::inst().frontend,
+               "Only one rubi_server can be loaded per process!");
+
+        frontend = std::make_shared<RosModule>();
+        BoardManager::inst().frontend = frontend;
+        BoardManager::inst().owns_process = false;
+
+        frontend->Init(getPrivateNodeHandle());
+        BoardManager::inst().Init(frontend->GetCansNames());
+
+        // onInit must not block the manager
+        worker = std::thread([]() { BoardManager::inst().Run(); });
+    }
+
+  public:
+    ~RubiServerNodelet()
+    {
+        if (!worker.joinable())
+            return;
+
+        frontend->RequestQuit();
+        worker.join();
+        frontend->ShutdownBoards();
+    }
+};
+
+} // namespace rubi_server
+
+PLUGINLIB_EXPORT_CLASS(rubi_server::RubiServerNodelet, nodelet::Nodelet)
@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "rubi_shm_client.h"
+
+RubiShmClient::RubiShmClient(std::string shm_name) : shm_name(shm_name)
+{
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw std::runtime_error("No rubi_server at " + shm_name);
+
+    struct stat shm_stat;
+    fstat(fd, &shm_stat);
+    shm_size = shm_stat.st_size;
+
+    void *segment =
+        mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (segment == MAP_FAILED)
+        throw std::runtime_error("Can't map " + shm_name);
+
+    header = static_cast<rubi_shm_header *>(segment);
+
+    if (header->magic.load(std::memory_order_acquire) != RUBI_SHM_MAGIC ||
+        header->version != RUBI_SHM_VERSION)
+    {
+        munmap(header, shm_size);
+        throw std::runtime_error("Incompatible rubi_server at " + shm_name);
+    }
+}
+
+RubiShmClient::~RubiShmClient() { munmap(header, shm_size); }
+
+bool RubiShmClient::Push(rubi_shm_header *header,
+                         const rubi_shm_command &command)
+{
+    if (!rubi_shm_push_command(header, command))
+        return false;
+
+    // only the first command since the server last looked rings the bell
+    if (header->doorbell_pending.exchange(1))
+        return true;
+
+    static thread_local int doorbell = socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, header->doorbell_path, sizeof(addr.sun_path) - 1);
+
+    char ring = 0;
+    sendto(doorbell, &ring, 1, MSG_DONTWAIT, (sockaddr *)&addr, sizeof(addr));
+
+    return true;
+}
+
+boost::optional<uint32_t> RubiShmClient::FindBoard(std::string board,
+                                                   std::string id)
+{
+    uint32_t boards_count = header->boards_count.load(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < boards_count; i++)
+    {
+        if (board == header->boards[i].name && id == header->boards[i].id)
+            return i;
+    }
+
+    return boost::none;
+}
+
+boost::optional<uint32_t> RubiShmClient::FindField(std::string board,
+                                                   std::string id,
+                                                   std::string field)
+{
+    auto board_index = FindBoard(board, id);
+    if (!board_index)
+        return boost::none;
+
+    auto &entry = header->boards[*board_index];
+
+    for (uint32_t i = entry.first_field;
+         i < entry.first_field + entry.fields_count; i++)
+    {
+        if (field == header->fields[i].name)
+            return i;
+    }
+
+    return boost::none;
+}
+
+std::vector<std::string> RubiShmClient::GetBoards()
+{
+    std::vector<std::string> ret;
+    uint32_t boards_count = header->boards_count.load(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < boards_count; i++)
+    {
+        if (header->boards[i].id[0])
+            ret.push_back(std::string(header->boards[i].name) + ":" +
+                          header->boards[i].id);
+        else
+            ret.push_back(header->boards[i].name);
+    }
+
+    return ret;
+}
+
+bool RubiShmClient::Command(std::string board, std::string id,
+                            uint8_t command_id)
+{
+    auto board_index = FindBoard(board, id);
+    if (!board_index)
+        return false;
+
+    rubi_shm_command command;
+    command.board = *board_index;
+    command.ffid = 0;
+    command.size = 0;
+    command.command = command_id;
+
+    return Push(header, command);
+}
+
+bool RubiShmClient::Wake(std::string board, std::string id)
+{
+    return Command(board, id, rubi_shm_wake);
+}
+
+bool RubiShmClient::Sleep(std::string board, std::string id)
+{
+    return Command(board, id, rubi_shm_sleep);
+}
+
+bool RubiShmClient::Reboot(std::string board, std::string id)
+{
+    return Command(board, id, rubi_shm_reboot);
+}
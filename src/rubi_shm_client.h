@@ -0,0 +1,182 @@
+#pragma once
+
+#include <boost/optional.hpp>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+#include "rubi_autodefs.h"
+#include "shm_layout.h"
+
+class RubiShmClient;
+
+// typecodes a C++ type can be read from and written to
+template <typename T> struct rubi_shm_typecode;
+
+template <> struct rubi_shm_typecode<int32_t>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_int32_t;
+    }
+};
+
+template <> struct rubi_shm_typecode<int16_t>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_int16_t;
+    }
+};
+
+template <> struct rubi_shm_typecode<int8_t>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_int8_t;
+    }
+};
+
+template <> struct rubi_shm_typecode<uint32_t>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_uint32_t;
+    }
+};
+
+template <> struct rubi_shm_typecode<uint16_t>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_uint16_t;
+    }
+};
+
+template <> struct rubi_shm_typecode<uint8_t>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_uint8_t ||
+               typecode == _RUBI_TYPECODES_bool;
+    }
+};
+
+template <> struct rubi_shm_typecode<float>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_float;
+    }
+};
+
+template <> struct rubi_shm_typecode<shortstring>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_shortstring;
+    }
+};
+
+template <> struct rubi_shm_typecode<longstring>
+{
+    static bool Matches(uint8_t typecode)
+    {
+        return typecode == _RUBI_TYPECODES_longstring;
+    }
+};
+
+// A field of a board, holding Count() values of type T. Reads never block
+// the server and take a few tens of ns when the value is not being updated.
+template <typename T> class RubiShmField
+{
+    friend class RubiShmClient;
+
+    rubi_shm_header *header;
+    const rubi_shm_field *field;
+
+    RubiShmField(rubi_shm_header *header, uint32_t index)
+        : header(header), field(&header->fields[index])
+    {
+    }
+
+  public:
+    size_t Count() const { return field->size / sizeof(T); }
+
+    // false if the board has not sent the field yet
+    bool Read(T *values, uint64_t *stamp_ns = nullptr) const
+    {
+        return rubi_shm_slot_read(rubi_shm_get_slot(header, field->slot),
+                                  reinterpret_cast<uint8_t *>(values),
+                                  field->size, stamp_ns);
+    }
+
+    bool Read(std::vector<T> &values, uint64_t *stamp_ns = nullptr) const
+    {
+        values.resize(Count());
+        return Read(values.data(), stamp_ns);
+    }
+
+    // false if the server's command queue is full
+    bool Write(const T *values);
+};
+
+class RubiShmClient
+{
+    template <typename T> friend class RubiShmField;
+
+    std::string shm_name;
+    size_t shm_size = 0;
+    rubi_shm_header *header = nullptr;
+
+    static bool Push(rubi_shm_header *header, const rubi_shm_command &command);
+
+    boost::optional<uint32_t> FindBoard(std::string board, std::string id);
+    boost::optional<uint32_t> FindField(std::string board, std::string id,
+                                        std::string field);
+    bool Command(std::string board, std::string id, uint8_t command);
+
+  public:
+    // throws std::runtime_error if the server does not run
+    RubiShmClient(std::string shm_name = "/rubi_server");
+    ~RubiShmClient();
+    RubiShmClient(RubiShmClient const &) = delete;
+    void operator=(RubiShmClient const &) = delete;
+
+    // none if there is no such board (yet) or the type does not match; pass
+    // an empty id for boards without one
+    template <typename T>
+    boost::optional<RubiShmField<T>>
+    GetField(std::string board, std::string id, std::string field)
+    {
+        auto index = FindField(board, id, field);
+
+        if (!index ||
+            !rubi_shm_typecode<T>::Matches(header->fields[*index].typecode) ||
+            header->fields[*index].size % sizeof(T))
+            return boost::none;
+
+        return RubiShmField<T>(header, *index);
+    }
+
+    std::vector<std::string> GetBoards();
+
+    bool Wake(std::string board, std::string id = "");
+    bool Sleep(std::string board, std::string id = "");
+    bool Reboot(std::string board, std::string id = "");
+};
+
+template <typename T> bool RubiShmField<T>::Write(const T *values)
+{
+    if (field->size > RUBI_SHM_MAX_COMMAND_SIZE)
+        return false;
+
+    rubi_shm_command command;
+    command.board = field->board;
+    command.ffid = field->ffid;
+    command.size = field->size;
+    command.command = rubi_shm_field_write;
+    memcpy(command.data, values, field->size);
+
+    return RubiShmClient::Push(header, command);
+}
@@ -0,0 +1,395 @@
+#include <boost/algorithm/string.hpp>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+#include "rubi_autodefs.h"
+#include "shm_frontend.h"
+#include "trace.h"
+
+std::atomic<bool> ShmFrontend::quit{false};
+
+static uint64_t MonotonicNow()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void ShmFrontend::SignalHandler(int signal) { quit = true; }
+
+// a running server holds a lock on its segment, which the kernel releases
+// however the server exits
+static bool IsSegmentStale(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    // closing the descriptor releases the lock again
+    bool stale = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    close(fd);
+
+    return stale;
+}
+
+ShmFrontend::ShmFrontend(bool handle_signals) : handle_signals(handle_signals)
+{
+}
+
+ShmFrontend::~ShmFrontend()
+{
+    if (header)
+    {
+        munmap(header, shm_size);
+        shm_unlink(shm_name.c_str());
+    }
+
+    if (shm_fd >= 0)
+        close(shm_fd);
+
+    if (doorbell >= 0)
+    {
+        close(doorbell);
+        unlink(("/tmp" + shm_name + ".doorbell").c_str());
+    }
+}
+
+bool ShmFrontend::Init(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::vector<std::string> name_and_value;
+        boost::split(name_and_value, argv[i], boost::is_any_of("="));
+
+        if (name_and_value.size() != 2 ||
+            !boost::starts_with(name_and_value[0], "_") ||
+            !boost::ends_with(name_and_value[0], ":"))
+            continue;
+
+        auto name = name_and_value[0].substr(1, name_and_value[0].size() - 2);
+        auto value = name_and_value[1];
+
+        if (name == "cans")
+            boost::split(cans_names, value, boost::is_any_of(","));
+        else if (name == "shm_name")
+            shm_name = value;
+        else if (name == "shm_size")
+            shm_size = std::stoul(value);
+    }
+
+    if (cans_names.empty())
+    {
+        LOG_WARNING(log, "No can interfaces given! Assuming its can0.");
+        cans_names = {"can0"};
+    }
+
+    ASSERT(shm_size > rubi_shm_slots_start(), "Shared memory is too small!");
+
+    shm_fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (shm_fd < 0 && errno == EEXIST && IsSegmentStale(shm_name))
+    {
+        LOG_WARNING(log, "Removing shared memory " + shm_name +
+                             " left behind by a server which is gone.");
+        shm_unlink(shm_name.c_str());
+        shm_fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    }
+    if (shm_fd < 0 && errno == EEXIST)
+        throw FrontendCommunicationException("Shared memory " + shm_name +
+                                             " is used by another server");
+    if (shm_fd < 0)
+        throw FrontendCommunicationException("Can't create shared memory " +
+                                             shm_name);
+    // held for as long as the server runs, see IsSegmentStale()
+    if (flock(shm_fd, LOCK_EX | LOCK_NB) < 0)
+        throw FrontendCommunicationException("Can't lock shared memory " +
+                                             shm_name);
+    if (ftruncate(shm_fd, shm_size) < 0)
+    {
+        shm_unlink(shm_name.c_str());
+        throw FrontendCommunicationException("Can't size shared memory " +
+                                             shm_name);
+    }
+
+    void *segment =
+        mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (segment == MAP_FAILED)
+        throw FrontendCommunicationException("Can't map shared memory " +
+                                             shm_name);
+
+    // the segment is zeroed by ftruncate
+    header = static_cast<rubi_shm_header *>(segment);
+    header->version = RUBI_SHM_VERSION;
+    header->size = shm_size;
+    header->slots_used = rubi_shm_slots_start();
+
+    for (uint64_t i = 0; i < RUBI_SHM_RING_SIZE; i++)
+        header->ring[i].seq.store(i, std::memory_order_relaxed);
+
+    std::string doorbell_path = "/tmp" + shm_name + ".doorbell";
+    ASSERT(doorbell_path.size() < sizeof(header->doorbell_path));
+    strcpy(header->doorbell_path, doorbell_path.c_str());
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, doorbell_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    unlink(doorbell_path.c_str());
+    doorbell = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (doorbell < 0 || bind(doorbell, (sockaddr *)&addr, sizeof(addr)) < 0)
+        throw FrontendCommunicationException("Can't bind the doorbell at " +
+                                             doorbell_path);
+
+    header->magic.store(RUBI_SHM_MAGIC, std::memory_order_release);
+
+    // next to other frontends, their own handling of the signals is kept
+    // and the server quits when they do
+    if (handle_signals)
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = ShmFrontend::SignalHandler;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+
+    LOG_INFO(log, "Serving boards in shared memory " + shm_name + ".");
+
+    return true;
+}
+
+std::vector<std::string> ShmFrontend::GetCansNames() { return cans_names; }
+
+void ShmFrontend::Spin()
+{
+    // clients ring again for whatever they push after this point
+    header->doorbell_pending.store(0);
+
+    char buffer[16];
+    while (recv(doorbell, buffer, sizeof(buffer), 0) >= 0)
+        ;
+
+    rubi_shm_command command;
+    while (rubi_shm_pop_command(header, command))
+        HandleCommand(command);
+}
+
+void ShmFrontend::HandleCommand(const rubi_shm_command &command)
+{
+    if (command.board >= boards.size())
+    {
+        LOG_WARNING(log, "Command for an unknown board dropped.");
+        return;
+    }
+
+    auto handler = boards[command.board];
+    auto backend_handler = handler->BackendReady();
+    if (!backend_handler)
+        return;
+
+    switch (command.command)
+    {
+    case rubi_shm_field_write:
+    {
+        const auto &layout = handler->board.descriptor->layout;
+        int ffid = command.ffid;
+
+        if (command.ffid >= handler->field_index.size() ||
+            handler->field_index[command.ffid] < 0)
+        {
+            LOG_WARNING(log, "Write to an unknown field dropped.");
+            return;
+        }
+
+        if ((layout.accesses[ffid] != RUBI_READONLY &&
+             layout.accesses[ffid] != RUBI_READWRITE) ||
+            layout.sizes[ffid] != command.size)
+        {
+            LOG_WARNING(log, std::string("Invalid write to field ") +
+                             layout.GetName(ffid) + " dropped.");
+            return;
+        }
+
+        std::vector<uint8_t> data(command.data, command.data + command.size);
+        backend_handler->FFDataOutbound(ffid, data);
+        break;
+    }
+    case rubi_shm_wake:
+        backend_handler->CommandWake();
+        break;
+    case rubi_shm_sleep:
+        backend_handler->CommandSleep();
+        break;
+    case rubi_shm_reboot:
+        backend_handler->CommandReboot();
+        break;
+    default:
+        LOG_WARNING(log, "Unknown command dropped.");
+    }
+}
+
+bool ShmFrontend::Quit() { return quit; }
+
+int ShmFrontend::GetEventFd() { return doorbell; }
+
+void ShmFrontend::LogInfo(std::string msg) { std::cout << msg << std::endl; }
+
+void ShmFrontend::LogWarning(std::string msg)
+{
+    std::cerr << "WARNING: " << msg << std::endl;
+}
+
+void ShmFrontend::LogError(std::string msg)
+{
+    std::cerr << "ERROR: " << msg << std::endl;
+}
+
+void ShmFrontend::ReportCansUtilization(std::vector<float> util,
+                                        std::vector<float> util_ewma)
+{
+}
+
+void ShmFrontend::ReportFailover(BoardInstance inst, float latency_ms)
+{
+    LOG_WARNING(log, "Board " + (std::string)inst + " failed over in " +
+                     std::to_string(latency_ms) + " ms.");
+}
+
+void ShmFrontend::ReportEmergencyStop(std::vector<float> latencies_us) {}
+
+void ShmFrontend::ReportGroupCommandStatus(uint32_t request_id,
+                                           uint8_t command_id,
+                                           BoardInstance inst, bool success)
+{
+}
+
+std::shared_ptr<FrontendBoardHandler> ShmFrontend::NewBoard(BoardInstance inst)
+{
+    auto handler = std::make_shared<ShmBoardHandler>(inst, this);
+    const auto &layout = inst.descriptor->layout;
+
+    uint32_t board_index = header->boards_count.load();
+    uint32_t fields_count = 0;
+    uint64_t slots_size = 0;
+
+    for (size_t ffid = 0; ffid < layout.Size(); ffid++)
+    {
+        if (layout.IsField(ffid))
+        {
+            fields_count += 1;
+            slots_size += (sizeof(rubi_shm_slot) + layout.sizes[ffid] +
+                           RUBI_SHM_SLOT_ALIGN - 1) /
+                          RUBI_SHM_SLOT_ALIGN * RUBI_SHM_SLOT_ALIGN;
+        }
+    }
+
+    if (board_index >= RUBI_SHM_MAX_BOARDS ||
+        header->fields_count + fields_count > RUBI_SHM_MAX_FIELDS ||
+        header->slots_used + slots_size > shm_size)
+    {
+        LOG_ERROR(log, "Out of shared memory, board " + (std::string)inst +
+                       " won't be available!");
+        // not in boards, which clients index like the header's boards
+        handler->field_index.resize(layout.Size(), -1);
+        return handler;
+    }
+
+    auto &board = header->boards[board_index];
+    strncpy(board.name, inst.descriptor->board_name.c_str(),
+            RUBI_SHM_NAME_LEN - 1);
+    strncpy(board.id, inst.id ? inst.id->c_str() : "", RUBI_SHM_NAME_LEN - 1);
+    board.first_field = header->fields_count;
+    board.fields_count = fields_count;
+
+    for (size_t ffid = 0; ffid < layout.Size(); ffid++)
+    {
+        if (!layout.IsField(ffid))
+        {
+            handler->field_index.push_back(-1);
+            continue;
+        }
+
+        auto &field = header->fields[header->fields_count];
+        strncpy(field.name, layout.GetName(ffid), RUBI_SHM_NAME_LEN - 1);
+        field.board = board_index;
+        field.ffid = ffid;
+        field.typecode = layout.typecodes[ffid];
+        field.access = layout.accesses[ffid];
+        field.size = layout.sizes[ffid];
+        field.slot = header->slots_used;
+
+        rubi_shm_get_slot(header, field.slot)->size = field.size;
+
+        header->slots_used += (sizeof(rubi_shm_slot) + field.size +
+                               RUBI_SHM_SLOT_ALIGN - 1) /
+                              RUBI_SHM_SLOT_ALIGN * RUBI_SHM_SLOT_ALIGN;
+        handler->field_index.push_back(header->fields_count);
+        header->fields_count += 1;
+    }
+
+    header->boards_count.store(board_index + 1, std::memory_order_release);
+    boards.push_back(handler);
+
+    LOG_INFO(log, "Frontend registered new board type: " +
+                  inst.descriptor->board_name);
+
+    return handler;
+}
+
+ShmBoardHandler::ShmBoardHandler(BoardInstance inst, ShmFrontend *shm_frontend)
+    : shm_frontend(shm_frontend), board(inst)
+{
+}
+
+void ShmBoardHandler::FFDataInbound(std::vector<uint8_t> &data, int ffid)
+{
+    TRACE_SCOPE("shm_write", ffid);
+
+    if (field_index[ffid] < 0)
+        return;
+
+    auto &field = shm_frontend->header->fields[field_index[ffid]];
+    ASSERT(field.size == data.size());
+
+    rubi_shm_slot_write(rubi_shm_get_slot(shm_frontend->header, field.slot),
+                        data.data(), data.size(), MonotonicNow());
+}
+
+sptr<BoardCommunicationHandler> ShmBoardHandler::BackendReady()
+{
+    sptr<BoardCommunicationHandler> ret;
+    if (!(ret = board.backend_handler.lock()) || ret->IsDead())
+    {
+        ret = BoardManager::inst().RequestNewHandler(board, shared_from_this());
+        if (ret)
+            board.backend_handler = ret;
+
+        return ret;
+    }
+
+    if (ret->IsLost())
+        return nullptr;
+
+    return ret;
+}
+
+void ShmBoardHandler::ReplaceBackendHandler(
+    std::shared_ptr<BoardCommunicationHandler> new_handler)
+{
+    board.backend_handler = new_handler;
+}
+
+void ShmBoardHandler::Shutdown() {}
+
+void ShmBoardHandler::ConnectionLost() {}
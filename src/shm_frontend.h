@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "communication.h"
+#include "descriptors.h"
+#include "frontend.h"
+#include "shm_layout.h"
+
+class ShmBoardHandler;
+
+// Frontend for local high-rate consumers. Every field of every board gets a
+// seqlock protected slot in a POSIX shared memory segment, and the clients
+// send their writes through a lock-free ring in the same segment. See
+// rubi_shm_client.h for the client side.
+class ShmFrontend : public RubiFrontend
+{
+    friend class ShmBoardHandler;
+
+  private:
+    static std::atomic<bool> quit;
+    static void SignalHandler(int signal);
+
+    bool handle_signals;
+
+    std::string shm_name = "/rubi_server";
+    size_t shm_size = 4 * 1024 * 1024;
+
+    int shm_fd = -1;
+    rubi_shm_header *header = nullptr;
+    int doorbell = -1;
+
+    // in the order of the header's boards, so only the ones in there
+    std::vector<sptr<ShmBoardHandler>> boards;
+    std::vector<std::string> cans_names;
+
+    Logger log{"ShmFrontend"};
+
+    void HandleCommand(const rubi_shm_command &command);
+
+  public:
+    // SIGINT and SIGTERM make it quit, for when it's the only frontend
+    ShmFrontend(bool handle_signals = false);
+    ~ShmFrontend();
+    ShmFrontend(ShmFrontend const &) = delete;
+    void operator=(ShmFrontend const &) = delete;
+
+    // takes the same "_name:=value" arguments as the RosModule
+    bool Init(int argc, char **argv) override;
+    std::vector<std::string> GetCansNames() override;
+
+    void Spin() override;
+    bool Quit() override;
+    int GetEventFd() override;
+
+    void LogInfo(std::string msg) override;
+    void LogWarning(std::string msg) override;
+    void LogError(std::string msg) override;
+
+    void ReportCansUtilization(std::vector<float> util,
+                               std::vector<float> util_ewma) override;
+    void ReportFailover(BoardInstance inst, float latency_ms) override;
+    void ReportEmergencyStop(std::vector<float> latencies_us) override;
+    void ReportGroupCommandStatus(uint32_t request_id, uint8_t command_id,
+                                  BoardInstance inst, bool success) override;
+
+    std::shared_ptr<FrontendBoardHandler> NewBoard(BoardInstance inst) override;
+};
+
+class ShmBoardHandler : public FrontendBoardHandler,
+                        public std::enable_shared_from_this<ShmBoardHandler>
+{
+    friend class ShmFrontend;
+    ShmFrontend *shm_frontend;
+
+    // ffid -> index of the field in the segment, -1 for functions
+    std::vector<int> field_index;
+
+    Logger log{"ShmBoardHandler"};
+
+  public:
+    BoardInstance board;
+
+    sptr<BoardCommunicationHandler> BackendReady();
+
+    void FFDataInbound(std::vector<uint8_t> &data, int ffid) override;
+
+    virtual void
+        ReplaceBackendHandler(sptr<BoardCommunicationHandler>) override;
+    virtual void Shutdown() override;
+    virtual void ConnectionLost() override;
+
+    ShmBoardHandler(BoardInstance inst, ShmFrontend *shm_frontend);
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <inttypes.h>
+
+// Layout of the shared memory segment written by the ShmFrontend and read by
+// rubi_shm_client. The segment is mapped at different addresses in every
+// process, so everything in it is referenced by indices or offsets.
+
+#define RUBI_SHM_MAGIC 0x49425552 // "RUBI"
+#define RUBI_SHM_VERSION 1
+
+#define RUBI_SHM_NAME_LEN 64
+#define RUBI_SHM_MAX_BOARDS 256
+#define RUBI_SHM_MAX_FIELDS 4096
+#define RUBI_SHM_RING_SIZE 256 // power of two
+#define RUBI_SHM_MAX_COMMAND_SIZE 256
+#define RUBI_SHM_SLOT_ALIGN 64
+
+enum rubi_shm_command_t
+{
+    rubi_shm_field_write = 1,
+    rubi_shm_wake,
+    rubi_shm_sleep,
+    rubi_shm_reboot
+};
+
+struct rubi_shm_board
+{
+    char name[RUBI_SHM_NAME_LEN];
+    char id[RUBI_SHM_NAME_LEN];
+    uint32_t first_field;
+    uint32_t fields_count;
+};
+
+struct rubi_shm_field
+{
+    char name[RUBI_SHM_NAME_LEN];
+    uint32_t board;
+    uint32_t ffid;
+    uint8_t typecode;
+    uint8_t access;
+    uint16_t size;
+    uint64_t slot; // offset of the rubi_shm_slot from the segment start
+};
+
+// written by the server only, the value follows the slot header
+struct rubi_shm_slot
+{
+    std::atomic<uint32_t> seq; // odd while being written, 0 if never
+    uint32_t size;
+    uint64_t stamp_ns; // CLOCK_MONOTONIC of the last update
+};
+
+struct rubi_shm_command
+{
+    std::atomic<uint64_t> seq;
+    uint32_t board;
+    uint32_t ffid;
+    uint16_t size;
+    uint8_t command;
+    uint8_t data[RUBI_SHM_MAX_COMMAND_SIZE];
+};
+
+struct rubi_shm_header
+{
+    std::atomic<uint32_t> magic; // set once the segment is ready
+    uint32_t version;
+    uint64_t size;
+
+    // unix datagram socket which wakes the server up
+    char doorbell_path[108];
+    std::atomic<uint32_t> doorbell_pending;
+
+    // boards and fields are append-only, a board becomes visible to the
+    // clients once boards_count covers it
+    std::atomic<uint32_t> boards_count;
+    uint32_t fields_count;
+    uint64_t slots_used;
+
+    // commands from the clients, bounded MPMC queue after D. Vyukov
+    alignas(64) std::atomic<uint64_t> ring_head;
+    alignas(64) uint64_t ring_tail;
+    rubi_shm_command ring[RUBI_SHM_RING_SIZE];
+
+    rubi_shm_board boards[RUBI_SHM_MAX_BOARDS];
+    rubi_shm_field fields[RUBI_SHM_MAX_FIELDS];
+};
+
+inline uint64_t rubi_shm_slots_start()
+{
+    return (sizeof(rubi_shm_header) + RUBI_SHM_SLOT_ALIGN - 1) /
+           RUBI_SHM_SLOT_ALIGN * RUBI_SHM_SLOT_ALIGN;
+}
+
+inline rubi_shm_slot *rubi_shm_get_slot(rubi_shm_header *header,
+                                        uint64_t offset)
+{
+    return reinterpret_cast<rubi_shm_slot *>(
+        reinterpret_cast<uint8_t *>(header) + offset);
+}
+
+inline uint8_t *rubi_shm_slot_data(rubi_shm_slot *slot)
+{
+    return reinterpret_cast<uint8_t *>(slot) + sizeof(rubi_shm_slot);
+}
+
+// seqlock writer, there is a single one per slot
+inline void rubi_shm_slot_write(rubi_shm_slot *slot, const uint8_t *data,
+                                uint32_t size, uint64_t stamp_ns)
+{
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(rubi_shm_slot_data(slot), data, size);
+    slot->stamp_ns = stamp_ns;
+
+    slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+// false if the slot has never been written
+inline bool rubi_shm_slot_read(rubi_shm_slot *slot, uint8_t *data,
+                               uint32_t size, uint64_t *stamp_ns)
+{
+    uint32_t seq_before, seq_after;
+    uint64_t stamp;
+
+    do
+    {
+        seq_before = slot->seq.load(std::memory_order_acquire);
+        if (seq_before == 0)
+            return false;
+        if (seq_before & 1)
+            continue;
+
+        memcpy(data, rubi_shm_slot_data(slot), size);
+        stamp = slot->stamp_ns;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_after = slot->seq.load(std::memory_order_relaxed);
+    } while ((seq_before & 1) || seq_before != seq_after);
+
+    if (stamp_ns)
+        *stamp_ns = stamp;
+
+    return true;
+}
+
+// false if the ring is full or the command too large
+inline bool rubi_shm_push_command(rubi_shm_header *header,
+                                  const rubi_shm_command &command)
+{
+    if (command.size > RUBI_SHM_MAX_COMMAND_SIZE)
+        return false;
+
+    uint64_t pos = header->ring_head.load(std::memory_order_relaxed);
+    rubi_shm_command *cell;
+
+    for (;;)
+    {
+        cell = &header->ring[pos % RUBI_SHM_RING_SIZE];
+        int64_t diff = (int64_t)cell->seq.load(std::memory_order_acquire) -
+                       (int64_t)pos;
+
+        if (diff == 0)
+        {
+            if (header->ring_head.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = header->ring_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->board = command.board;
+    cell->ffid = command.ffid;
+    cell->size = command.size;
+    cell->command = command.command;
+    memcpy(cell->data, command.data, command.size);
+
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+// single consumer, the server. Any client can write the ring, so cells
+// claiming more data than they can hold are dropped.
+inline bool rubi_shm_pop_command(rubi_shm_header *header,
+                                 rubi_shm_command &command)
+{
+    for (;;)
+    {
+        uint64_t pos = header->ring_tail;
+        rubi_shm_command *cell = &header->ring[pos % RUBI_SHM_RING_SIZE];
+
+        if (cell->seq.load(std::memory_order_acquire) != pos + 1)
+            return false;
+
+        // read once, the client may still be scribbling over the cell
+        uint16_t size = *(volatile uint16_t *)&cell->size;
+        bool valid = size <= RUBI_SHM_MAX_COMMAND_SIZE;
+
+        if (valid)
+        {
+            command.board = cell->board;
+            command.ffid = cell->ffid;
+            command.size = size;
+            command.command = cell->command;
+            memcpy(command.data, cell->data, size);
+        }
+
+        cell->seq.store(pos + RUBI_SHM_RING_SIZE, std::memory_order_release);
+        header->ring_tail = pos + 1;
+
+        if (valid)
+            return true;
+    }
+}
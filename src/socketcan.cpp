@@ -1,14 +1,20 @@
 
 
+#include "can_bits.h"
 #include "exceptions.h"
 #include "socketcan.h"
+#include "trace.h"
 #include "types.h"
 
+#include <sys/time.h>
 #include <thread>
 
 // http://stackoverflow.com/questions/15723061/how-to-check-if-interface-is-up
 bool SocketCan::IsInterfaceAvaliable(std::string port)
 {
+    if (IsInproc(port))
+        return true;
+
     struct ifreq ifr;
     int sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
     memset(&ifr, 0, sizeof(ifr));
@@ -21,29 +27,102 @@ bool SocketCan::IsInterfaceAvaliable(std::string port)
     return ifr.ifr_flags & IFF_UP;
 }
 
+bool SocketCan::IsInproc(std::string port)
+{
+    return port.compare(0, 7, "inproc:") == 0;
+}
+
 SocketCan::~SocketCan()
 {
-    close(soc);
+    if (!inproc)
+        close(soc);
+}
+
+int SocketCan::GetFd() { return soc; }
+
+void SocketCan::DisableReceive()
+{
+    if (inproc)
+        return inproc->DisableReceive();
+
+    setsockopt(soc, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
 }
 
 size_t SocketCan::GetTotalReceivedDataSize() { return rx_data_n; }
 
 size_t SocketCan::GetTotalTransmittedDataSize() { return tx_data_n; }
 
-bool SocketCan::Send(std::pair<uint16_t, std::vector<uint8_t>> data, bool block)
+size_t SocketCan::GetTotalReceivedFramesCount() { return rx_frames_n; }
+
+size_t SocketCan::GetTotalTransmittedFramesCount() { return tx_frames_n; }
+
+uint64_t SocketCan::GetTotalReceivedBits() { return rx_bits_n; }
+
+uint64_t SocketCan::GetTotalTransmittedBits() { return tx_bits_n; }
+
+void SocketCan::SetExactBitStuffing(bool exact) { exact_bit_stuffing = exact; }
+
+int SocketCan::GetLastReceivedBits() { return last_rx_bits; }
+
+int SocketCan::GetLastTransmittedBits() { return last_tx_bits; }
+
+const std::unordered_map<uint32_t, can_id_traffic_t> &SocketCan::GetIdTraffic()
 {
+    return id_traffic;
+}
+
+int SocketCan::FrameBits(const can_frame &frame)
+{
+    if (exact_bit_stuffing)
+        return CanFrameBits(frame.can_id, frame.data, frame.can_dlc);
+
+    return CanFrameBitsWorstCase(frame.can_id & CAN_EFF_FLAG, frame.can_dlc);
+}
+
+int SocketCan::GetTxQueueDepth()
+{
+    int queued = 0;
+    if (!inproc)
+        ioctl(soc, SIOCOUTQ, &queued);
+
+    return queued;
+}
+
+bool SocketCan::Send(std::pair<uint32_t, std::vector<uint8_t>> data, bool block)
+{
+    return Send(data.first, data.second.data(), data.second.size(), block);
+}
+
+bool SocketCan::Send(uint32_t id, const uint8_t *data, uint8_t size,
+                     bool block)
+{
+    TRACE_SCOPE("can_send", id);
+
     int retval;
     can_frame frame;
 
-    frame.can_dlc = data.second.size();
-    memcpy(frame.data, data.second.data(), frame.can_dlc);
-    frame.can_id = data.first;
+    frame.can_dlc = size;
+    memcpy(frame.data, data, frame.can_dlc);
+    frame.can_id = id;
 
     do{
-        retval = write(soc, &frame, sizeof(struct can_frame));
+        if (inproc)
+        {
+            inproc->Send(frame);
+            retval = sizeof(struct can_frame);
+        }
+        else
+            retval = write(soc, &frame, sizeof(struct can_frame));
 
         if (retval == sizeof(struct can_frame)) {
-            tx_data_n += data.second.size();
+            tx_data_n += size;
+            tx_frames_n += 1;
+            last_tx_bits = FrameBits(frame);
+            tx_bits_n += last_tx_bits;
+
+            auto &traffic = id_traffic[frame.can_id];
+            traffic.tx_frames += 1;
+            traffic.tx_bits += last_tx_bits;
             return true;
         }
 
@@ -53,15 +132,26 @@ bool SocketCan::Send(std::pair<uint16_t, std::vector<uint8_t>> data, bool block)
     return false;
 }
 
-boost::optional<std::tuple<uint16_t, std::vector<uint8_t>, timeval>>
+boost::optional<std::tuple<uint32_t, std::vector<uint8_t>, timeval>>
 SocketCan::Receive(uint32_t timeout_ms)
 {
-    struct can_frame frame_rd;
+    std::pair<uint32_t, std::vector<uint8_t>> rx;
+    timeval tv;
+
+    if (!Receive(timeout_ms, rx, tv))
+        return boost::none;
 
+    return std::tuple<uint32_t, std::vector<uint8_t>, timeval>(
+        rx.first, std::move(rx.second), tv);
+}
+
+bool SocketCan::Receive(uint32_t timeout_ms,
+                        std::pair<uint32_t, std::vector<uint8_t>> &rx,
+                        timeval &tv)
+{
     msghdr msg = smsg;
     cmsghdr *cmsg;
-    timeval tv;
-    std::vector<uint8_t> data;
+    auto &data = rx.second;
 
     fd_set readSet;
     FD_ZERO(&readSet);
@@ -72,9 +162,21 @@ SocketCan::Receive(uint32_t timeout_ms)
     {
         if (FD_ISSET(soc, &readSet))
         {
-            iov.iov_len = sizeof(can_frame);
+            if (inproc)
+            {
+                if (!inproc->Receive(frame))
+                    return false;
+
+                gettimeofday(&tv, NULL);
+                msg.msg_controllen = 0;
+            }
+            else
+            {
+                iov.iov_len = sizeof(can_frame);
+                recvmsg(soc, &msg, 0);
+            }
 
-            auto nbytes_can = recvmsg(soc, &msg, 0);
+            TRACE_INSTANT("can_read", frame.can_id);
             for (cmsg = CMSG_FIRSTHDR(&msg);
                  cmsg && (cmsg->cmsg_level == SOL_SOCKET);
                  cmsg = CMSG_NXTHDR(&msg, cmsg))
@@ -88,7 +190,8 @@ SocketCan::Receive(uint32_t timeout_ms)
                     uint32_t dropped_new = *(uint32_t *)CMSG_DATA(cmsg);
                     if (dropped_new > dropped) 
                     {
-                        log.Warning("dropped can frames due to receive buffer overflow");
+                        LOG_WARNING(log, "dropped can frames due to receive "
+                                         "buffer overflow");
                         dropped = dropped_new;
                     }
                 }
@@ -98,17 +201,31 @@ SocketCan::Receive(uint32_t timeout_ms)
             memcpy(data.data(), frame.data, data.size());
 
             rx_data_n += data.size();
+            rx_frames_n += 1;
+            last_rx_bits = FrameBits(frame);
+            rx_bits_n += last_rx_bits;
 
-            return std::tuple<uint16_t, std::vector<uint8_t>, timeval>(
-                frame.can_id, data, tv);
+            auto &traffic = id_traffic[frame.can_id];
+            traffic.rx_frames += 1;
+            traffic.rx_bits += last_rx_bits;
+
+            rx.first = frame.can_id;
+            return true;
         }
     }
 
-    return boost::none;
+    return false;
 }
 
 SocketCan::SocketCan(std::string port)
 {
+    if (IsInproc(port))
+    {
+        inproc.reset(new InprocCanEndpoint(port.substr(7)));
+        soc = inproc->GetFd();
+        return;
+    }
+
     struct ifreq ifr;
     /* open socket */
 
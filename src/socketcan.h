@@ -3,6 +3,7 @@
 #include <inttypes.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/sockios.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <fcntl.h>
@@ -12,18 +13,38 @@
 #include <unistd.h>
 
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 #include <cstring>
 #include <boost/optional/optional.hpp>
 
+#include "inproc_can.h"
 #include "logger.h"
 
+struct can_id_traffic_t
+{
+    uint64_t rx_frames = 0;
+    uint64_t rx_bits = 0;
+    uint64_t tx_frames = 0;
+    uint64_t tx_bits = 0;
+};
+
 class SocketCan
 {
     int soc;
     int read_can_port;
     size_t rx_data_n = 0;
     size_t tx_data_n = 0;
+    size_t rx_frames_n = 0;
+    size_t tx_frames_n = 0;
+    uint64_t rx_bits_n = 0;
+    uint64_t tx_bits_n = 0;
+    bool exact_bit_stuffing = true;
+    int last_rx_bits = 0;
+    int last_tx_bits = 0;
+
+    // keyed by the identifier, including CAN_EFF_FLAG
+    std::unordered_map<uint32_t, can_id_traffic_t> id_traffic;
     uint32_t dropped = 0;
 
     struct can_frame frame;
@@ -32,17 +53,49 @@ class SocketCan
     msghdr smsg;
     struct iovec iov;
 
+    // set for ports named inproc:<bus>, soc is then its event fd
+    std::unique_ptr<InprocCanEndpoint> inproc;
+
     Logger log{"SocketCan"};
 
+    int FrameBits(const can_frame &frame);
+
   public:
     static bool IsInterfaceAvaliable(std::string port);
+    static bool IsInproc(std::string port);
+
+    // for sockets which are only used for sending
+    void DisableReceive();
+
+    int GetFd();
 
     size_t GetTotalReceivedDataSize();
     size_t GetTotalTransmittedDataSize();
+    size_t GetTotalReceivedFramesCount();
+    size_t GetTotalTransmittedFramesCount();
+
+    // bits the frames took on the bus, including the protocol overhead
+    uint64_t GetTotalReceivedBits();
+    uint64_t GetTotalTransmittedBits();
+    // otherwise every frame is assumed to be stuffed as much as possible
+    void SetExactBitStuffing(bool exact);
+    // length of the frame last returned by Receive() / written by Send()
+    int GetLastReceivedBits();
+    int GetLastTransmittedBits();
+    const std::unordered_map<uint32_t, can_id_traffic_t> &GetIdTraffic();
+
+    // bytes queued in the socket, waiting for the bus
+    int GetTxQueueDepth();
 
-    bool Send(std::pair<uint16_t, std::vector<uint8_t>> data, bool block=true);
-    boost::optional<std::tuple<uint16_t, std::vector<uint8_t>, timeval>>
+    // identifiers are canid_t, extended frames carry CAN_EFF_FLAG
+    bool Send(std::pair<uint32_t, std::vector<uint8_t>> data, bool block=true);
+    bool Send(uint32_t id, const uint8_t *data, uint8_t size, bool block=true);
+    boost::optional<std::tuple<uint32_t, std::vector<uint8_t>, timeval>>
     Receive(uint32_t timeout_ms);
+    // into a frame of the caller, whose data keeps its capacity from one
+    // frame to the next, false if there was none
+    bool Receive(uint32_t timeout_ms,
+                 std::pair<uint32_t, std::vector<uint8_t>> &rx, timeval &tv);
 
     SocketCan(std::string port);
     ~SocketCan();
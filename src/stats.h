@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <inttypes.h>
+#include <memory>
+
+// Counters have a single writer, the server thread, but may be read from any
+// thread. Increments are therefore plain relaxed load/store pairs instead of
+// locked read-modify-writes.
+inline void StatsAdd(std::atomic<uint64_t> &counter, uint64_t value = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+}
+
+struct traffic_stats_t
+{
+    std::atomic<uint64_t> rx_messages{0};
+    std::atomic<uint64_t> rx_bytes{0};
+    std::atomic<uint64_t> tx_messages{0};
+    std::atomic<uint64_t> tx_bytes{0};
+
+    // CAN frames the messages took, and their length on the wire
+    std::atomic<uint64_t> rx_frames{0};
+    std::atomic<uint64_t> rx_bits{0};
+    std::atomic<uint64_t> tx_frames{0};
+    std::atomic<uint64_t> tx_bits{0};
+
+    void CountRx(uint64_t bytes)
+    {
+        StatsAdd(rx_messages);
+        StatsAdd(rx_bytes, bytes);
+    }
+
+    void CountTx(uint64_t bytes)
+    {
+        StatsAdd(tx_messages);
+        StatsAdd(tx_bytes, bytes);
+    }
+
+    void CountRxFrames(uint64_t frames, uint64_t bits)
+    {
+        StatsAdd(rx_frames, frames);
+        StatsAdd(rx_bits, bits);
+    }
+
+    void CountTxFrames(uint64_t frames, uint64_t bits)
+    {
+        StatsAdd(tx_frames, frames);
+        StatsAdd(tx_bits, bits);
+    }
+};
+
+struct board_stats_t
+{
+    // CAN frames from and to the board
+    traffic_stats_t frames;
+
+    std::atomic<uint64_t> block_transfer_failures{0};
+    std::atomic<uint64_t> keepalives_missed{0};
+    // not counted as missed, the server was late, see LoopMonitor
+    std::atomic<uint64_t> keepalives_compensated{0};
+
+    // field and function messages, indexed by ffid
+    std::unique_ptr<traffic_stats_t[]> fields;
+    size_t fields_count = 0;
+};
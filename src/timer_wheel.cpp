@@ -0,0 +1,128 @@
+#include "timer_wheel.h"
+#include "exceptions.h"
+
+#include <algorithm>
+
+TimerWheel::TimerWheel(std::chrono::milliseconds resolution, uint32_t slots_n)
+    : resolution(resolution)
+{
+    ASSERT(resolution.count() > 0 && slots_n > 0);
+
+    slots.resize(slots_n);
+    slots_load.resize(slots_n, 0);
+}
+
+uint64_t TimerWheel::ToTicks(std::chrono::milliseconds duration)
+{
+    return std::max((uint64_t)1, (uint64_t)((duration.count() +
+                                              resolution.count() - 1) /
+                                             resolution.count()));
+}
+
+void TimerWheel::Insert(std::shared_ptr<timer_entry> entry)
+{
+    auto slot = entry->deadline % slots.size();
+
+    slots[slot].push_back(entry);
+    slots_load[slot] += 1;
+}
+
+TimerWheel::timer_id
+TimerWheel::SchedulePeriodic(std::chrono::milliseconds period,
+                             std::function<void()> callback)
+{
+    auto entry = std::make_shared<timer_entry>();
+    entry->id = next_id++;
+    entry->period = ToTicks(period);
+    entry->cancelled = false;
+    entry->callback = callback;
+
+    // phase the timer into the least crowded slot of its first period
+    uint64_t window = std::min(entry->period, (uint64_t)slots.size());
+    uint64_t best_tick = current_tick + 1;
+
+    for (uint64_t tick = current_tick + 1; tick <= current_tick + window;
+         tick++)
+    {
+        if (slots_load[tick % slots.size()] <
+            slots_load[best_tick % slots.size()])
+            best_tick = tick;
+    }
+
+    entry->deadline = best_tick;
+    Insert(entry);
+    timers[entry->id] = entry;
+
+    return entry->id;
+}
+
+void TimerWheel::Cancel(timer_id id)
+{
+    auto timer = timers.find(id);
+    if (timer == timers.end())
+        return;
+
+    timer->second->cancelled = true;
+    slots_load[timer->second->deadline % slots.size()] -= 1;
+    timers.erase(timer);
+}
+
+void TimerWheel::ProcessTick()
+{
+    auto slot = current_tick % slots.size();
+    std::vector<std::shared_ptr<timer_entry>> entries;
+    entries.swap(slots[slot]);
+
+    for (auto &entry : entries)
+    {
+        if (entry->cancelled)
+            continue;
+
+        if (entry->deadline > current_tick)
+        {
+            slots[slot].push_back(entry);
+            continue;
+        }
+
+        slots_load[slot] -= 1;
+        while (entry->deadline <= current_tick)
+            entry->deadline += entry->period;
+        Insert(entry);
+
+        // may cancel or schedule timers, including this one
+        entry->callback();
+    }
+}
+
+void TimerWheel::Advance(time_point now)
+{
+    if (!started)
+    {
+        start_time = now;
+        started = true;
+        return;
+    }
+
+    if (now <= start_time)
+        return;
+
+    uint64_t target_tick =
+        std::chrono::duration_cast<std::chrono::milliseconds>(now -
+                                                              start_time)
+            .count() /
+        resolution.count();
+
+    // after a long stall a single turn of the wheel visits every slot
+    if (target_tick > current_tick + slots.size())
+        current_tick = target_tick - slots.size();
+
+    while (current_tick < target_tick)
+    {
+        current_tick += 1;
+        ProcessTick();
+    }
+}
+
+std::chrono::milliseconds TimerWheel::GetResolution() { return resolution; }
+
+size_t TimerWheel::GetTimersCount() { return timers.size(); }
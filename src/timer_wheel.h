@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <inttypes.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Hashed timer wheel for periodic work. New timers are phased into the least
+// loaded slot of their first period, so N timers with equal periods end up
+// spread evenly over that period instead of firing in one burst.
+class TimerWheel
+{
+  public:
+    typedef std::chrono::system_clock::time_point time_point;
+    typedef uint64_t timer_id;
+
+  private:
+    struct timer_entry
+    {
+        timer_id id;
+        uint64_t deadline; // in ticks
+        uint64_t period;   // in ticks
+        bool cancelled;
+        std::function<void()> callback;
+    };
+
+    std::chrono::milliseconds resolution;
+    std::vector<std::vector<std::shared_ptr<timer_entry>>> slots;
+    std::vector<uint32_t> slots_load;
+    std::map<timer_id, std::shared_ptr<timer_entry>> timers;
+
+    timer_id next_id = 1;
+    uint64_t current_tick = 0;
+    bool started = false;
+    time_point start_time;
+
+    uint64_t ToTicks(std::chrono::milliseconds duration);
+    void Insert(std::shared_ptr<timer_entry> entry);
+    void ProcessTick();
+
+  public:
+    TimerWheel(std::chrono::milliseconds resolution =
+                   std::chrono::milliseconds(10),
+               uint32_t slots_n = 512);
+
+    // callback is invoked every period, starting within the first period
+    timer_id SchedulePeriodic(std::chrono::milliseconds period,
+                              std::function<void()> callback);
+    void Cancel(timer_id id);
+    void Advance(time_point now);
+
+    std::chrono::milliseconds GetResolution();
+    size_t GetTimersCount();
+};
@@ -0,0 +1,133 @@
+#include "trace.h"
+
+#ifdef RUBI_TRACING
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+struct event_t
+{
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t arg;
+    char phase;
+};
+
+const size_t ring_size = 1 << 15;
+
+// written by its thread only, the lock is uncontended but while dumping
+struct ring_t
+{
+    std::mutex lock;
+    uint64_t head = 0;
+    pid_t tid;
+    event_t events[ring_size];
+};
+
+// rings outlive their threads, so that events of finished ones are dumped
+std::mutex rings_lock;
+std::vector<std::shared_ptr<ring_t>> rings;
+
+ring_t &GetRing()
+{
+    // owned by the rings above
+    thread_local ring_t *ring = nullptr;
+
+    if (!ring)
+    {
+        auto new_ring = std::make_shared<ring_t>();
+        new_ring->tid = syscall(SYS_gettid);
+
+        std::lock_guard<std::mutex> guard(rings_lock);
+        rings.push_back(new_ring);
+        ring = new_ring.get();
+    }
+
+    return *ring;
+}
+} // namespace
+
+uint64_t Trace::Now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void Trace::Record(const char *name, char phase, uint64_t start_ns,
+                   uint64_t duration_ns, uint64_t arg)
+{
+    auto &ring = GetRing();
+
+    std::lock_guard<std::mutex> guard(ring.lock);
+    ring.events[ring.head % ring_size] = {name, start_ns, duration_ns, arg,
+                                          phase};
+    ring.head += 1;
+}
+
+int Trace::Dump(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+        return -1;
+
+    int written = 0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    std::lock_guard<std::mutex> guard(rings_lock);
+
+    // copied under the ring's lock, written out without holding up its
+    // thread any longer
+    std::vector<event_t> events;
+    events.reserve(ring_size);
+
+    for (const auto &ring : rings)
+    {
+        events.clear();
+        {
+            std::lock_guard<std::mutex> ring_guard(ring->lock);
+            uint64_t count = std::min<uint64_t>(ring->head, ring_size);
+
+            for (uint64_t i = ring->head - count; i < ring->head; i++)
+                events.push_back(ring->events[i % ring_size]);
+        }
+
+        for (const auto &event : events)
+        {
+            fprintf(file,
+                    "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"arg\":%" PRIu64 "}",
+                    written ? "," : "", event.name, event.phase,
+                    event.start_ns / 1000.0, getpid(), ring->tid, event.arg);
+
+            if (event.phase == 'X')
+                fprintf(file, ",\"dur\":%.3f}", event.duration_ns / 1000.0);
+            else
+                fprintf(file, ",\"s\":\"t\"}");
+
+            written += 1;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return written;
+}
+
+#else
+
+int Trace::Dump(const std::string &) { return -1; }
+
+#endif
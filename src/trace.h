@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+
+// Tracepoints on the frame path, compiled in only with -DRUBI_TRACING.
+// Every thread records into a ring of its own, which Trace::Dump() writes
+// out in the Chrome trace event format, as read by chrome://tracing and
+// Perfetto.
+namespace Trace
+{
+// number of events written, -1 if tracing is not compiled in or the file
+// can't be written
+int Dump(const std::string &path);
+} // namespace Trace
+
+#ifdef RUBI_TRACING
+
+#include <inttypes.h>
+
+namespace Trace
+{
+uint64_t Now();
+void Record(const char *name, char phase, uint64_t start_ns,
+            uint64_t duration_ns, uint64_t arg);
+
+class Scope
+{
+    const char *name;
+    uint64_t arg;
+    uint64_t start_ns;
+
+  public:
+    Scope(const char *name, uint64_t arg)
+        : name(name), arg(arg), start_ns(Now())
+    {
+    }
+
+    ~Scope() { Record(name, 'X', start_ns, Now() - start_ns, arg); }
+};
+} // namespace Trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// name must be a string literal, arg is e.g. a CAN identifier or an ffid
+#define TRACE_SCOPE(name, arg) \
+    Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+#define TRACE_INSTANT(name, arg) \
+    Trace::Record(name, 'i', Trace::Now(), 0, arg)
+
+#else
+
+#define TRACE_SCOPE(name, arg) \
+    do                         \
+    {                          \
+    } while (0)
+#define TRACE_INSTANT(name, arg) \
+    do                           \
+    {                            \
+    } while (0)
+
+#endif
@@ -0,0 +1,233 @@
+#include <algorithm>
+
+#include "board.h"
+#include "communication.h"
+#include "traffic_analyzer.h"
+
+const int TrafficAnalyzer::baseline_windows;
+const int TrafficAnalyzer::baseline_warmup;
+constexpr float TrafficAnalyzer::baseline_min_rate;
+
+void TrafficAnalyzer::Sample()
+{
+    auto now = std::chrono::steady_clock::now();
+    float duration_s = std::chrono::duration<float>(now - sampled).count();
+    sampled = now;
+
+    if (duration_s <= 0)
+        return;
+
+    window_t window;
+    window.duration_s = duration_s;
+
+    // only counters seen now are kept, so that vanished boards drop out
+    decltype(previous) seen;
+    auto delta = [&](const void *owner, uint32_t key, uint64_t frames,
+                     uint64_t bits) {
+        auto counters = std::make_pair(owner, key);
+        auto last = previous.find(counters);
+        seen[counters] = std::make_pair(frames, bits);
+
+        // counters which went back are new ones at a recycled address
+        if (last == previous.end() || last->second.first > frames ||
+            last->second.second > bits)
+            return std::make_pair(frames, bits);
+
+        return std::make_pair(frames - last->second.first,
+                              bits - last->second.second);
+    };
+
+    for (const auto &can_entry : BoardManager::inst().cans)
+    {
+        auto &can = can_entry.second;
+        auto &socket = can->GetSocket();
+
+        for (const auto &id_entry : socket.GetIdTraffic())
+        {
+            const auto &traffic = id_entry.second;
+            auto counts = delta(&socket, id_entry.first,
+                                traffic.rx_frames + traffic.tx_frames,
+                                traffic.rx_bits + traffic.tx_bits);
+            if (!counts.first)
+                continue;
+
+            entry_t entry;
+            entry.talker.bus = can_entry.first;
+            entry.talker.can_id = id_entry.first;
+            entry.frames = counts.first;
+            entry.bits = counts.second;
+            entry.bitrate = can->GetBitrate();
+
+            auto handler = can->GetHandler(id_entry.first);
+            if (handler && handler->GetBoard().descriptor)
+            {
+                auto board = handler->GetBoard();
+                entry.talker.board = board.descriptor->board_name;
+                entry.talker.id = board.id.is_initialized() ? *board.id : "";
+            }
+
+            window.by_id.push_back(entry);
+        }
+
+        for (const auto &handler : can->GetHandlers())
+        {
+            auto &stats = handler->stats;
+            auto board = handler->GetBoard();
+
+            for (size_t ffid = 0; ffid < stats.fields_count; ffid++)
+            {
+                const auto &traffic = stats.fields[ffid];
+                auto counts = delta(&traffic, 0,
+                                    traffic.rx_frames + traffic.tx_frames,
+                                    traffic.rx_bits + traffic.tx_bits);
+
+                entry_t entry;
+                entry.talker.bus = can_entry.first;
+                entry.talker.board = board.descriptor->board_name;
+                entry.talker.id = board.id.is_initialized() ? *board.id : "";
+                entry.talker.field = board.descriptor->layout.GetName(ffid);
+                entry.frames = counts.first;
+                entry.bits = counts.second;
+                entry.bitrate = can->GetBitrate();
+
+                // silent fields are checked too, a field may stop altogether
+                entry.talker.rate_changed = UpdateBaseline(
+                    GetFieldKey(*handler, ffid), counts.first / duration_s);
+
+                if (entry.frames)
+                    window.by_field.push_back(entry);
+            }
+        }
+    }
+
+    previous = std::move(seen);
+
+    std::lock_guard<std::mutex> guard(windows_lock);
+    windows.push_back(std::move(window));
+    while (windows.size() > (size_t)BoardManager::inst().traffic_windows)
+        windows.pop_front();
+}
+
+void TrafficAnalyzer::Forget(BoardCommunicationHandler &handler)
+{
+    auto &stats = handler.stats;
+
+    for (size_t ffid = 0; ffid < stats.fields_count; ffid++)
+        previous.erase(std::make_pair((const void *)&stats.fields[ffid], 0u));
+
+    if (!handler.GetBoard().descriptor)
+        return;
+
+    for (size_t ffid = 0; ffid < stats.fields_count; ffid++)
+        baselines.erase(GetFieldKey(handler, ffid));
+}
+
+std::string TrafficAnalyzer::GetFieldKey(BoardCommunicationHandler &handler,
+                                         size_t ffid)
+{
+    auto board = handler.GetBoard();
+    std::string id = board.id.is_initialized() ? *board.id : "";
+
+    return board.descriptor->board_name + ":" + id + "/" +
+           board.descriptor->layout.GetName(ffid);
+}
+
+bool TrafficAnalyzer::UpdateBaseline(const std::string &field,
+                                     float frame_rate)
+{
+    auto &baseline = baselines[field];
+    float ratio = BoardManager::inst().traffic_change_ratio;
+
+    bool changed =
+        baseline.windows >= baseline_warmup &&
+        std::max(frame_rate, baseline.frame_rate) >= baseline_min_rate &&
+        (frame_rate > baseline.frame_rate * ratio ||
+         frame_rate * ratio < baseline.frame_rate);
+
+    if (changed && !baseline.changed)
+    {
+        LOG_WARNING(log, "Rate of " + field + " changed from " +
+                         std::to_string((int)baseline.frame_rate) + " to " +
+                         std::to_string((int)frame_rate) + " frames/s.");
+    }
+
+    baseline.changed = changed;
+
+    // a plain mean while warming up, an EWMA afterwards
+    baseline.windows += 1;
+    baseline.frame_rate += (frame_rate - baseline.frame_rate) /
+                           std::min(baseline.windows, baseline_windows);
+
+    return changed;
+}
+
+std::vector<TrafficAnalyzer::talker_t>
+TrafficAnalyzer::GetTopTalkers(size_t top, size_t windows_count, bool by_field)
+{
+    std::map<std::tuple<std::string, uint32_t, std::string>, entry_t> sums;
+    float duration_s = 0;
+
+    {
+        std::lock_guard<std::mutex> guard(windows_lock);
+
+        if (!windows_count || windows_count > windows.size())
+            windows_count = windows.size();
+
+        for (auto window = windows.end() - windows_count;
+             window != windows.end(); window++)
+        {
+            duration_s += window->duration_s;
+
+            for (const auto &entry : by_field ? window->by_field
+                                              : window->by_id)
+            {
+                auto key =
+                    by_field ? std::make_tuple(entry.talker.bus, 0u,
+                                               entry.talker.board + ":" +
+                                                   entry.talker.id + "/" +
+                                                   entry.talker.field)
+                             : std::make_tuple(entry.talker.bus,
+                                               entry.talker.can_id,
+                                               std::string());
+
+                auto sum = sums.find(key);
+                if (sum == sums.end())
+                {
+                    sums[key] = entry;
+                    continue;
+                }
+
+                // the board an identifier belongs to may have changed, the
+                // latest one is reported
+                bool rate_changed = sum->second.talker.rate_changed;
+                sum->second.talker = entry.talker;
+                sum->second.talker.rate_changed |= rate_changed;
+                sum->second.frames += entry.frames;
+                sum->second.bits += entry.bits;
+            }
+        }
+    }
+
+    std::vector<talker_t> talkers;
+    if (duration_s <= 0)
+        return talkers;
+
+    for (auto &sum : sums)
+    {
+        auto talker = sum.second.talker;
+        talker.frame_rate = sum.second.frames / duration_s;
+        talker.bit_rate = sum.second.bits / duration_s;
+        talker.load = talker.bit_rate / sum.second.bitrate;
+        talkers.push_back(talker);
+    }
+
+    std::sort(talkers.begin(), talkers.end(),
+              [](const talker_t &a, const talker_t &b) {
+                  return a.bit_rate > b.bit_rate;
+              });
+
+    if (top && talkers.size() > top)
+        talkers.resize(top);
+
+    return talkers;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <inttypes.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+
+class BoardCommunicationHandler;
+
+// Turns the cumulative frame and bit counters of the buses and boards into
+// a ring of recent windows, to find out who loads a bus, and warns about
+// fields whose rate suddenly departs from their baseline.
+class TrafficAnalyzer
+{
+  public:
+    struct talker_t
+    {
+        std::string bus;
+        uint32_t can_id = 0; // only for per identifier talkers
+        std::string board;   // empty if no board has the identifier
+        std::string id;
+        std::string field; // only for per field talkers
+        float frame_rate = 0;
+        float bit_rate = 0;
+        float load = 0; // fraction of the bus' bitrate
+        bool rate_changed = false;
+    };
+
+  private:
+    struct entry_t
+    {
+        talker_t talker;
+        uint64_t frames;
+        uint64_t bits;
+        uint32_t bitrate;
+    };
+
+    struct window_t
+    {
+        float duration_s;
+        std::vector<entry_t> by_id;
+        std::vector<entry_t> by_field;
+    };
+
+    struct baseline_t
+    {
+        float frame_rate = 0;
+        int windows = 0;
+        bool changed = false;
+    };
+
+    // windows a baseline averages over, and needs before it is trusted
+    static const int baseline_windows = 30;
+    static const int baseline_warmup = 5;
+    // rates below this many frames/s are too noisy to compare
+    static constexpr float baseline_min_rate = 5;
+
+    std::deque<window_t> windows;
+    std::mutex windows_lock;
+
+    // counter owner, key -> frames, bits at the previous sample
+    std::map<std::pair<const void *, uint32_t>, std::pair<uint64_t, uint64_t>>
+        previous;
+    std::map<std::string, baseline_t> baselines;
+    std::chrono::steady_clock::time_point sampled =
+        std::chrono::steady_clock::now();
+
+    Logger log{"TrafficAnalyzer"};
+
+    static std::string GetFieldKey(BoardCommunicationHandler &handler,
+                                   size_t ffid);
+    bool UpdateBaseline(const std::string &field, float frame_rate);
+
+  public:
+    // closes the current window, called every traffic_window
+    void Sample();
+    // drops the counters and baselines of a handler's fields once it left
+    // the bus, a later handler may get the same addresses
+    void Forget(BoardCommunicationHandler &handler);
+
+    // busiest talkers over the last windows_count windows, all if 0
+    std::vector<talker_t> GetTopTalkers(size_t top, size_t windows_count,
+                                        bool by_field);
+};